@@ -204,7 +204,7 @@ static void createTargets(ApplyMultiplexerData * data) {
 		while(!data->regions->done 
 		      && (length = data->regions->finish - data->regions->start) < MAX_BUFFER
 		      && (!data->head 
-			  || ((total_buffers += length) < MAX_BUFFER_SUM && data->regions->start <= last_finish + MAX_SEEK && !strcmp(data->regions->chrom, data->tail->chrom))
+			  || ((total_buffers += length) < MAX_BUFFER_SUM && data->regions->start <= last_finish + MAX_SEEK && sameChromosome(data->regions->chrom, data->tail->chrom))
 			 )
 		     ) 
 		{
@@ -314,7 +314,7 @@ void ApplyMultiplexerPop(Multiplexer * apply) {
 	// If ongoing targets are reading:
 	// Push enough data to finish the first job
 	if (data->head->values) {
-		while (!data->input->done && data->input->start < data->head->finish && !strcmp(data->input->chrom, data->head->chrom)) {
+		while (!data->input->done && data->input->start < data->head->finish && sameChromosome(data->input->chrom, data->head->chrom)) {
 			pushData(data);
 			pop(data->input);
 		}
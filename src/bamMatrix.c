@@ -0,0 +1,348 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Coverage matrix of a cohort of Bam files.
+// Rather than piling up each file in its own reader, then merging the
+// resulting streams in a generic multiplexer, the reads of all the files
+// are swept together: each row of the multiplexer runs between two
+// consecutive read boundaries of any sample, and holds the coverage of
+// every sample. BGZF inflation runs on the shared htslib pool.
+
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/hts.h"
+#include "multiplexer.h"
+#include "bamReader.h"
+#include "tournament.h"
+
+// Ring window of the per sample breakpoints, reads which span more spill over
+static const int SAMPLE_WINDOW = 1 << 12;
+
+typedef struct sample_st {
+	char * filename;
+	samFile * fp;
+	bam_hdr_t * header;
+	hts_idx_t * idx;
+	hts_itr_t * iter;
+	bam1_t * aln;
+	// Whether aln holds an accepted read yet to be stored
+	bool pending;
+	Breakpoints * starts;
+	Breakpoints * ends;
+	int value;
+	// Sample tid of each cohort chromosome, -1 if absent
+	int * tids;
+} Sample;
+
+typedef struct bamMatrixData_st {
+	Sample * samples;
+	int count;
+	ReadFilter filter;
+	// Union of the chromosomes of all samples, in alphabetical order
+	char ** chroms;
+	int chrom_count;
+	// Chromosomes left to read: [chrom_index, last_chrom_index)
+	int chrom_index;
+	int last_chrom_index;
+	bool loaded;
+	// Region query, if any
+	bool region;
+	int start;
+	int finish;
+	// Position from which the current sample values hold
+	int cursor;
+	// Number of samples with non zero coverage
+	int covered;
+	// Samples queued by the next position where their coverage may change
+	TournamentTree * queue;
+	// Samples taken off the queue at the current breakpoint
+	int * crossing;
+} BamMatrixData;
+
+//////////////////////////////////////////////////////
+// Samples
+//////////////////////////////////////////////////////
+
+static void openSample(Sample * sample, char * filename) {
+	sample->filename = filename;
+	if (!(sample->fp = hts_open(filename, "r")) || !(sample->header = sam_hdr_read(sample->fp))) {
+		fprintf(stderr, "Could not open BAM file %s\n", filename);
+		exit(1);
+	}
+	useInflationThreads(sample->fp);
+	if (!(sample->idx = sam_index_load(sample->fp, filename))) {
+		fprintf(stderr, "Unable to open BAM/SAM index of %s. Make sure alignments are indexed\n", filename);
+		exit(1);
+	}
+	sample->aln = bam_init1();
+	sample->starts = breakpoints_construct_window(SAMPLE_WINDOW);
+	sample->ends = breakpoints_construct_window(SAMPLE_WINDOW);
+}
+
+// Rejected and unmapped reads are skipped here, so that they never become breakpoints
+static void nextSampleRead(BamMatrixData * data, Sample * sample) {
+	do
+		sample->pending = sample->iter && sam_itr_next(sample->fp, sample->iter, sample->aln) >= 0;
+	while (sample->pending && ((sample->aln->core.flag & BAM_FUNMAP) || !acceptRead(&data->filter, sample->aln)));
+}
+
+static void clearBreakpoints(Breakpoints * breakpoints) {
+	while (!breakpoints_empty(breakpoints))
+		breakpoints_remove_min(breakpoints);
+}
+
+static void resetSample(Sample * sample) {
+	if (sample->iter) {
+		hts_itr_destroy(sample->iter);
+		sample->iter = NULL;
+	}
+	sample->pending = false;
+	clearBreakpoints(sample->starts);
+	clearBreakpoints(sample->ends);
+	sample->value = 0;
+}
+
+static void loadSampleChromosome(BamMatrixData * data, Sample * sample) {
+	int tid = sample->tids[data->chrom_index];
+
+	resetSample(sample);
+	if (tid < 0)
+		return;
+
+	// BAM coords are 0-based, queries are 1-based half open
+	if (data->region)
+		sample->iter = sam_itr_queryi(sample->idx, tid, data->start - 1, data->finish - 1);
+	else
+		sample->iter = sam_itr_queryi(sample->idx, tid, 0, sample->header->target_len[tid]);
+
+	if (!sample->iter) {
+		fprintf(stderr, "Unable to iterate through %s within %s BAM file.", data->chroms[data->chrom_index], sample->filename);
+		exit(1);
+	}
+	nextSampleRead(data, sample);
+}
+
+// Queues a sample at the next position where its coverage may change, if any
+static void queueSample(BamMatrixData * data, int index) {
+	Sample * sample = data->samples + index;
+	bool found = false;
+	int next = 0;
+	int candidate;
+
+	if (sample->pending) {
+		// Note that BAM coords are 0-based, hence +1
+		next = sample->aln->core.pos + 1;
+		found = true;
+	}
+	if (!breakpoints_empty(sample->starts)) {
+		candidate = breakpoints_min(sample->starts);
+		if (!found || candidate < next)
+			next = candidate;
+		found = true;
+	}
+	if (!breakpoints_empty(sample->ends)) {
+		candidate = breakpoints_min(sample->ends);
+		if (!found || candidate < next)
+			next = candidate;
+		found = true;
+	}
+
+	if (found)
+		tt_insert(data->queue, next, index);
+}
+
+//////////////////////////////////////////////////////
+// Cohort chromosomes
+//////////////////////////////////////////////////////
+
+static int compareNames(const void * A, const void * B) {
+	return strcmp(*(char **) A, *(char **) B);
+}
+
+static void listChromosomes(BamMatrixData * data) {
+	int total = 0;
+	int index, sample, chrom;
+
+	for (sample = 0; sample < data->count; sample++)
+		total += data->samples[sample].header->n_targets;
+
+	data->chroms = calloc(total > 0? total: 1, sizeof(char *));
+	for (sample = 0; sample < data->count; sample++) {
+		bam_hdr_t * header = data->samples[sample].header;
+		for (index = 0; index < header->n_targets; index++)
+			data->chroms[data->chrom_count++] = header->target_name[index];
+	}
+
+	// Sort and remove duplicates
+	qsort(data->chroms, data->chrom_count, sizeof(char *), compareNames);
+	for (index = 0, chrom = 0; index < data->chrom_count; index++)
+		if (chrom == 0 || strcmp(data->chroms[chrom - 1], data->chroms[index]))
+			data->chroms[chrom++] = data->chroms[index];
+	data->chrom_count = chrom;
+
+	for (sample = 0; sample < data->count; sample++) {
+		data->samples[sample].tids = calloc(data->chrom_count > 0? data->chrom_count: 1, sizeof(int));
+		for (chrom = 0; chrom < data->chrom_count; chrom++)
+			data->samples[sample].tids[chrom] = bam_name2id(data->samples[sample].header, data->chroms[chrom]);
+	}
+}
+
+static int findChromosome(BamMatrixData * data, const char * chrom) {
+	char ** match = bsearch(&chrom, data->chroms, data->chrom_count, sizeof(char *), compareNames);
+	return match? match - data->chroms: -1;
+}
+
+//////////////////////////////////////////////////////
+// Sweep
+//////////////////////////////////////////////////////
+
+// Next position where the coverage of any sample may change
+static bool nextBreakpoint(BamMatrixData * data, int * position) {
+	if (tt_empty(data->queue))
+		return false;
+	*position = tt_min(data->queue);
+	return true;
+}
+
+// Updates the coverage of the samples which change at the given breakpoint
+static void crossBreakpoint(BamMatrixData * data, int position) {
+	int crossing = 0;
+	int index;
+
+	while (tt_notempty(data->queue) && tt_min(data->queue) == position)
+		data->crossing[crossing++] = tt_extractmin(data->queue);
+
+	for (index = 0; index < crossing; index++) {
+		Sample * sample = data->samples + data->crossing[index];
+		bool covered = sample->value != 0;
+
+		while (sample->pending && sample->aln->core.pos + 1 <= position) {
+			storeReadComponents(sample->starts, sample->ends, sample->aln, &data->filter);
+			nextSampleRead(data, sample);
+		}
+		while (!breakpoints_empty(sample->ends) && breakpoints_min(sample->ends) == position)
+			sample->value -= breakpoints_remove_min(sample->ends);
+		while (!breakpoints_empty(sample->starts) && breakpoints_min(sample->starts) == position)
+			sample->value += breakpoints_remove_min(sample->starts);
+
+		if (covered && !sample->value)
+			data->covered--;
+		else if (!covered && sample->value)
+			data->covered++;
+
+		queueSample(data, data->crossing[index]);
+	}
+}
+
+static void BamMatrixPop(Multiplexer * multi) {
+	BamMatrixData * data = (BamMatrixData *) multi->data;
+	int index, start, next;
+	bool emit;
+
+	while (true) {
+		if (!data->loaded) {
+			if (data->chrom_index == data->last_chrom_index) {
+				multi->done = true;
+				return;
+			}
+			tt_clear(data->queue);
+			for (index = 0; index < data->count; index++) {
+				loadSampleChromosome(data, data->samples + index);
+				queueSample(data, index);
+			}
+			data->loaded = true;
+			data->covered = 0;
+			multi->chrom = internChromosome(data->chroms[data->chrom_index]);
+		}
+
+		if (!nextBreakpoint(data, &next)) {
+			data->loaded = false;
+			data->chrom_index++;
+			continue;
+		}
+
+		// The row between the previous breakpoint and this one
+		start = data->cursor;
+		emit = data->covered && (!multi->strict || data->covered == data->count);
+		if (emit) {
+			for (index = 0; index < data->count; index++) {
+				multi->values[index] = data->samples[index].value;
+				multi->inplay[index] = data->samples[index].value != 0;
+			}
+			multi->inplay_count = data->covered;
+		}
+
+		crossBreakpoint(data, next);
+		data->cursor = next;
+
+		if (!emit)
+			continue;
+
+		// Clip to the query region
+		if (data->region) {
+			if (start >= data->finish) {
+				multi->done = true;
+				return;
+			}
+			if (next <= data->start)
+				continue;
+			if (start < data->start)
+				start = data->start;
+			if (next > data->finish)
+				next = data->finish;
+		}
+		multi->start = start;
+		multi->finish = next;
+		return;
+	}
+}
+
+static void BamMatrixSeek(Multiplexer * multi, const char * chrom, int start, int finish) {
+	BamMatrixData * data = (BamMatrixData *) multi->data;
+	int index = findChromosome(data, chrom);
+
+	data->region = true;
+	data->start = start;
+	data->finish = finish;
+	data->loaded = false;
+	if (index < 0) {
+		data->chrom_index = data->last_chrom_index = 0;
+	} else {
+		data->chrom_index = index;
+		data->last_chrom_index = index + 1;
+	}
+	BamMatrixPop(multi);
+}
+
+Multiplexer * BamMatrix(char ** filenames, int count, ReadFilter * filter, bool strict) {
+	BamMatrixData * data = (BamMatrixData *) calloc(1, sizeof(BamMatrixData));
+	int index;
+
+	data->count = count;
+	data->samples = calloc(count, sizeof(Sample));
+	for (index = 0; index < count; index++)
+		openSample(data->samples + index, filenames[index]);
+	if (filter)
+		data->filter = *filter;
+	listChromosomes(data);
+	data->last_chrom_index = data->chrom_count;
+	data->queue = tt_make(count);
+	data->crossing = calloc(count > 0? count: 1, sizeof(int));
+
+	Multiplexer * new = newCoreMultiplexer(data, count, BamMatrixPop, BamMatrixSeek);
+	new->strict = strict;
+	popMultiplexer(new);
+	return new;
+}
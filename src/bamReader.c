@@ -13,11 +13,16 @@
 // limitations under the License.
 
 #include <string.h>
+#include <pthread.h>
 #include "htslib/sam.h"
 #include "htslib/hts.h"
 #include "wiggleIterator.h"
 #include "bufferedReader.h"
-#include "hashfib.h"
+#include "breakpoints.h"
+#include "bamReader.h"
+
+// Width of the tiles which whole files are piled up in, 0 if not tiled
+static int tileWidth = 0;
 
 typedef struct bamFileReaderData_st {
 	// Arguments to downloader
@@ -26,19 +31,82 @@ typedef struct bamFileReaderData_st {
 	int chrom_tid;
 	int start, stop;
 	bool read_count;
+	ReadFilter filter;
 	BufferedReaderData * bufferedReaderData;
 
 	// BAM stuff
 	samFile * fp;
 	hts_idx_t * idx;
 	bam_hdr_t * header;
+	// Separate file handles for concurrent tile decoders, each with
+	// its own index since Cram indices are bound to their handle
+	samFile ** handles;
+	hts_idx_t ** indices;
 } BamReaderData;
 
-static void storeReadComponents(HashFib * starts, HashFib * ends, bam1_t * aln) {
+// Coverage intervals of a tile, piled up ahead of time then pushed out in order
+typedef struct pileupTile_st {
+	BamReaderData * data;
+	samFile * fp;
+	hts_idx_t * idx;
+	int tid;
+	// Query, 0-based, half open
+	int start;
+	int stop;
+	int count;
+	int capacity;
+	int * starts;
+	int * finishes;
+	int * values;
+	Task * task;
+} PileupTile;
+
+void setBamTileWidth(int width) {
+	if (width < 0) {
+		fprintf(stderr, "The BAM tile width cannot be negative: %i\n", width);
+		exit(1);
+	}
+	tileWidth = width;
+}
+
+// Coverage is either pushed straight out, or stored into a tile, clipped to the tile's left boundary
+static bool emitCoverage(BamReaderData * data, PileupTile * tile, char * chrom, int start, int finish, int value) {
+	if (!tile)
+		return pushValuesToBuffer(data->bufferedReaderData, chrom, start, finish, value);
+
+	if (finish <= tile->start + 1)
+		return false;
+	if (start < tile->start + 1)
+		start = tile->start + 1;
+
+	if (tile->count == tile->capacity) {
+		tile->capacity = tile->capacity? tile->capacity * 2: 1024;
+		tile->starts = realloc(tile->starts, tile->capacity * sizeof(int));
+		tile->finishes = realloc(tile->finishes, tile->capacity * sizeof(int));
+		tile->values = realloc(tile->values, tile->capacity * sizeof(int));
+	}
+	tile->starts[tile->count] = start;
+	tile->finishes[tile->count] = finish;
+	tile->values[tile->count] = value;
+	tile->count++;
+	return false;
+}
+
+bool acceptRead(ReadFilter * filter, bam1_t * aln) {
+	uint16_t flag = aln->core.flag;
+	return aln->core.qual >= filter->min_mapq
+		&& (flag & filter->required_flags) == filter->required_flags
+		&& !(flag & filter->excluded_flags)
+		&& (!filter->proper_pairs || (flag & BAM_FPROPER_PAIR));
+}
+
+void storeReadComponents(Breakpoints * starts, Breakpoints * ends, bam1_t * aln, ReadFilter * filter) {
 	// Sometimes a read has coordinates, but is not mapped (cf BWA)
 	// We should skip these exceptions
 	if (aln->core.flag & 0x4)
 		return;
+	if (!acceptRead(filter, aln))
+		return;
 	// Note that BAM coords are 0-based, hence +1
 	int start = aln->core.pos + 1;
 	uint32_t *cigar = bam_get_cigar(aln);
@@ -51,16 +119,16 @@ static void storeReadComponents(HashFib * starts, HashFib * ends, bam1_t * aln)
 			case BAM_CEQUAL:
 			case BAM_CDIFF:
 			case BAM_CDEL:
-				hashfib_insert(starts, start);
-				hashfib_insert(ends, start + length);
+				breakpoints_insert(starts, start);
+				breakpoints_insert(ends, start + length);
 			case BAM_CREF_SKIP:
 				start += length;
 		}
 	}
 }
 
-static bam1_t * nextRead(BamReaderData * data, hts_itr_t * iter, bam1_t * aln) {
-	if (sam_itr_next(data->fp, iter, aln) < 0) {
+static bam1_t * nextRead(samFile * fp, hts_itr_t * iter, bam1_t * aln) {
+	if (sam_itr_next(fp, iter, aln) < 0) {
 		bam_destroy1(aln);
 		return NULL;
 	} else  {
@@ -68,82 +136,87 @@ static bam1_t * nextRead(BamReaderData * data, hts_itr_t * iter, bam1_t * aln) {
 	}
 }
 
-static bool consumeIteratorWithCigars(BamReaderData * data, hts_itr_t * iter, char * query_chrom, int query_chrom_tid, int query_stop) {
+static bool consumeIteratorWithCigars(BamReaderData * data, samFile * fp, PileupTile * tile, hts_itr_t * iter, char * query_chrom, int query_chrom_tid, int query_stop) {
 	// Iterate through data
 	bam1_t *aln = bam_init1();
-	HashFib * starts = hashfib_construct();
-	HashFib * ends = hashfib_construct();
+	Breakpoints * starts = breakpoints_construct();
+	Breakpoints * ends = breakpoints_construct();
 	int start, finish = -1, chrom_tid = -1;
 	int value = 0;
 
-	aln = nextRead(data, iter, aln);
+	aln = nextRead(fp, iter, aln);
 
 	while(1) {
 		// Remove dead weight
-		if (!hashfib_empty(ends) && hashfib_min(ends) == finish)
-			value -= hashfib_remove_min(ends);
+		if (!breakpoints_empty(ends) && breakpoints_min(ends) == finish)
+			value -= breakpoints_remove_min(ends);
 
 		// Stream more data into heaps
 		while (aln
-		       && (aln->core.tid == chrom_tid || hashfib_empty(ends)) 
-		       && (hashfib_empty(ends) || aln->core.pos <= hashfib_min(ends) || hashfib_empty(starts) || aln->core.pos <= hashfib_min(starts))
+		       && (aln->core.tid == chrom_tid || breakpoints_empty(ends)) 
+		       && (breakpoints_empty(ends) || aln->core.pos <= breakpoints_min(ends) || breakpoints_empty(starts) || aln->core.pos <= breakpoints_min(starts))
 		) {
-			storeReadComponents(starts, ends, aln);
+			storeReadComponents(starts, ends, aln, &data->filter);
 			chrom_tid = aln->core.tid;
-			aln = nextRead(data, iter, aln);
+			aln = nextRead(fp, iter, aln);
 		}
 
-		if (!hashfib_empty(ends)) {
+		if (!breakpoints_empty(ends)) {
 			// Choose new start
 			if (value)
 				start = finish;
 			else
-				start = hashfib_min(starts);
+				start = breakpoints_min(starts);
 
 			// If gone overboard
 			if ((start >= query_stop && chrom_tid == query_chrom_tid) || chrom_tid > query_chrom_tid) {
-				hashfib_destroy(starts);
-				hashfib_destroy(ends);
+				breakpoints_destroy(starts);
+				breakpoints_destroy(ends);
 				return false;
 			}
 
 			// Load new weight
-			if (!hashfib_empty(starts) && hashfib_min(starts) == start) 
-				value += hashfib_remove_min(starts);
+			if (!breakpoints_empty(starts) && breakpoints_min(starts) == start) 
+				value += breakpoints_remove_min(starts);
 
 			// Choose finish
-			if (hashfib_empty(starts) || hashfib_min(ends) < hashfib_min(starts))
-				finish = hashfib_min(ends);
+			if (breakpoints_empty(starts) || breakpoints_min(ends) < breakpoints_min(starts))
+				finish = breakpoints_min(ends);
 			else 
-				finish = hashfib_min(starts);
+				finish = breakpoints_min(starts);
 
 			// If gone overboard
 			if (finish > query_stop)
 				finish = query_stop;
 
 			// Push out
-			if (pushValuesToBuffer(data->bufferedReaderData, data->header->target_name[chrom_tid], start, finish, value)) {
-				hashfib_destroy(starts);
-				hashfib_destroy(ends);
+			if (emitCoverage(data, tile, data->header->target_name[chrom_tid], start, finish, value)) {
+				breakpoints_destroy(starts);
+				breakpoints_destroy(ends);
 				return true;
 			}
 		} else {
 			// No ends => end of file iterator
-			hashfib_destroy(starts);
-			hashfib_destroy(ends);
+			breakpoints_destroy(starts);
+			breakpoints_destroy(ends);
 			return false;
 		}
 	}
 }
 
-static bool consumeIteratorNoCigars(BamReaderData * data, hts_itr_t * iter, char * query_chrom, int query_chrom_tid, int query_stop) {
+static bool consumeIteratorNoCigars(BamReaderData * data, samFile * fp, PileupTile * tile, hts_itr_t * iter, char * query_chrom, int query_chrom_tid, int query_stop) {
 	// Iterate through data
 	bam1_t *aln = bam_init1();
 	int start, finish, value;
 
-	aln = nextRead(data, iter, aln);
+	aln = nextRead(fp, iter, aln);
 
 	while(aln && aln->core.tid == query_chrom_tid && aln->core.pos < query_stop) {
+		if (!acceptRead(&data->filter, aln)) {
+			aln = nextRead(fp, iter, aln);
+			continue;
+		}
+
 		// Read coordinates
 		// Note that BAM coords are 0-based, hence +1
 		start = aln->core.pos + 1;
@@ -154,12 +227,13 @@ static bool consumeIteratorNoCigars(BamReaderData * data, hts_itr_t * iter, char
 		while (aln
 		       && aln->core.tid == query_chrom_tid 
 		       && aln->core.pos == start - 1) {
-			value++;
-			aln = nextRead(data, iter, aln);
+			if (acceptRead(&data->filter, aln))
+				value++;
+			aln = nextRead(fp, iter, aln);
 		}
 
 		// Push on
-		if (pushValuesToBuffer(data->bufferedReaderData, query_chrom, start, finish, value)) 
+		if (emitCoverage(data, tile, query_chrom, start, finish, value))
 			return true;
 	}
 
@@ -176,9 +250,9 @@ static bool downloadBamFileChromosome(BamReaderData * data, char * query_chrom,
 	}
 	bool status;
 	if (data->read_count) 
-		status = consumeIteratorNoCigars(data, iter, query_chrom, query_chrom_tid, query_stop);
+		status = consumeIteratorNoCigars(data, data->fp, NULL, iter, query_chrom, query_chrom_tid, query_stop);
 	else 
-		status = consumeIteratorWithCigars(data, iter, query_chrom, query_chrom_tid, query_stop);
+		status = consumeIteratorWithCigars(data, data->fp, NULL, iter, query_chrom, query_chrom_tid, query_stop);
 
 	if (iter)
 		bam_itr_destroy(iter);
@@ -196,6 +270,137 @@ static int comp_name_id_st(const void * A, const void * B) {
 	return strcmp(A_name, B_name);
 }
 
+//////////////////////////////////////////////////////
+// Concurrent tile pileups
+//////////////////////////////////////////////////////
+
+static void * pileupTile(void * ptr) {
+	PileupTile * tile = (PileupTile *) ptr;
+	BamReaderData * data = tile->data;
+	char * chrom = data->header->target_name[tile->tid];
+	int length = data->header->target_len[tile->tid];
+
+	tile->count = 0;
+	hts_itr_t * iter = sam_itr_queryi(tile->idx, tile->tid, tile->start, tile->stop);
+	if (iter == NULL) {
+		fprintf(stderr, "Unable to iterate to region %s:%i-%i within %s BAM file.", chrom, tile->start, tile->stop, data->filename);
+		exit(1);
+	}
+	// Read starts are clipped on 0-based positions, coverage on 1-based coordinates,
+	// both as if the chromosome had been read in one go
+	if (data->read_count)
+		consumeIteratorNoCigars(data, tile->fp, tile, iter, chrom, tile->tid, tile->stop);
+	else
+		consumeIteratorWithCigars(data, tile->fp, tile, iter, chrom, tile->tid, tile->stop < length? tile->stop + 1: length);
+	bam_itr_destroy(iter);
+	return NULL;
+}
+
+static int pushTile(BamReaderData * data, PileupTile * tile) {
+	char * chrom = data->header->target_name[tile->tid];
+	int index;
+	for (index = 0; index < tile->count; index++)
+		if (pushValuesToBuffer(data->bufferedReaderData, chrom, tile->starts[index], tile->finishes[index], tile->values[index]))
+			return 1;
+	return 0;
+}
+
+// Iterator positions within a file handle cannot be shared between threads,
+// so concurrent tiles each get their own, with the header skipped
+static void tileHandle(BamReaderData * data, int slot, PileupTile * tile) {
+	if (!data->handles) {
+		data->handles = calloc(getLookahead(), sizeof(samFile *));
+		data->indices = calloc(getLookahead(), sizeof(hts_idx_t *));
+	}
+	if (!data->handles[slot]) {
+		bam_hdr_t * header;
+		if (!(data->handles[slot] = hts_open(data->filename, "r")) || !(header = sam_hdr_read(data->handles[slot]))) {
+			fprintf(stderr, "Could not open BAM file %s\n", data->filename);
+			exit(1);
+		}
+		bam_hdr_destroy(header);
+		useInflationThreads(data->handles[slot]);
+		if (!(data->indices[slot] = sam_index_load(data->handles[slot], data->filename))) {
+			fprintf(stderr, "Unable to open BAM/SAM index. Make sure alignments are indexed\n");
+			exit(1);
+		}
+	}
+	tile->fp = data->handles[slot];
+	tile->idx = data->indices[slot];
+}
+
+static bool nextTile(BamReaderData * data, int * tids, int tid_count, int * tid_index, int * position, PileupTile * tile) {
+	while (*tid_index < tid_count && *position >= data->header->target_len[tids[*tid_index]]) {
+		(*tid_index)++;
+		*position = 0;
+	}
+	if (*tid_index == tid_count)
+		return false;
+
+	tile->tid = tids[*tid_index];
+	tile->start = *position;
+	tile->stop = *position + tileWidth;
+	if (tile->stop > data->header->target_len[tile->tid])
+		tile->stop = data->header->target_len[tile->tid];
+	*position += tileWidth;
+	return true;
+}
+
+static void downloadBamFileTiles(BamReaderData * data, int * tids, int tid_count) {
+	Task * self = getBufferedReaderTask(data->bufferedReaderData);
+	int lookahead = getLookahead();
+	PileupTile * tiles = calloc(lookahead, sizeof(PileupTile));
+	int tid_index = 0;
+	int position = 0;
+	int launched = 0;
+	int pushed = 0;
+	bool interrupted = false;
+	int slot;
+
+	// Piling up runs up to lookahead tiles ahead of the one being pushed out
+	while (true) {
+		while (!interrupted && launched - pushed < lookahead) {
+			PileupTile * tile = tiles + launched % lookahead;
+			if (!nextTile(data, tids, tid_count, &tid_index, &position, tile))
+				break;
+			tile->data = data;
+			if (lookahead == 1) {
+				tile->fp = data->fp;
+				tile->idx = data->idx;
+				pileupTile(tile);
+			} else {
+				tileHandle(data, launched % lookahead, tile);
+				launchSubtask(&pileupTile, tile, &tile->task, self);
+			}
+			launched++;
+		}
+
+		if (pushed == launched)
+			break;
+
+		PileupTile * tile = tiles + pushed % lookahead;
+		if (tile->task) {
+			joinSubtask(tile->task, self);
+			tile->task = NULL;
+		}
+		// Outstanding pileups must still be joined when interrupted
+		if (!interrupted && pushTile(data, tile))
+			interrupted = true;
+		pushed++;
+	}
+
+	for (slot = 0; slot < lookahead; slot++) {
+		free(tiles[slot].starts);
+		free(tiles[slot].finishes);
+		free(tiles[slot].values);
+	}
+	free(tiles);
+}
+
+//////////////////////////////////////////////////////
+// Reader
+//////////////////////////////////////////////////////
+
 static void * downloadBamFile(void * args) {
 	BamReaderData * data = (BamReaderData *) args;
 
@@ -213,10 +418,19 @@ static void * downloadBamFile(void * args) {
 		// Sort list of chromosomes alphabetically:
 		qsort(name_ids, data->header->n_targets, sizeof(name_id_st), comp_name_id_st); 
 		
-		// Iterate through chromsomes in alphabetic order
-		for (index = 0; index < data->header->n_targets; index++)
-			if (downloadBamFileChromosome(data, name_ids[index].name, 0, data->header->target_len[name_ids[index].tid]))
-				break;
+		if (tileWidth) {
+			int * tids = calloc(data->header->n_targets, sizeof(int));
+			for (index = 0; index < data->header->n_targets; index++)
+				tids[index] = name_ids[index].tid;
+			downloadBamFileTiles(data, tids, data->header->n_targets);
+			free(tids);
+		} else {
+			// Iterate through chromsomes in alphabetic order
+			for (index = 0; index < data->header->n_targets; index++)
+				if (downloadBamFileChromosome(data, name_ids[index].name, 0, data->header->target_len[name_ids[index].tid]))
+					break;
+		}
+		free(name_ids);
 	}
 
 	endBufferedSignal(data->bufferedReaderData);
@@ -228,6 +442,7 @@ void OpenBamFile(BamReaderData * data, char * filename) {
 
 	// read the header and initialize data
 	data->fp = hts_open(filename, "r");
+	useInflationThreads(data->fp);
 
         //Get the header
         data->header = sam_hdr_read(data->fp);
@@ -241,6 +456,17 @@ void OpenBamFile(BamReaderData * data, char * filename) {
 }
 
 void closeBamFile(BamReaderData * data) {
+	int slot;
+	if (data->handles) {
+		for (slot = 0; slot < getLookahead(); slot++) {
+			if (data->indices[slot])
+				hts_idx_destroy(data->indices[slot]);
+			if (data->handles[slot])
+				sam_close(data->handles[slot]);
+		}
+		free(data->handles);
+		free(data->indices);
+	}
 	if (data->idx)
 		hts_idx_destroy(data->idx);
         bam_hdr_destroy(data->header);
@@ -277,11 +503,43 @@ void BamReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finis
 
 }
 
-WiggleIterator * BamReader(char * filename, bool holdFire, bool read_count) {
+WiggleIterator * FilteredBamReader(char * filename, bool holdFire, bool read_count, ReadFilter * filter) {
 	BamReaderData * data = (BamReaderData *) calloc(1, sizeof(BamReaderData));
 	data->read_count = read_count;
+	if (filter)
+		data->filter = *filter;
 	OpenBamFile(data, filename);
 	if (!holdFire)
 		launchBufferedReader(&downloadBamFile, data, &(data->bufferedReaderData));
 	return newWiggleIterator(data, &BamReaderPop, &BamReaderSeek, 0, false);
 }
+
+WiggleIterator * BamReader(char * filename, bool holdFire, bool read_count) {
+	return FilteredBamReader(filename, holdFire, read_count, NULL);
+}
+
+Chrom_length * BamReaderChromosomes(WiggleIterator * wi, int * count) {
+	BamReaderData * data = (BamReaderData *) wi->data;
+	Chrom_length * chrom_lengths = calloc(data->header->n_targets, sizeof(Chrom_length));
+	int index;
+
+	// Interned names outlive the header
+	for (index = 0; index < data->header->n_targets; index++) {
+		chrom_lengths[index].chrom = internChromosome(data->header->target_name[index]);
+		chrom_lengths[index].length = data->header->target_len[index];
+	}
+	qsort(chrom_lengths, data->header->n_targets, sizeof(Chrom_length), compare_chrom_lengths);
+	*count = data->header->n_targets;
+	return chrom_lengths;
+}
+
+void closeBamReader(WiggleIterator * wi) {
+	BamReaderData * data = (BamReaderData *) wi->data;
+
+	if (data->bufferedReaderData) {
+		killBufferedReader(data->bufferedReaderData);
+		free(data->bufferedReaderData);
+	}
+	closeBamFile(data);
+	destroyWiggleIterator(wi);
+}
@@ -0,0 +1,29 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef _BAM_READER_H_
+#define _BAM_READER_H_
+
+#include "htslib/sam.h"
+#include "wiggletools.h"
+#include "breakpoints.h"
+#include "threadPool.h"
+
+// Mapping quality, flag and pairing filters
+bool acceptRead(ReadFilter * filter, bam1_t * aln);
+// Stores the boundaries of the aligned blocks of a mapped and accepted read
+void storeReadComponents(Breakpoints * starts, Breakpoints * ends, bam1_t * aln, ReadFilter * filter);
+
+#endif
@@ -55,13 +55,20 @@ static void * downloadBCFFile(void * args) {
 
 	endBufferedSignal(data->bufferedReaderData);
 	bcf_destroy(vcf_line);
-	if (data->bcf_iterator) 
+	if (data->bcf_iterator) {
 		bcf_itr_destroy(data->bcf_iterator);
+		data->bcf_iterator = NULL;
+	}
 	return NULL;
 }
 
 void OpenBCFFile(BCFReaderData * data, char * filename) {
-	data->bcf_file = bcf_open(filename, "r");
+	data->filename = filename;
+	if (!(data->bcf_file = bcf_open(filename, "r"))) {
+		fprintf(stderr, "Could not open BCF file %s\n", filename);
+		exit(1);
+	}
+	useInflationThreads(data->bcf_file);
 	data->bcf_index = bcf_index_load(filename);
 	data->bcf_header = bcf_hdr_read(data->bcf_file);
 }
@@ -87,8 +94,16 @@ void BcfReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finis
 		free(data->bufferedReaderData);
 		data->bufferedReaderData = NULL;
 	}
+	if (data->bcf_index == NULL) {
+		fprintf(stderr, "Could not find index file to BCF file %s.\n", data->filename);
+		exit(1);
+	}
 	// Note: BCF encoding is 0 based, hence -1s
-	data->bcf_iterator = bcf_itr_queryi(data->bcf_index, bcf_hdr_name2id(data->bcf_header, chrom), start - 1, finish - 1);
+	int rid = bcf_hdr_name2id(data->bcf_header, chrom);
+	if (rid < 0)
+		data->bcf_iterator = bcf_itr_queryi(data->bcf_index, HTS_IDX_NONE, 0, 0);
+	else
+		data->bcf_iterator = bcf_itr_queryi(data->bcf_index, rid, start - 1, finish - 1);
 	if (data->bcf_iterator == NULL) {
 		fprintf(stderr, "Could not find index file to BCF file %s.\n", data->filename);
 		exit(1);
@@ -16,29 +16,36 @@
 #include <string.h> 
 
 #include "wiggleIterator.h"
+#include "lineReader.h"
 
 typedef struct bedReaderData_st {
 	char  *filename;
-	FILE * file;
+	LineReader * reader;
 	char * chrom;
 	int stop;
 } BedReaderData;
 
 void BedReaderPop(WiggleIterator * wi) {
 	BedReaderData * data = (BedReaderData *) wi->data;
-	char line[5000];
+	char * line, * end, * word;
 	char chrom[1000];
 	char sign = '.';
-	int start, finish;
+	int start, finish, length;
 
 	if (wi->done)
 		return;
 
-	while (fgets(line, 5000, data->file)) {
-		if (line[0] == '#' || line[0] == EOF)
+	while (nextLine(data->reader, &line, &end)) {
+		if (line == end || line[0] == '#')
 			continue;
 
-		sscanf(line, "%s\t%i\t%i", chrom, &start, &finish);
+		word = parseWord(&line, end, &length);
+		if (length >= sizeof(chrom))
+			length = sizeof(chrom) - 1;
+		memcpy(chrom, word, length);
+		chrom[length] = '\0';
+		start = parseInteger(&line, end);
+		finish = parseInteger(&line, end);
 		// Conversion from 0 to 1-based...
 		start++;
 		finish++;
@@ -59,13 +66,10 @@ void BedReaderPop(WiggleIterator * wi) {
 			wi->strand = 0;
 
 
-		// The reason for creating a new string instead of simply 
-		// overwriting is that other functions may still be pointing
-		// at the old label
-		if (wi->chrom[0] == '\0' || strcmp(wi->chrom, chrom)) {
-			wi->chrom = (char *) calloc(strlen(chrom) + 1, sizeof(char));
-			strcpy(wi->chrom, chrom);
-		}
+		// The label is replaced rather than overwritten, as other
+		// functions may still be pointing at the old one
+		if (wi->chrom[0] == '\0' || strcmp(wi->chrom, chrom))
+			wi->chrom = internChromosome(chrom);
 
 		if (data->stop > 0) {
 			int comparison = strcmp(wi->chrom, data->chrom);
@@ -83,8 +87,8 @@ void BedReaderPop(WiggleIterator * wi) {
 		return;
 	} 
 
-	fclose(data->file);
-	data->file = NULL;
+	closeLineReader(data->reader);
+	data->reader = NULL;
 	wi->done = true;
 }
 
@@ -94,17 +98,23 @@ void BedReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finis
 	data->stop = finish;
 	data->chrom = chrom;
 
-	if (!data->file || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
-		if (data->file)
-			fclose(data->file);
-		if (!(data->file = fopen(data->filename, "r"))) {
-			fprintf(stderr, "Could not open input file %s\n", data->filename);
+	bool reopened = false;
+
+	if (!data->reader) {
+		data->reader = openLineReader(data->filename);
+		reopened = true;
+	}
+
+	// Indexed bed files jump directly to the region
+	bool indexed = seekLineReader(data->reader, chrom, start, finish);
+
+	if (indexed || reopened || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
+		if (!indexed && !reopened && !rewindLineReader(data->reader)) {
+			fprintf(stderr, "Cannot do a seek on stdin stream!\n");
 			exit(1);
 		}
-		// The reason for creating a new string instead of simply 
-		// overwriting is that other functions may still be pointing
-		// at the old label
-		wi->chrom = (char *) calloc(strlen(chrom) + 1, sizeof(char));
+		// Empty label, which sorts before any chromosome
+		wi->chrom = internChromosome("");
 		wi->done = false;
 		pop(wi);
 	}
@@ -120,9 +130,6 @@ WiggleIterator * BedReader(char * filename) {
 	BedReaderData * data = (BedReaderData *) calloc(1, sizeof(BedReaderData));
 	data->filename = filename;
 	data->stop = -1;
-	if (!(data->file = fopen(filename, "r"))) {
-		fprintf(stderr, "Could not open bed file %s\n", filename);
-		exit(1);
-	}
+	data->reader = openLineReader(filename);
 	return newWiggleIteratorChromName(data, &BedReaderPop, &BedReaderSeek, 0, true);
 }
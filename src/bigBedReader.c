@@ -18,14 +18,132 @@
 
 static int MAX_BLOCKS = 100;
 
+// Entries overlapping the current position, as a min-heap on their ends
+typedef struct scoreHeap_st {
+	int * finishes;
+	double * values;
+	int count;
+	int capacity;
+} ScoreHeap;
+
 typedef struct bigBedReaderData_st {
+	char * filename;
 	bigWigFile_t * fp;
 	char * chrom;
 	int start;
 	int stop;
+	// BED column holding the values, 0 if none
+	int column;
+	ScoreHeap heap;
+	// Position from which the current sum of values holds
+	int cursor;
+	double total;
 	BufferedReaderData * bufferedReaderData;
 } BigBedReaderData;
 
+//////////////////////////////////////////////////////
+// Scores
+//////////////////////////////////////////////////////
+
+static void swapScores(ScoreHeap * heap, int A, int B) {
+	int finish = heap->finishes[A];
+	double value = heap->values[A];
+	heap->finishes[A] = heap->finishes[B];
+	heap->values[A] = heap->values[B];
+	heap->finishes[B] = finish;
+	heap->values[B] = value;
+}
+
+static void pushScore(ScoreHeap * heap, int finish, double value) {
+	int index, parent;
+
+	if (heap->count == heap->capacity) {
+		heap->capacity = heap->capacity? 2 * heap->capacity: 16;
+		heap->finishes = realloc(heap->finishes, heap->capacity * sizeof(int));
+		heap->values = realloc(heap->values, heap->capacity * sizeof(double));
+	}
+	index = heap->count++;
+	heap->finishes[index] = finish;
+	heap->values[index] = value;
+
+	for (; index > 0; index = parent) {
+		parent = (index - 1) / 2;
+		if (heap->finishes[parent] <= heap->finishes[index])
+			break;
+		swapScores(heap, parent, index);
+	}
+}
+
+static double popScore(ScoreHeap * heap) {
+	double value = heap->values[0];
+	int index = 0, child;
+
+	heap->count--;
+	heap->finishes[0] = heap->finishes[heap->count];
+	heap->values[0] = heap->values[heap->count];
+
+	for (; (child = 2 * index + 1) < heap->count; index = child) {
+		if (child + 1 < heap->count && heap->finishes[child + 1] < heap->finishes[child])
+			child++;
+		if (heap->finishes[index] <= heap->finishes[child])
+			break;
+		swapScores(heap, index, child);
+	}
+	return value;
+}
+
+// Reads the value of an entry, given the BED fields after the first three
+static double parseScore(BigBedReaderData * data, char * chrom, int start, char * fields) {
+	char * ptr = fields;
+	char * end;
+	double value;
+	int column;
+
+	for (column = 4; ptr && column < data->column; column++) {
+		ptr = strchr(ptr, '\t');
+		if (ptr)
+			ptr++;
+	}
+
+	if (ptr) {
+		value = strtod(ptr, &end);
+		if (end != ptr && (*end == '\t' || *end == '\0'))
+			return value;
+	}
+
+	fprintf(stderr, "No numerical value in column %i of BigBed file %s at %s:%i\n", data->column, data->filename, chrom, start);
+	exit(1);
+}
+
+// Pushes the sum of the values of overlapping entries up to position
+static int flushScores(BigBedReaderData * data, char * chrom, int position) {
+	ScoreHeap * heap = &data->heap;
+
+	while (heap->count && heap->finishes[0] <= position) {
+		int finish = heap->finishes[0];
+		if (finish > data->cursor) {
+			if (pushValuesToBuffer(data->bufferedReaderData, chrom, data->cursor, finish, data->total))
+				return 1;
+			data->cursor = finish;
+		}
+		data->total -= popScore(heap);
+	}
+
+	if (!heap->count)
+		// Avoid rounding residues after the last overlap
+		data->total = 0;
+	else if (position > data->cursor) {
+		if (pushValuesToBuffer(data->bufferedReaderData, chrom, data->cursor, position, data->total))
+			return 1;
+	}
+	data->cursor = position;
+	return 0;
+}
+
+//////////////////////////////////////////////////////
+// Reading
+//////////////////////////////////////////////////////
+
 static int readIteratorEntries(bwOverlapIterator_t *iter, char * chrom, int stretch_start, int stretch_stop, BigBedReaderData * data) {
 	int index;
 	for(index = 0; index < iter->entries->l; index++) {
@@ -36,7 +154,14 @@ static int readIteratorEntries(bwOverlapIterator_t *iter, char * chrom, int stre
 		start = start < stretch_start? stretch_start: start;
 		finish = finish < stretch_stop? finish: stretch_stop;
 
-		if (pushValuesToBuffer(data->bufferedReaderData, chrom, start, finish, 1))
+		if (data->column) {
+			double value = parseScore(data, chrom, start, iter->entries->str[index]);
+			// Entries come sorted by start
+			if (flushScores(data, chrom, start))
+				return 1;
+			pushScore(&data->heap, finish, value);
+			data->total += value;
+		} else if (pushValuesToBuffer(data->bufferedReaderData, chrom, start, finish, 1))
 			return 1;
 	}
 	return 0;
@@ -49,10 +174,12 @@ static int readBigBedRegion(BigBedReaderData * data, char * chrom, int start, in
 	if (stop < 1)
 		stop = 1;
 	// BigBed format 1 indexed, hence the -1s
-	bwOverlapIterator_t *iter = bbOverlappingEntriesIterator(data->fp, chrom, start - 1, stop - 1, 0, MAX_BLOCKS);
+	bwOverlapIterator_t *iter = bbOverlappingEntriesIterator(data->fp, chrom, start - 1, stop - 1, data->column != 0, MAX_BLOCKS);
 	if (!iter)
 		return 0;
 	
+	data->heap.count = 0;
+	data->total = 0;
 	while(iter->data) {
 		if (readIteratorEntries(iter, chrom, start, stop, data)) {
 			bwIteratorDestroy(iter);
@@ -61,6 +188,10 @@ static int readBigBedRegion(BigBedReaderData * data, char * chrom, int start, in
 		iter = bwIteratorNext(iter);
 	}
 	bwIteratorDestroy(iter);
+
+	// Close the entries still open at the end of the stretch
+	if (data->column && data->heap.count)
+		return flushScores(data, chrom, stop);
 	return 0;
 }
 
@@ -96,10 +227,12 @@ void BigBedReaderPop(WiggleIterator * wi) {
 }
 
 void openBigBed(BigBedReaderData * data, char * filename, bool holdFire) {
+	filename = cachedUrl(filename);
 	if(!bbIsBigBed(filename, NULL)) {
 		printf("File %s is not in BigBed format\n", filename);
 		exit(1);
 	}
+	data->filename = filename;
 	data->fp = bbOpen(filename, NULL);
 	if (!holdFire)
 		launchBufferedReader(&readBigBed, data, &(data->bufferedReaderData));
@@ -131,4 +264,17 @@ WiggleIterator * BigBedReader(char * f, bool holdFire) {
 	BigBedReaderData * data = (BigBedReaderData *) calloc(1, sizeof(BigBedReaderData));
 	openBigBed(data, f, holdFire);
 	return newWiggleIterator(data, &BigBedReaderPop, &BigBedReaderSeek, 0, true);
+}
+
+// Values read from a numerical BED column (e.g. 5 for the score),
+// overlapping entries are summed up
+WiggleIterator * ScoredBigBedReader(char * f, int column, bool holdFire) {
+	BigBedReaderData * data = (BigBedReaderData *) calloc(1, sizeof(BigBedReaderData));
+	if (column < 4) {
+		fprintf(stderr, "BigBed values must be read from column 4 or more, not %i\n", column);
+		exit(1);
+	}
+	data->column = column;
+	openBigBed(data, f, holdFire);
+	return newWiggleIterator(data, &BigBedReaderPop, &BigBedReaderSeek, 0, false);
 }	
@@ -13,19 +13,54 @@
 // limitations under the License.
 
 #include <string.h>
+#include <math.h>
 #include "bigWig.h"
 #include "bufferedReader.h"
+#include "multiplexer.h"
 
 static int MAX_BLOCKS = 100;
+static int TILE_SIZE = 10000;
+static int CACHE_TILES = 16;
+// Whole file reads are split into windows, several of which are decoded concurrently
+static int WINDOW_SIZE = 100000;
+// Number of bins summarised per zoom level query
+static int ZOOM_BINS = 10000;
+
+// Decoded intervals overlapping a fixed width tile of a chromosome
+typedef struct tile_st {
+	char * chrom;
+	int index;
+	int count;
+	int capacity;
+	int * start;
+	int * finish;
+	double * value;
+	unsigned long lastUsed;
+} Tile;
 
 typedef struct bigWiggleReaderData_st {
+	char * filename;
 	bigWigFile_t * fp;
 	char * chrom;
 	int start;
 	int stop;
 	BufferedReaderData * bufferedReaderData;
+	// LRU cache of decoded tiles, only touched by the reader task
+	Tile * tiles;
+	unsigned long clock;
+	// Separate file handles for concurrent window decoders
+	bigWigFile_t ** handles;
 } BigWiggleReaderData;
 
+typedef struct window_st {
+	bigWigFile_t * fp;
+	char * chrom;
+	int start;
+	int stop;
+	Tile intervals;
+	Task * task;
+} Window;
+
 void libBigWigInit(int size) {
 	if(bwInit(size) != 0) {
 		fprintf(stderr, "Received an error in bwInit\n");
@@ -70,40 +105,263 @@ static int readBigWiggleRegion(BigWiggleReaderData * data, char * chrom, int sta
 	return 0;
 }
 
-static int readBigWiggleChromosome(BigWiggleReaderData * data, char * chrom, int length) {
-	int start;
-	int stretch=10000;
+//////////////////////////////////////////////////////
+// Decoded tile cache
+//////////////////////////////////////////////////////
 
-	for (start = 1; start < length; start+=stretch) {
-		if (readBigWiggleRegion(data, chrom, start, start+stretch))
-			return 1;
+static void appendToTile(Tile * tile, int start, int finish, double value) {
+	if (tile->count == tile->capacity) {
+		tile->capacity = tile->capacity? 2 * tile->capacity: 1024;
+		tile->start = realloc(tile->start, tile->capacity * sizeof(int));
+		tile->finish = realloc(tile->finish, tile->capacity * sizeof(int));
+		tile->value = realloc(tile->value, tile->capacity * sizeof(double));
 	}
+	tile->start[tile->count] = start;
+	tile->finish[tile->count] = finish;
+	tile->value[tile->count] = value;
+	tile->count++;
+}
 
-	return 0;
+// Intervals overlapping [start, stop), 1-based, unboxed
+static void decodeIntervals(bigWigFile_t * fp, Tile * tile, char * chrom, int start, int stop) {
+	int interval;
+
+	tile->count = 0;
+	bwOverlapIterator_t *iter = bwOverlappingIntervalsIterator(fp, chrom, start - 1, stop - 1, MAX_BLOCKS);
+	if (!iter)
+		return;
+
+	while(iter->data) {
+		for (interval = 0; interval < iter->intervals->l; interval++)
+			appendToTile(tile, iter->intervals->start[interval] + 1, iter->intervals->end[interval] + 1, iter->intervals->value[interval]);
+		iter = bwIteratorNext(iter);
+	}
+	bwIteratorDestroy(iter);
 }
 
-void * readBigWiggle(void * ptr) {
-	BigWiggleReaderData * data = (BigWiggleReaderData *) ptr;
-	if (data->chrom)
-		readBigWiggleRegion(data, data->chrom, data->start, data->stop);
-	else {
-		int chrom_index;
-		Chrom_length * chrom_lengths = calloc(data->fp->cl->nKeys, sizeof(Chrom_length));
-		for (chrom_index = 0; chrom_index < data->fp->cl->nKeys; chrom_index++) {
-			chrom_lengths[chrom_index].chrom = data->fp->cl->chrom[chrom_index];
-			chrom_lengths[chrom_index].length = data->fp->cl->len[chrom_index];
+static void fillTile(BigWiggleReaderData * data, Tile * tile, char * chrom, int index) {
+	free(tile->chrom);
+	tile->chrom = malloc(strlen(chrom) + 1);
+	strcpy(tile->chrom, chrom);
+	tile->index = index;
+	decodeIntervals(data->fp, tile, chrom, index * TILE_SIZE + 1, (index + 1) * TILE_SIZE + 1);
+}
+
+static Tile * getTile(BigWiggleReaderData * data, char * chrom, int index) {
+	Tile * oldest = NULL;
+	int position;
+
+	if (!data->tiles)
+		data->tiles = calloc(CACHE_TILES, sizeof(Tile));
+
+	for (position = 0; position < CACHE_TILES; position++) {
+		Tile * tile = data->tiles + position;
+		if (tile->chrom && tile->index == index && strcmp(tile->chrom, chrom) == 0) {
+			tile->lastUsed = ++data->clock;
+			return tile;
 		}
+		if (!oldest || tile->lastUsed < oldest->lastUsed)
+			oldest = tile;
+	}
+
+	fillTile(data, oldest, chrom, index);
+	oldest->lastUsed = ++data->clock;
+	return oldest;
+}
+
+// Same output as readBigWiggleRegion, but nearby or repeated queries
+// reuse the intervals decoded for previous ones
+static int readBigWiggleCachedRegion(BigWiggleReaderData * data, char * chrom, int start, int stop) {
+	int first, last, index, interval;
+
+	if (start < 1)
+		start = 1;
+	if (stop <= start)
+		return 0;
+
+	first = (start - 1) / TILE_SIZE;
+	last = (stop - 2) / TILE_SIZE;
+	if (last - first >= CACHE_TILES)
+		return readBigWiggleRegion(data, chrom, start, stop);
 
-		qsort(chrom_lengths, data->fp->cl->nKeys, sizeof(Chrom_length), compare_chrom_lengths);
+	for (index = first; index <= last; index++) {
+		Tile * tile = getTile(data, chrom, index);
+		int tile_start = index * TILE_SIZE + 1;
 
-		for (chrom_index = 0; chrom_index < data->fp->cl->nKeys; chrom_index++)
-			if (readBigWiggleChromosome(data, chrom_lengths[chrom_index].chrom, chrom_lengths[chrom_index].length))
+		for (interval = 0; interval < tile->count; interval++) {
+			int interval_start = tile->start[interval];
+			int interval_finish = tile->finish[interval];
+
+			// Intervals straddling tiles were already pushed from the previous one
+			if (index > first && interval_start < tile_start)
+				continue;
+			if (interval_start >= stop)
 				break;
+			if (interval_finish <= start)
+				continue;
 
-		free(chrom_lengths);
+			// Box into queried stretch
+			if (pushValuesToBuffer(data->bufferedReaderData, chrom, interval_start < start? start: interval_start, interval_finish < stop? interval_finish: stop, tile->value[interval]))
+				return 1;
+		}
 	}
+	return 0;
+}
+
+//////////////////////////////////////////////////////
+// Concurrent window decoding
+//////////////////////////////////////////////////////
+
+static void * decodeWindow(void * ptr) {
+	Window * window = (Window *) ptr;
+	decodeIntervals(window->fp, &window->intervals, window->chrom, window->start, window->stop);
+	return NULL;
+}
+
+static int pushWindow(BigWiggleReaderData * data, Window * window) {
+	int interval;
+	Tile * intervals = &window->intervals;
+
+	for (interval = 0; interval < intervals->count; interval++) {
+		int start = intervals->start[interval];
+		int finish = intervals->finish[interval];
+
+		// Box into queried stretch
+		start = start < window->start? window->start: start;
+		finish = finish < window->stop? finish: window->stop;
+
+		if (pushValuesToBuffer(data->bufferedReaderData, window->chrom, start, finish, intervals->value[interval]))
+			return 1;
+	}
+	return 0;
+}
+
+// Whole file reads in progress. Windows are only decoded concurrently when
+// a single file is being read, as lists of files are already read in parallel
+// and extra handles for each would soon exhaust the open file limit.
+static int wholeFileReads = 0;
+
+// libBigWig file handles carry a read buffer, so concurrent decoders each get their own
+static bigWigFile_t * windowHandle(BigWiggleReaderData * data, int slot) {
+	if (!data->handles)
+		data->handles = calloc(getLookahead(), sizeof(bigWigFile_t *));
+	if (!data->handles[slot] && !(data->handles[slot] = bwOpen(data->filename, NULL, "r"))) {
+		fprintf(stderr, "Could not open BigWig file %s\n", data->filename);
+		exit(1);
+	}
+	return data->handles[slot];
+}
+
+static void closeWindowHandles(BigWiggleReaderData * data) {
+	int slot;
+
+	if (!data->handles)
+		return;
+	for (slot = 0; slot < getLookahead(); slot++)
+		if (data->handles[slot])
+			bwClose(data->handles[slot]);
+	free(data->handles);
+	data->handles = NULL;
+}
+
+// Walks through the chromosomes in alphabetical order, one window at a time
+static bool nextWindow(Chrom_length * chrom_lengths, int chrom_count, int * chrom_index, int * position, Window * window) {
+	while (*chrom_index < chrom_count && *position >= chrom_lengths[*chrom_index].length) {
+		(*chrom_index)++;
+		*position = 1;
+	}
+	if (*chrom_index == chrom_count)
+		return false;
+
+	window->chrom = chrom_lengths[*chrom_index].chrom;
+	window->start = *position;
+	window->stop = *position + WINDOW_SIZE;
+	*position += WINDOW_SIZE;
+	return true;
+}
+
+static void readBigWiggleFile(BigWiggleReaderData * data) {
+	int chrom_index;
+	int chrom_count = data->fp->cl->nKeys;
+	Chrom_length * chrom_lengths = calloc(chrom_count, sizeof(Chrom_length));
+	for (chrom_index = 0; chrom_index < chrom_count; chrom_index++) {
+		chrom_lengths[chrom_index].chrom = data->fp->cl->chrom[chrom_index];
+		chrom_lengths[chrom_index].length = data->fp->cl->len[chrom_index];
+	}
+
+	qsort(chrom_lengths, chrom_count, sizeof(Chrom_length), compare_chrom_lengths);
+
+	Task * self = getBufferedReaderTask(data->bufferedReaderData);
+	int lookahead = getLookahead();
+	Window * windows = calloc(lookahead, sizeof(Window));
+	int position = 1;
+	int launched = 0;
+	int pushed = 0;
+	bool interrupted = false;
+	bool concurrent;
+	chrom_index = 0;
+
+	__atomic_add_fetch(&wholeFileReads, 1, __ATOMIC_SEQ_CST);
+
+	// Decoding runs up to lookahead windows ahead of the one being pushed out
+	while (true) {
+		concurrent = lookahead > 1 && __atomic_load_n(&wholeFileReads, __ATOMIC_SEQ_CST) == 1;
+		// Other files were opened since, the extra handles are released once idle
+		if (!concurrent && launched == pushed)
+			closeWindowHandles(data);
+
+		while (!interrupted && launched - pushed < (concurrent? lookahead: 1)) {
+			int slot = launched % lookahead;
+			if (!nextWindow(chrom_lengths, chrom_count, &chrom_index, &position, windows + slot))
+				break;
+			if (!concurrent) {
+				windows[slot].fp = data->fp;
+				decodeWindow(windows + slot);
+			} else {
+				windows[slot].fp = windowHandle(data, slot);
+				launchSubtask(&decodeWindow, windows + slot, &windows[slot].task, self);
+			}
+			launched++;
+		}
+
+		if (pushed == launched)
+			break;
+
+		Window * window = windows + pushed % lookahead;
+		if (window->task) {
+			joinSubtask(window->task, self);
+			window->task = NULL;
+		}
+		// Outstanding decoders must still be joined when interrupted
+		if (!interrupted && pushWindow(data, window))
+			interrupted = true;
+		pushed++;
+	}
+
+	__atomic_sub_fetch(&wholeFileReads, 1, __ATOMIC_SEQ_CST);
+	closeWindowHandles(data);
+
+	for (chrom_index = 0; chrom_index < lookahead; chrom_index++) {
+		free(windows[chrom_index].intervals.start);
+		free(windows[chrom_index].intervals.finish);
+		free(windows[chrom_index].intervals.value);
+	}
+	free(windows);
+	free(chrom_lengths);
+}
+
+void * readBigWiggle(void * ptr) {
+	BigWiggleReaderData * data = (BigWiggleReaderData *) ptr;
+
+	// Seeks are passed on as new queries to this same task
+	do {
+		if (data->chrom)
+			readBigWiggleCachedRegion(data, data->chrom, data->start, data->stop);
+		else
+			readBigWiggleFile(data);
+		endBufferedSignal(data->bufferedReaderData);
+	} while (waitForBufferedQuery(data->bufferedReaderData));
 
-	endBufferedSignal(data->bufferedReaderData);
 	return NULL;
 }
 
@@ -113,27 +371,30 @@ void BigWiggleReaderPop(WiggleIterator * wi) {
 }
 
 void openBigWiggle(BigWiggleReaderData * data, char * filename, bool holdFire) {
+	filename = cachedUrl(filename);
 	if(!bwIsBigWig(filename, NULL)) {
 		printf("File %s is not in BigWig format\n", filename);
 		exit(1);
 	}
+	data->filename = filename;
 	data->fp = bwOpen(filename, NULL, "r");
 	if (!holdFire)
-		launchBufferedReader(&readBigWiggle, data, &(data->bufferedReaderData));
+		launchRestartableBufferedReader(&readBigWiggle, data, &(data->bufferedReaderData));
 }
 
 void BigWiggleReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
 	BigWiggleReaderData * data = (BigWiggleReaderData *) wi->data; 
 
-	if (data->bufferedReaderData) {
-		killBufferedReader(data->bufferedReaderData);
-		free(data->bufferedReaderData);
-		data->bufferedReaderData = NULL;
-	}
+	// The reader task is paused and handed the new query, rather than relaunched
+	if (data->bufferedReaderData)
+		pauseBufferedReader(data->bufferedReaderData);
 	data->chrom = chrom;
 	data->start = start;
 	data->stop = finish;
-	launchBufferedReader(&readBigWiggle, data, &(data->bufferedReaderData));
+	if (data->bufferedReaderData)
+		resumeBufferedReader(data->bufferedReaderData);
+	else
+		launchRestartableBufferedReader(&readBigWiggle, data, &(data->bufferedReaderData));
 	wi->done = false;
 	BigWiggleReaderPop(wi);
 
@@ -149,3 +410,263 @@ WiggleIterator * BigWiggleReader(char * f, bool holdFire) {
 	openBigWiggle(data, f, holdFire);
 	return newWiggleIterator(data, &BigWiggleReaderPop, &BigWiggleReaderSeek, 0, false);
 }	
+
+Chrom_length * BigWiggleReaderChromosomes(WiggleIterator * wi, int * count) {
+	BigWiggleReaderData * data = (BigWiggleReaderData *) wi->data;
+	Chrom_length * chrom_lengths = calloc(data->fp->cl->nKeys, sizeof(Chrom_length));
+	int chrom_index;
+
+	// Interned names outlive the file handle
+	for (chrom_index = 0; chrom_index < data->fp->cl->nKeys; chrom_index++) {
+		chrom_lengths[chrom_index].chrom = internChromosome(data->fp->cl->chrom[chrom_index]);
+		chrom_lengths[chrom_index].length = data->fp->cl->len[chrom_index];
+	}
+	qsort(chrom_lengths, data->fp->cl->nKeys, sizeof(Chrom_length), compare_chrom_lengths);
+	*count = data->fp->cl->nKeys;
+	return chrom_lengths;
+}
+
+void closeBigWiggleReader(WiggleIterator * wi) {
+	BigWiggleReaderData * data = (BigWiggleReaderData *) wi->data;
+	int index;
+
+	if (data->bufferedReaderData) {
+		killBufferedReader(data->bufferedReaderData);
+		free(data->bufferedReaderData);
+	}
+	closeWindowHandles(data);
+	if (data->tiles) {
+		for (index = 0; index < CACHE_TILES; index++) {
+			free(data->tiles[index].chrom);
+			free(data->tiles[index].start);
+			free(data->tiles[index].finish);
+			free(data->tiles[index].value);
+		}
+		free(data->tiles);
+	}
+	bwClose(data->fp);
+	destroyWiggleIterator(wi);
+}
+
+//////////////////////////////////////////////////////
+// Zoom level summaries
+//////////////////////////////////////////////////////
+
+// libBigWig answers summary queries from the coarsest zoom level which is
+// still finer than the requested bins, falling back onto the base level
+// data when none fits. The results are therefore approximate whenever zoom
+// level records straddle bin or region boundaries.
+
+static bigWigFile_t * openBigWiggleSummaries(char * filename) {
+	bigWigFile_t * fp;
+	filename = cachedUrl(filename);
+	if(!bwIsBigWig(filename, NULL)) {
+		printf("File %s is not in BigWig format\n", filename);
+		exit(1);
+	}
+	if (!(fp = bwOpen(filename, NULL, "r"))) {
+		fprintf(stderr, "Could not open BigWig file %s\n", filename);
+		exit(1);
+	}
+	return fp;
+}
+
+// Summaries of nBins equal bins over [start, finish), 0-based, into output.
+// Empty bins are NAN.
+static void summarise(bigWigFile_t * fp, char * chrom, int start, int finish, int nBins, enum bwStatsType type, double * output) {
+	int bin;
+	double * stats = finish > start? bwStats(fp, chrom, start, finish, nBins, type): NULL;
+	for (bin = 0; bin < nBins; bin++)
+		output[bin] = stats? stats[bin]: NAN;
+	free(stats);
+}
+
+typedef struct zoomBinningData_st {
+	bigWigFile_t * fp;
+	int width;
+	Chrom_length * chrom_lengths;
+	int chrom_count;
+	int chrom_index;
+	// Current query, 0-based, half open
+	int start;
+	int finish;
+	bool whole_file;
+	// Sums of the current batch of bins
+	double * sums;
+	int first_bin;
+	int bin_count;
+	int index;
+} ZoomBinningData;
+
+static void fetchBins(ZoomBinningData * data, char * chrom) {
+	int width = data->width;
+	int first = data->first_bin + data->bin_count;
+	int last = (data->finish + width - 1) / width;
+	if (last > first + ZOOM_BINS)
+		last = first + ZOOM_BINS;
+	int start = first * width < data->start? data->start: first * width;
+	int finish = last * width > data->finish? data->finish: last * width;
+	int index = 0;
+
+	data->first_bin = first;
+	data->bin_count = last - first;
+	data->index = 0;
+
+	// Bins clipped by the query boundaries are summarised on their own
+	if (start % width) {
+		int stop = (start / width + 1) * width < finish? (start / width + 1) * width: finish;
+		summarise(data->fp, chrom, start, stop, 1, sum, data->sums + index++);
+		start = stop;
+	}
+	if (finish / width * width > start) {
+		int full_bins = (finish / width * width - start) / width;
+		summarise(data->fp, chrom, start, start + full_bins * width, full_bins, sum, data->sums + index);
+		index += full_bins;
+		start += full_bins * width;
+	}
+	if (finish > start)
+		summarise(data->fp, chrom, start, finish, 1, sum, data->sums + index);
+}
+
+static void setZoomBinningChromosome(ZoomBinningData * data) {
+	data->start = 0;
+	data->finish = data->chrom_lengths[data->chrom_index].length;
+	data->first_bin = 0;
+	data->bin_count = 0;
+	data->index = 0;
+}
+
+static void ZoomBinningReaderPop(WiggleIterator * wi) {
+	ZoomBinningData * data = (ZoomBinningData *) wi->data;
+
+	while (!wi->done) {
+		// Bins without data are skipped
+		while (data->index < data->bin_count) {
+			int index = data->index++;
+			if (isnan(data->sums[index]))
+				continue;
+			wi->chrom = data->chrom_lengths[data->chrom_index].chrom;
+			wi->start = (data->first_bin + index) * data->width + 1;
+			wi->finish = wi->start + data->width;
+			wi->value = data->sums[index];
+			return;
+		}
+
+		if ((data->first_bin + data->bin_count) * data->width < data->finish)
+			fetchBins(data, data->chrom_lengths[data->chrom_index].chrom);
+		else if (data->whole_file && ++data->chrom_index < data->chrom_count)
+			setZoomBinningChromosome(data);
+		else
+			wi->done = true;
+	}
+}
+
+static void ZoomBinningReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
+	ZoomBinningData * data = (ZoomBinningData *) wi->data;
+
+	data->whole_file = false;
+	wi->done = true;
+	for (data->chrom_index = 0; data->chrom_index < data->chrom_count; data->chrom_index++) {
+		if (strcmp(data->chrom_lengths[data->chrom_index].chrom, chrom) == 0) {
+			setZoomBinningChromosome(data);
+			data->start = start - 1;
+			if (finish - 1 < data->finish)
+				data->finish = finish - 1;
+			data->first_bin = data->start / data->width;
+			wi->done = false;
+			break;
+		}
+	}
+	ZoomBinningReaderPop(wi);
+}
+
+WiggleIterator * ZoomBinningReader(char * filename, int width) {
+	ZoomBinningData * data = (ZoomBinningData *) calloc(1, sizeof(ZoomBinningData));
+	int chrom_index;
+
+	if (width < 2) {
+		fprintf(stderr, "Cannot bin over a window of width %i, must be 2 or more\n", width);
+		exit(1);
+	}
+	data->fp = openBigWiggleSummaries(filename);
+	data->width = width;
+	data->sums = calloc(ZOOM_BINS, sizeof(double));
+	data->chrom_count = data->fp->cl->nKeys;
+	data->chrom_lengths = calloc(data->chrom_count, sizeof(Chrom_length));
+	for (chrom_index = 0; chrom_index < data->chrom_count; chrom_index++) {
+		data->chrom_lengths[chrom_index].chrom = internChromosome(data->fp->cl->chrom[chrom_index]);
+		data->chrom_lengths[chrom_index].length = data->fp->cl->len[chrom_index];
+	}
+	qsort(data->chrom_lengths, data->chrom_count, sizeof(Chrom_length), compare_chrom_lengths);
+	data->whole_file = true;
+	if (data->chrom_count)
+		setZoomBinningChromosome(data);
+
+	return newWiggleIterator(data, &ZoomBinningReaderPop, &ZoomBinningReaderSeek, 0, false);
+}
+
+typedef struct zoomApplyData_st {
+	bigWigFile_t * fp;
+	WiggleIterator * regions;
+	enum bwStatsType * types;
+} ZoomApplyData;
+
+static void ZoomApplyMultiplexerPop(Multiplexer * multi) {
+	ZoomApplyData * data = (ZoomApplyData *) multi->data;
+	WiggleIterator * regions = data->regions;
+	int i;
+
+	if (regions->done) {
+		multi->done = true;
+		return;
+	}
+
+	multi->chrom = regions->chrom;
+	multi->start = regions->start;
+	multi->finish = regions->finish;
+	for (i = 0; i < multi->count; i++) {
+		summarise(data->fp, regions->chrom, regions->start - 1, regions->finish - 1, 1, data->types[i], multi->values + i);
+		// The area under an empty region is 0, not undefined
+		if (data->types[i] == sum && isnan(multi->values[i]))
+			multi->values[i] = 0;
+	}
+	pop(regions);
+}
+
+static void ZoomApplyMultiplexerSeek(Multiplexer * multi, const char * chrom, int start, int finish) {
+	ZoomApplyData * data = (ZoomApplyData *) multi->data;
+	seek(data->regions, chrom, start, finish);
+	multi->done = false;
+	ZoomApplyMultiplexerPop(multi);
+}
+
+// Returns NULL if one of the statistics cannot be read off zoom levels
+Multiplexer * ZoomApplyMultiplexer(WiggleIterator * regions, WiggleIterator * (**statistics)(WiggleIterator *), int count, char * filename) {
+	enum bwStatsType * types = calloc(count, sizeof(enum bwStatsType));
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (statistics[i] == &MeanIntegrator)
+			types[i] = mean;
+		else if (statistics[i] == &MaxIntegrator)
+			types[i] = max;
+		else if (statistics[i] == &MinIntegrator)
+			types[i] = min;
+		else if (statistics[i] == &AUCIntegrator)
+			types[i] = sum;
+		else {
+			free(types);
+			return NULL;
+		}
+	}
+
+	ZoomApplyData * data = (ZoomApplyData *) calloc(1, sizeof(ZoomApplyData));
+	data->fp = openBigWiggleSummaries(filename);
+	data->regions = regions;
+	data->types = types;
+	Multiplexer * res = newCoreMultiplexer(data, count, &ZoomApplyMultiplexerPop, &ZoomApplyMultiplexerSeek);
+	for (i = 0; i < count; i++)
+		res->default_values[i] = NAN;
+	popMultiplexer(res);
+	return res;
+}
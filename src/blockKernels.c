@@ -0,0 +1,373 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Column kernels of the block reducers.
+// Each row is computed with the same operations in the same order by all
+// versions, so that they give identical results. The vector versions
+// work on 4 (AVX2) or 8 (AVX-512) rows at a time, replacing tests with
+// comparison masks and blends, and leave the last rows to the scalar
+// version. They are compiled with function level target attributes, and
+// only selected at run time if the CPU supports them, so the library
+// still runs on any x86 machine, and on other architectures without them.
+// This file is compiled without floating point contraction, which would
+// otherwise fuse some multiplications and additions in some versions only.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "blockKernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VECTOR_KERNELS
+#include <immintrin.h>
+#endif
+
+static bool inPlayRow(const uint64_t * inplay, int row) {
+	return (inplay[row / 64] >> (row % 64)) & 1;
+}
+
+//////////////////////////////////////////////////////
+// Scalar
+//////////////////////////////////////////////////////
+
+// Rows from first to length, so that vector versions can finish off with them
+
+static void addFrom(double * results, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		results[row] += values[row];
+}
+
+static void addFloatFrom(double * results, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		results[row] += (float) values[row];
+}
+
+static void multiplyFrom(double * results, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		results[row] *= values[row];
+}
+
+static void maxFrom(double * results, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		if (results[row] < values[row] || isnan(values[row]))
+			results[row] = values[row];
+}
+
+static void minFrom(double * results, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		if (results[row] > values[row] || isnan(values[row]))
+			results[row] = values[row];
+}
+
+static void inPlayFrom(double * results, const double * values, const uint64_t * inplay, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		results[row] = inPlayRow(inplay, row)? values[row]: 0;
+}
+
+static void squaredErrorFrom(double * results, const double * means, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++) {
+		double diff = means[row] - values[row];
+		results[row] += diff * diff;
+	}
+}
+
+static void squaredErrorInPlayFrom(double * results, const double * means, const double * values, const uint64_t * inplay, int first, int length) {
+	int row;
+	for (row = first; row < length; row++) {
+		double diff = means[row] - values[row];
+		results[row] += inPlayRow(inplay, row)? diff * diff: 0;
+	}
+}
+
+static void countPositiveFrom(double * results, const double * values, int first, int length) {
+	int row;
+	for (row = first; row < length; row++)
+		results[row] = isnan(values[row])? values[row]: results[row] + (values[row] > 0? 1: 0);
+}
+
+static void scalarAdd(double * results, const double * values, int length) {
+	addFrom(results, values, 0, length);
+}
+
+static void scalarAddFloat(double * results, const double * values, int length) {
+	addFloatFrom(results, values, 0, length);
+}
+
+static void scalarMultiply(double * results, const double * values, int length) {
+	multiplyFrom(results, values, 0, length);
+}
+
+static void scalarMax(double * results, const double * values, int length) {
+	maxFrom(results, values, 0, length);
+}
+
+static void scalarMin(double * results, const double * values, int length) {
+	minFrom(results, values, 0, length);
+}
+
+static void scalarInPlay(double * results, const double * values, const uint64_t * inplay, int length) {
+	inPlayFrom(results, values, inplay, 0, length);
+}
+
+static void scalarSquaredError(double * results, const double * means, const double * values, int length) {
+	squaredErrorFrom(results, means, values, 0, length);
+}
+
+static void scalarSquaredErrorInPlay(double * results, const double * means, const double * values, const uint64_t * inplay, int length) {
+	squaredErrorInPlayFrom(results, means, values, inplay, 0, length);
+}
+
+static void scalarCountPositive(double * results, const double * values, int length) {
+	countPositiveFrom(results, values, 0, length);
+}
+
+static BlockKernels scalarKernels = {"scalar", &scalarAdd, &scalarAddFloat, &scalarMultiply, &scalarMax, &scalarMin, &scalarInPlay, &scalarSquaredError, &scalarSquaredErrorInPlay, &scalarCountPositive};
+
+#ifdef VECTOR_KERNELS
+
+//////////////////////////////////////////////////////
+// AVX2
+//////////////////////////////////////////////////////
+
+#define AVX2 __attribute__((target("avx2")))
+
+// All ones in the lanes of the rows in play, from 4 bits
+static inline AVX2 __m256d avx2InPlayMask(const uint64_t * inplay, int row) {
+	__m256i selectors = _mm256_setr_epi64x(1, 2, 4, 8);
+	__m256i bits = _mm256_set1_epi64x((inplay[row / 64] >> (row % 64)) & 15);
+	return _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(bits, selectors), selectors));
+}
+
+static AVX2 void avx2Add(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4)
+		_mm256_storeu_pd(results + row, _mm256_add_pd(_mm256_loadu_pd(results + row), _mm256_loadu_pd(values + row)));
+	addFrom(results, values, row, length);
+}
+
+static AVX2 void avx2AddFloat(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4) {
+		__m256d rounded = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_loadu_pd(values + row)));
+		_mm256_storeu_pd(results + row, _mm256_add_pd(_mm256_loadu_pd(results + row), rounded));
+	}
+	addFloatFrom(results, values, row, length);
+}
+
+static AVX2 void avx2Multiply(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4)
+		_mm256_storeu_pd(results + row, _mm256_mul_pd(_mm256_loadu_pd(results + row), _mm256_loadu_pd(values + row)));
+	multiplyFrom(results, values, row, length);
+}
+
+static AVX2 void avx2Max(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4) {
+		__m256d result = _mm256_loadu_pd(results + row);
+		__m256d value = _mm256_loadu_pd(values + row);
+		__m256d replace = _mm256_or_pd(_mm256_cmp_pd(result, value, _CMP_LT_OQ), _mm256_cmp_pd(value, value, _CMP_UNORD_Q));
+		_mm256_storeu_pd(results + row, _mm256_blendv_pd(result, value, replace));
+	}
+	maxFrom(results, values, row, length);
+}
+
+static AVX2 void avx2Min(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4) {
+		__m256d result = _mm256_loadu_pd(results + row);
+		__m256d value = _mm256_loadu_pd(values + row);
+		__m256d replace = _mm256_or_pd(_mm256_cmp_pd(result, value, _CMP_GT_OQ), _mm256_cmp_pd(value, value, _CMP_UNORD_Q));
+		_mm256_storeu_pd(results + row, _mm256_blendv_pd(result, value, replace));
+	}
+	minFrom(results, values, row, length);
+}
+
+static AVX2 void avx2InPlay(double * results, const double * values, const uint64_t * inplay, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4)
+		_mm256_storeu_pd(results + row, _mm256_and_pd(avx2InPlayMask(inplay, row), _mm256_loadu_pd(values + row)));
+	inPlayFrom(results, values, inplay, row, length);
+}
+
+static AVX2 void avx2SquaredError(double * results, const double * means, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4) {
+		__m256d diff = _mm256_sub_pd(_mm256_loadu_pd(means + row), _mm256_loadu_pd(values + row));
+		_mm256_storeu_pd(results + row, _mm256_add_pd(_mm256_loadu_pd(results + row), _mm256_mul_pd(diff, diff)));
+	}
+	squaredErrorFrom(results, means, values, row, length);
+}
+
+static AVX2 void avx2SquaredErrorInPlay(double * results, const double * means, const double * values, const uint64_t * inplay, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4) {
+		__m256d diff = _mm256_sub_pd(_mm256_loadu_pd(means + row), _mm256_loadu_pd(values + row));
+		__m256d square = _mm256_and_pd(avx2InPlayMask(inplay, row), _mm256_mul_pd(diff, diff));
+		_mm256_storeu_pd(results + row, _mm256_add_pd(_mm256_loadu_pd(results + row), square));
+	}
+	squaredErrorInPlayFrom(results, means, values, inplay, row, length);
+}
+
+static AVX2 void avx2CountPositive(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 4 <= length; row += 4) {
+		__m256d value = _mm256_loadu_pd(values + row);
+		__m256d ones = _mm256_and_pd(_mm256_cmp_pd(value, _mm256_setzero_pd(), _CMP_GT_OQ), _mm256_set1_pd(1));
+		__m256d result = _mm256_add_pd(_mm256_loadu_pd(results + row), ones);
+		_mm256_storeu_pd(results + row, _mm256_blendv_pd(result, value, _mm256_cmp_pd(value, value, _CMP_UNORD_Q)));
+	}
+	countPositiveFrom(results, values, row, length);
+}
+
+static BlockKernels avx2Kernels = {"avx2", &avx2Add, &avx2AddFloat, &avx2Multiply, &avx2Max, &avx2Min, &avx2InPlay, &avx2SquaredError, &avx2SquaredErrorInPlay, &avx2CountPositive};
+
+//////////////////////////////////////////////////////
+// AVX-512
+//////////////////////////////////////////////////////
+
+#define AVX512 __attribute__((target("avx512f")))
+
+static inline __mmask8 avx512InPlayMask(const uint64_t * inplay, int row) {
+	return (inplay[row / 64] >> (row % 64)) & 255;
+}
+
+static AVX512 void avx512Add(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8)
+		_mm512_storeu_pd(results + row, _mm512_add_pd(_mm512_loadu_pd(results + row), _mm512_loadu_pd(values + row)));
+	addFrom(results, values, row, length);
+}
+
+static AVX512 void avx512AddFloat(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8) {
+		__m512d rounded = _mm512_cvtps_pd(_mm512_cvtpd_ps(_mm512_loadu_pd(values + row)));
+		_mm512_storeu_pd(results + row, _mm512_add_pd(_mm512_loadu_pd(results + row), rounded));
+	}
+	addFloatFrom(results, values, row, length);
+}
+
+static AVX512 void avx512Multiply(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8)
+		_mm512_storeu_pd(results + row, _mm512_mul_pd(_mm512_loadu_pd(results + row), _mm512_loadu_pd(values + row)));
+	multiplyFrom(results, values, row, length);
+}
+
+static AVX512 void avx512Max(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8) {
+		__m512d result = _mm512_loadu_pd(results + row);
+		__m512d value = _mm512_loadu_pd(values + row);
+		__mmask8 replace = _mm512_cmp_pd_mask(result, value, _CMP_LT_OQ) | _mm512_cmp_pd_mask(value, value, _CMP_UNORD_Q);
+		_mm512_storeu_pd(results + row, _mm512_mask_blend_pd(replace, result, value));
+	}
+	maxFrom(results, values, row, length);
+}
+
+static AVX512 void avx512Min(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8) {
+		__m512d result = _mm512_loadu_pd(results + row);
+		__m512d value = _mm512_loadu_pd(values + row);
+		__mmask8 replace = _mm512_cmp_pd_mask(result, value, _CMP_GT_OQ) | _mm512_cmp_pd_mask(value, value, _CMP_UNORD_Q);
+		_mm512_storeu_pd(results + row, _mm512_mask_blend_pd(replace, result, value));
+	}
+	minFrom(results, values, row, length);
+}
+
+static AVX512 void avx512InPlay(double * results, const double * values, const uint64_t * inplay, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8)
+		_mm512_storeu_pd(results + row, _mm512_maskz_mov_pd(avx512InPlayMask(inplay, row), _mm512_loadu_pd(values + row)));
+	inPlayFrom(results, values, inplay, row, length);
+}
+
+static AVX512 void avx512SquaredError(double * results, const double * means, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8) {
+		__m512d diff = _mm512_sub_pd(_mm512_loadu_pd(means + row), _mm512_loadu_pd(values + row));
+		_mm512_storeu_pd(results + row, _mm512_add_pd(_mm512_loadu_pd(results + row), _mm512_mul_pd(diff, diff)));
+	}
+	squaredErrorFrom(results, means, values, row, length);
+}
+
+static AVX512 void avx512SquaredErrorInPlay(double * results, const double * means, const double * values, const uint64_t * inplay, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8) {
+		__m512d diff = _mm512_sub_pd(_mm512_loadu_pd(means + row), _mm512_loadu_pd(values + row));
+		__m512d result = _mm512_loadu_pd(results + row);
+		_mm512_storeu_pd(results + row, _mm512_mask_add_pd(result, avx512InPlayMask(inplay, row), result, _mm512_mul_pd(diff, diff)));
+	}
+	squaredErrorInPlayFrom(results, means, values, inplay, row, length);
+}
+
+static AVX512 void avx512CountPositive(double * results, const double * values, int length) {
+	int row;
+	for (row = 0; row + 8 <= length; row += 8) {
+		__m512d value = _mm512_loadu_pd(values + row);
+		__m512d result = _mm512_loadu_pd(results + row);
+		__mmask8 positive = _mm512_cmp_pd_mask(value, _mm512_setzero_pd(), _CMP_GT_OQ);
+		result = _mm512_mask_add_pd(result, positive, result, _mm512_set1_pd(1));
+		_mm512_storeu_pd(results + row, _mm512_mask_blend_pd(_mm512_cmp_pd_mask(value, value, _CMP_UNORD_Q), result, value));
+	}
+	countPositiveFrom(results, values, row, length);
+}
+
+static BlockKernels avx512Kernels = {"avx512", &avx512Add, &avx512AddFloat, &avx512Multiply, &avx512Max, &avx512Min, &avx512InPlay, &avx512SquaredError, &avx512SquaredErrorInPlay, &avx512CountPositive};
+
+#endif
+
+//////////////////////////////////////////////////////
+// Dispatch
+//////////////////////////////////////////////////////
+
+static BlockKernels * kernels = NULL;
+
+BlockKernels * findBlockKernels(const char * name) {
+	if (!strcmp(name, "scalar"))
+		return &scalarKernels;
+#ifdef VECTOR_KERNELS
+	__builtin_cpu_init();
+	if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+		return &avx2Kernels;
+	if (!strcmp(name, "avx512") && __builtin_cpu_supports("avx512f"))
+		return &avx512Kernels;
+#endif
+	return NULL;
+}
+
+BlockKernels * getBlockKernels() {
+	if (!kernels) {
+		char * variable = getenv("WIGGLETOOLS_KERNELS");
+		if (variable && variable[0]) {
+			if (!(kernels = findBlockKernels(variable))) {
+				fprintf(stderr, "Kernels %s are not supported on this machine, choose among scalar, avx2 and avx512\n", variable);
+				exit(1);
+			}
+		} else if (!(kernels = findBlockKernels("avx512")) && !(kernels = findBlockKernels("avx2")))
+			kernels = &scalarKernels;
+	}
+	return kernels;
+}
@@ -0,0 +1,52 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BLOCK_KERNELS_H_
+#define _BLOCK_KERNELS_H_
+
+#include <stdint.h>
+
+#include "wiggletools.h"
+
+// Row by row operations between a column of a multiplexer block and a
+// column of results, over the first length rows. In play bitmaps hold
+// one bit per row, starting from bit 0 of the first word.
+typedef struct blockKernels_st {
+	const char * name;
+	// results += values
+	void (*add)(double * results, const double * values, int length);
+	// results += values rounded to single precision
+	void (*addFloat)(double * results, const double * values, int length);
+	// results *= values
+	void (*multiply)(double * results, const double * values, int length);
+	// results = values where greater, or NaN
+	void (*max)(double * results, const double * values, int length);
+	// results = values where lower, or NaN
+	void (*min)(double * results, const double * values, int length);
+	// results = values where in play, 0 elsewhere
+	void (*inPlay)(double * results, const double * values, const uint64_t * inplay, int length);
+	// results += (means - values)^2
+	void (*squaredError)(double * results, const double * means, const double * values, int length);
+	// results += (means - values)^2 where in play
+	void (*squaredErrorInPlay)(double * results, const double * means, const double * values, const uint64_t * inplay, int length);
+	// results += 1 where values are positive, or NaN
+	void (*countPositive)(double * results, const double * values, int length);
+} BlockKernels;
+
+// Kernels named "scalar", "avx2" or "avx512", NULL if not supported here
+BlockKernels * findBlockKernels(const char * name);
+// Fastest kernels supported, unless WIGGLETOOLS_KERNELS names others
+BlockKernels * getBlockKernels();
+
+#endif
@@ -0,0 +1,114 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h> 
+#include <stdio.h>
+
+#include "wiggletools.h"
+#include "hashfib.h"
+#include "breakpoints.h"
+
+// Default window, must be a power of 2
+static const int WINDOW_SIZE = 1 << 18;
+
+struct breakpoints_st {
+	// counts[position & mask] for positions within [first, last]
+	int * counts;
+	int mask;
+	int first;
+	int last;
+	// Number of positions with a non zero count in the ring
+	int occupied;
+	// Positions too far from the window
+	HashFib * overflow;
+};
+
+Breakpoints *breakpoints_construct_window(int window) {
+	Breakpoints * res = (Breakpoints *) calloc(1, sizeof(Breakpoints));
+	if (window <= 0 || (window & (window - 1))) {
+		fprintf(stderr, "Breakpoint windows must be powers of 2: %i\n", window);
+		exit(1);
+	}
+	res->counts = (int *) calloc(window, sizeof(int));
+	res->mask = window - 1;
+	res->overflow = hashfib_construct();
+	return res;
+}
+
+Breakpoints *breakpoints_construct() {
+	return breakpoints_construct_window(WINDOW_SIZE);
+}
+
+bool breakpoints_empty(Breakpoints * bp) {
+	return bp->occupied == 0 && hashfib_empty(bp->overflow);
+}
+
+void breakpoints_insert(Breakpoints * bp, int key) {
+	if (bp->occupied == 0)
+		bp->first = bp->last = key;
+	else if (key < bp->first) {
+		if (bp->last - key > bp->mask) {
+			hashfib_insert(bp->overflow, key);
+			return;
+		}
+		bp->first = key;
+	} else if (key > bp->last) {
+		if (key - bp->first > bp->mask) {
+			hashfib_insert(bp->overflow, key);
+			return;
+		}
+		bp->last = key;
+	}
+
+	if (bp->counts[key & bp->mask]++ == 0)
+		bp->occupied++;
+}
+
+// Slides the start of the window onto the lowest counted position
+static int ring_min(Breakpoints * bp) {
+	while (bp->counts[bp->first & bp->mask] == 0)
+		bp->first++;
+	return bp->first;
+}
+
+int breakpoints_min(Breakpoints * bp) {
+	if (bp->occupied == 0)
+		return hashfib_min(bp->overflow);
+	else if (hashfib_empty(bp->overflow))
+		return ring_min(bp);
+
+	int key = ring_min(bp);
+	int outlier = hashfib_min(bp->overflow);
+	return outlier < key? outlier: key;
+}
+
+int breakpoints_remove_min(Breakpoints * bp) {
+	int key = breakpoints_min(bp);
+	int count = 0;
+
+	if (bp->occupied && bp->first == key) {
+		count = bp->counts[key & bp->mask];
+		bp->counts[key & bp->mask] = 0;
+		bp->occupied--;
+	}
+	if (!hashfib_empty(bp->overflow) && hashfib_min(bp->overflow) == key)
+		count += hashfib_remove_min(bp->overflow);
+	return count;
+}
+
+void breakpoints_destroy(Breakpoints * bp) {
+	hashfib_destroy(bp->overflow);
+	free(bp->counts);
+	free(bp);
+}
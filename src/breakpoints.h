@@ -0,0 +1,34 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BREAKPOINTS_H_
+#define _BREAKPOINTS_H_
+
+// Counted multiset of read start or end positions, with the same
+// interface as HashFib. Positions are counted in a ring buffer that
+// slides along the chromosome, so long as they are inserted within
+// a bounded window of each other, which is the case for sorted reads.
+// Outliers (e.g. reads with huge spliced gaps) spill into a HashFib.
+typedef struct breakpoints_st Breakpoints;
+
+Breakpoints *breakpoints_construct();
+// Smaller windows save memory when many multisets are open at once
+Breakpoints *breakpoints_construct_window(int);
+bool breakpoints_empty(Breakpoints *);
+void breakpoints_insert(Breakpoints *, int);
+int breakpoints_min(Breakpoints *);
+int breakpoints_remove_min(Breakpoints *);
+void breakpoints_destroy(Breakpoints *);
+
+#endif
@@ -15,8 +15,14 @@
 #include <string.h>
 #include "bufferedReader.h"
 
-static int MAX_HEAD_START = 3;
 static int BLOCK_SIZE = 10000;
+// Three blocks read ahead, plus the one being read and the one being written
+static int RING_SIZE = 5;
+// Chunks of a file (BigWig windows, Bam tiles) decoded ahead of the output
+static int lookahead = 4;
+
+#define ATOMIC_LOAD(X) __atomic_load_n(&(X), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_SEQ_CST)
 
 typedef struct blockData_st {
 	char **chrom;
@@ -24,35 +30,44 @@ typedef struct blockData_st {
 	int * finish;
 	double * value;
 	int count;
+	bool last;
 	struct blockData_st * next;
 } BlockData;
 
+// Single producer, single consumer ring of recycled blocks.
+// head counts the blocks published by the reader task, tail
+// the blocks released by the consumer. The reader task hands its
+// worker thread back to the pool when the ring is full, the consumer
+// sleeps when the ring is empty, raising a flag so that the reader
+// knows to signal it.
 struct bufferedReaderData_st {
-	pthread_t downloaderThreadID;
-	BlockData * blockData, *lastBlockData;
-	pthread_mutex_t count_mutex;
-	pthread_cond_t count_cond;
-	int blockCount;
+	Task * task;
+	BlockData ** ring;
+	unsigned int head;
+	unsigned int tail;
+	BlockData * writeBlock;
+	BlockData * readBlock;
 	int readIndex;
+	bool stopped;
+	bool interrupted;
+	bool parked;
+	bool restartable;
+	bool consumerWaiting;
+	pthread_mutex_t sleep_mutex;
+	pthread_cond_t sleep_cond;
 	void * readerData;
 	bool killed;
+	// Last name pushed by the reader task, and its interned label
+	const char * pushedChrom;
+	char * internedChrom;
 };
 
-static bool declareNewBlock(BufferedReaderData * data) {
-	pthread_mutex_lock(&data->count_mutex);
+//////////////////////////////////////////////////////
+// Block recycling
+//////////////////////////////////////////////////////
 
-	if (data->blockCount > MAX_HEAD_START) {
-		pthread_cond_wait(&data->count_cond, &data->count_mutex);
-	} 
-	if (data->blockCount < 0) {
-		pthread_mutex_unlock(&data->count_mutex);
-		return true;
-	}
-	data->blockCount++;
-	pthread_cond_signal(&data->count_cond);
-	pthread_mutex_unlock(&data->count_mutex);
-	return false;
-}
+static BlockData * spareBlocks = NULL;
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static BlockData * createBlockData() {
 	BlockData * new = (BlockData * ) calloc(1, sizeof(BlockData));
@@ -63,73 +78,204 @@ static BlockData * createBlockData() {
 	return new;
 }
 
+static BlockData * allocateBlockData() {
+	BlockData * block;
+
+	pthread_mutex_lock(&spare_mutex);
+	if ((block = spareBlocks))
+		spareBlocks = block->next;
+	pthread_mutex_unlock(&spare_mutex);
+
+	if (!block)
+		block = createBlockData();
+	block->next = NULL;
+	return block;
+}
+
+static void recycleBlockData(BlockData * block) {
+	pthread_mutex_lock(&spare_mutex);
+	block->next = spareBlocks;
+	spareBlocks = block;
+	pthread_mutex_unlock(&spare_mutex);
+}
+
+//////////////////////////////////////////////////////
+// Synchronisation
+//////////////////////////////////////////////////////
+
+static bool hasFreeBlock(BufferedReaderData * data) {
+	return ATOMIC_LOAD(data->stopped) || ATOMIC_LOAD(data->interrupted) || (int) (data->head - ATOMIC_LOAD(data->tail)) < RING_SIZE;
+}
+
+static bool hasFullBlock(BufferedReaderData * data) {
+	return ATOMIC_LOAD(data->head) != data->tail;
+}
+
+static bool isParked(BufferedReaderData * data) {
+	return ATOMIC_LOAD(data->parked);
+}
+
+static void sleepUntil(BufferedReaderData * data, bool * waiting, bool (*ready)(BufferedReaderData *)) {
+	pthread_mutex_lock(&data->sleep_mutex);
+	ATOMIC_STORE(*waiting, true);
+	while (!ready(data))
+		pthread_cond_wait(&data->sleep_cond, &data->sleep_mutex);
+	ATOMIC_STORE(*waiting, false);
+	pthread_mutex_unlock(&data->sleep_mutex);
+}
+
+static void wakeUp(BufferedReaderData * data, bool * waiting) {
+	if (ATOMIC_LOAD(*waiting)) {
+		pthread_mutex_lock(&data->sleep_mutex);
+		pthread_cond_signal(&data->sleep_cond);
+		pthread_mutex_unlock(&data->sleep_mutex);
+	}
+}
+
+//////////////////////////////////////////////////////
+// Producer side
+//////////////////////////////////////////////////////
+
+static BlockData * claimBlock(BufferedReaderData * data) {
+	while (!hasFreeBlock(data))
+		suspendTask(data->task);
+	if (ATOMIC_LOAD(data->stopped) || ATOMIC_LOAD(data->interrupted))
+		return NULL;
+
+	data->writeBlock = data->ring[data->head % RING_SIZE];
+	data->writeBlock->count = 0;
+	data->writeBlock->last = false;
+	return data->writeBlock;
+}
+
+static void publishBlock(BufferedReaderData * data, bool last) {
+	data->writeBlock->last = last;
+	data->writeBlock = NULL;
+	ATOMIC_STORE(data->head, data->head + 1);
+	wakeUp(data, &data->consumerWaiting);
+	// Give other readers a turn on this worker
+	yieldTask(data->task);
+}
+
 bool pushValuesToBuffer(BufferedReaderData * data, const char * chrom, int start, int finish, double value) {
+	BlockData * block = data->writeBlock;
+
+	if (block == NULL && !(block = claimBlock(data)))
+		return true;
 
-	if (data->blockData == NULL)
-		data->lastBlockData = data->blockData = createBlockData();
-	else if (data->lastBlockData->count == BLOCK_SIZE) {
-		data->lastBlockData->next = createBlockData();
-		data->lastBlockData = data->lastBlockData->next;
-		if (declareNewBlock(data))
-			return true;
+	// Names are interned once per run of records on the same chromosome
+	if (chrom != data->pushedChrom) {
+		data->pushedChrom = chrom;
+		data->internedChrom = internChromosome(chrom);
 	}
 
-	int index = data->lastBlockData->count;
-	data->lastBlockData->chrom[index] = chrom;
-	data->lastBlockData->start[index] = start;
-	data->lastBlockData->finish[index] = finish;
-	data->lastBlockData->value[index] = value;
-	data->lastBlockData->count++;
+	int index = block->count;
+	block->chrom[index] = data->internedChrom;
+	block->start[index] = start;
+	block->finish[index] = finish;
+	block->value[index] = value;
+	block->count++;
+
+	if (block->count == BLOCK_SIZE)
+		publishBlock(data, false);
 	return false;
 }
 
 void endBufferedSignal(BufferedReaderData * data) {
-	declareNewBlock(data);
-	declareNewBlock(data);
+	if (data->writeBlock == NULL && !claimBlock(data))
+		return;
+	publishBlock(data, true);
 }
 
-static void destroyBlockData(BlockData * data) {
-	free(data->chrom);
-	free(data->start);
-	free(data->finish);
-	free(data->value);
-	free(data);
+// Parks the reader task until the next query, returns false if killed instead
+bool waitForBufferedQuery(BufferedReaderData * data) {
+	ATOMIC_STORE(data->parked, true);
+	wakeUp(data, &data->consumerWaiting);
+	while (ATOMIC_LOAD(data->parked) && !ATOMIC_LOAD(data->stopped))
+		suspendTask(data->task);
+	return !ATOMIC_LOAD(data->stopped);
 }
 
+//////////////////////////////////////////////////////
+// Consumer side
+//////////////////////////////////////////////////////
+
 static void waitForNextBlock(BufferedReaderData * data) {
-	pthread_mutex_lock(&data->count_mutex);
-	// Check whether allowed to step forward
-	if (data->blockCount == 0) {
-		pthread_cond_wait(&data->count_cond, &data->count_mutex);
-	}
-	// Signal freed memory
-	data->blockCount--;
-	pthread_cond_signal(&data->count_cond);
-	pthread_mutex_unlock(&data->count_mutex);
+	if (!hasFullBlock(data))
+		sleepUntil(data, &data->consumerWaiting, &hasFullBlock);
+	data->readBlock = data->ring[data->tail % RING_SIZE];
+	data->readIndex = 0;
 }
 
 static void goToNextBlock(BufferedReaderData * data) {
-	BlockData * prevBlockData = data->blockData;
-	data->blockData = data->blockData->next;
-	data->readIndex = 0;
-	destroyBlockData(prevBlockData);
+	ATOMIC_STORE(data->tail, data->tail + 1);
+	// Readers which are about to run dry get scheduled first
+	wakeTask(data->task, ATOMIC_LOAD(data->head) - data->tail <= 1);
+	waitForNextBlock(data);
 }
 
-void launchBufferedReader(void * (* readFileFunction)(void *), void * f_data, BufferedReaderData ** buf_data) {
+static void allocateRing(BufferedReaderData * data) {
+	int index;
+	data->ring = calloc(RING_SIZE, sizeof(BlockData *));
+	for (index = 0; index < RING_SIZE; index++)
+		data->ring[index] = allocateBlockData();
+}
+
+static void recycleRing(BufferedReaderData * data) {
+	int index;
+	for (index = 0; index < RING_SIZE; index++)
+		recycleBlockData(data->ring[index]);
+	free(data->ring);
+	data->ring = NULL;
+	data->readBlock = NULL;
+	data->writeBlock = NULL;
+}
+
+static void startBufferedReader(void * (* readFileFunction)(void *), void * f_data, BufferedReaderData ** buf_data, bool restartable) {
 	BufferedReaderData * data = calloc(1, sizeof(BufferedReaderData));
 	*buf_data = data;
-	data->readIndex = 0;
 	data->readerData = f_data;
+	data->restartable = restartable;
 
-	pthread_mutex_init(&data->count_mutex, NULL);
-	pthread_cond_init(&data->count_cond, NULL);
+	allocateRing(data);
+	pthread_mutex_init(&data->sleep_mutex, NULL);
+	pthread_cond_init(&data->sleep_cond, NULL);
 
-	int err = pthread_create(&(data->downloaderThreadID), NULL, readFileFunction, f_data);
-	if (err) {
-		fprintf(stderr, "Could not create new thread %i\n", err);
-		abort();
-	}
+	launchTask(readFileFunction, f_data, &data->task);
+	waitForNextBlock(data);
+}
+
+void launchBufferedReader(void * (* readFileFunction)(void *), void * f_data, BufferedReaderData ** buf_data) {
+	startBufferedReader(readFileFunction, f_data, buf_data, false);
+}
+
+void launchRestartableBufferedReader(void * (* readFileFunction)(void *), void * f_data, BufferedReaderData ** buf_data) {
+	startBufferedReader(readFileFunction, f_data, buf_data, true);
+}
+
+Task * getBufferedReaderTask(BufferedReaderData * data) {
+	return data->task;
+}
+
+// Once this returns, the reader task is idle and its query parameters can be changed
+void pauseBufferedReader(BufferedReaderData * data) {
+	ATOMIC_STORE(data->interrupted, true);
+	wakeTask(data->task, true);
+	if (!isParked(data))
+		sleepUntil(data, &data->consumerWaiting, &isParked);
+}
 
+void resumeBufferedReader(BufferedReaderData * data) {
+	if (!data->ring)
+		allocateRing(data);
+	data->writeBlock = NULL;
+	// The names of a new query may be allocated where the previous ones were
+	data->pushedChrom = NULL;
+	ATOMIC_STORE(data->head, 0);
+	ATOMIC_STORE(data->tail, 0);
+	ATOMIC_STORE(data->interrupted, false);
+	ATOMIC_STORE(data->parked, false);
+	wakeTask(data->task, true);
 	waitForNextBlock(data);
 }
 
@@ -137,52 +283,62 @@ void killBufferedReader(BufferedReaderData * data) {
 	if (data->killed)
 		return;
 
-	pthread_mutex_lock(&data->count_mutex);
-	data->blockCount = -1;
-	// Send a signal in case the slave is waiting somewhere
-	pthread_cond_signal(&data->count_cond);
-	pthread_mutex_unlock(&data->count_mutex);
-	pthread_join(data->downloaderThreadID, NULL);
+	ATOMIC_STORE(data->stopped, true);
+	// Wake up the slave in case it is waiting for space
+	wakeTask(data->task, true);
+	joinTask(data->task);
+	data->task = NULL;
 
-	pthread_mutex_destroy(&data->count_mutex);
-	pthread_cond_destroy(&data->count_cond);
+	pthread_mutex_destroy(&data->sleep_mutex);
+	pthread_cond_destroy(&data->sleep_cond);
 
-	while (data->blockData) {
-		BlockData * prevData = data->blockData;
-		data->blockData = data->blockData->next;
-		destroyBlockData(prevData);
-	}
-
-	data->lastBlockData = NULL;
-	data->blockCount = 0;
+	if (data->ring)
+		recycleRing(data);
 	data->killed = true;
 }
 
 void BufferedReaderPop(WiggleIterator * wi, BufferedReaderData * data) {
 	if (wi->done)
 		return;
-	else if (data == NULL || data->blockData == NULL) {
+	else if (data == NULL || data->killed || data->readBlock == NULL) {
 		wi->done = true;
 		return;
-	} else if (data->readIndex == data->blockData->count) {
-		waitForNextBlock(data);
-		goToNextBlock(data);
-		if (data->blockData == NULL) {
-			killBufferedReader(data);
+	}
+
+	while (data->readIndex == data->readBlock->count) {
+		if (data->readBlock->last) {
+			// Restartable readers keep their task, but give back their memory until the next query
+			if (data->restartable)
+				recycleRing(data);
+			else
+				killBufferedReader(data);
 			wi->done = true;
 			return;
 		}
-	} 
+		goToNextBlock(data);
+	}
 
 	int index = data->readIndex;
-	wi->chrom = data->blockData->chrom[index];
-	wi->start = data->blockData->start[index];
-	wi->finish = data->blockData->finish[index];
-	wi->value = (double) data->blockData->value[index];
+	wi->chrom = data->readBlock->chrom[index];
+	wi->start = data->readBlock->start[index];
+	wi->finish = data->readBlock->finish[index];
+	wi->value = (double) data->readBlock->value[index];
 	data->readIndex++;
 }
 
 
+void setLookahead(int count) {
+	if (count < 1) {
+		fprintf(stderr, "The lookahead must be a positive integer, not %i\n", count);
+		exit(1);
+	}
+	lookahead = count;
+}
+
+int getLookahead() {
+	return lookahead;
+}
+
 int compare_chrom_lengths(const void * A, const void * B) {
 	Chrom_length * cl_A = (Chrom_length *) A;
 	Chrom_length * cl_B = (Chrom_length *) B;
@@ -19,6 +19,7 @@
 #include <pthread.h>
 #include "wiggletools.h"
 #include "wiggleIterator.h"
+#include "threadPool.h"
 
 typedef struct chrom_length_st {
 	char * chrom;
@@ -32,5 +33,25 @@ void endBufferedSignal(BufferedReaderData * data);
 void killBufferedReader(BufferedReaderData * data);
 void BufferedReaderPop(WiggleIterator * wi, BufferedReaderData * data);
 
+// Restartable readers loop on waitForBufferedQuery after each query instead of
+// exiting, so that a seek is a message to the running task rather than a relaunch:
+// the consumer pauses the reader, updates the query parameters, then resumes it.
+void launchRestartableBufferedReader(void * (* readFileFunction)(void *), void * f_data, BufferedReaderData ** buf_data);
+bool waitForBufferedQuery(BufferedReaderData * data);
+void pauseBufferedReader(BufferedReaderData * data);
+void resumeBufferedReader(BufferedReaderData * data);
+// The pool task running the reader function, e.g. to launch subtasks
+Task * getBufferedReaderTask(BufferedReaderData * data);
+
+// Number of chunks of a file which readers may decode concurrently
+int getLookahead();
+
 int compare_chrom_lengths(const void * A, const void * B);
+
+// Chromosomes listed in a file's header, sorted by name, and release of
+// every resource held by a reader, for readers which are closed and reopened
+Chrom_length * BigWiggleReaderChromosomes(WiggleIterator * wi, int * count);
+void closeBigWiggleReader(WiggleIterator * wi);
+Chrom_length * BamReaderChromosomes(WiggleIterator * wi, int * count);
+void closeBamReader(WiggleIterator * wi);
 #endif
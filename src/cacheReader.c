@@ -0,0 +1,353 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Binary cache of any track (.wtc)
+// The file is partitioned by chromosome, and each chromosome is stored
+// as three columns: starts, finishes and values. It is memory mapped
+// and iterated in place, with no parsing nor copies.
+//
+// Layout, in native byte order, every section aligned on 8 bytes:
+// 	CacheHeader
+// 	for each chromosome: name, starts (int32), finishes (int32), values (double)
+// 	CacheChrom table, at header.table_offset
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wiggleIterator.h"
+
+static const char CACHE_MAGIC[8] = "wtcache1";
+// Written as is, to detect files copied across byte orders
+static const int32_t CACHE_BYTE_ORDER = 0x01020304;
+
+typedef struct cacheHeader_st {
+	char magic[8];
+	int32_t byte_order;
+	int32_t chrom_count;
+	int64_t table_offset;
+	double default_value;
+	int32_t overlaps;
+	int32_t padding;
+} CacheHeader;
+
+typedef struct cacheChrom_st {
+	int64_t name_offset;
+	int64_t count;
+	int64_t starts_offset;
+	int64_t finishes_offset;
+	int64_t values_offset;
+} CacheChrom;
+
+typedef struct cacheReaderData_st {
+	char * filename;
+	char * buffer;
+	size_t length;
+	CacheChrom * chroms;
+	int chrom_count;
+	// Current chromosome, and next record within it
+	int chrom_index;
+	char * chrom;
+	int64_t index;
+	int32_t * starts;
+	int32_t * finishes;
+	double * values;
+	// Seek target
+	int stop;
+} CacheReaderData;
+
+//////////////////////////////////////////////////////
+// Reader
+//////////////////////////////////////////////////////
+
+static void CacheReaderLoadChrom(CacheReaderData * data, int chrom_index) {
+	CacheChrom * chrom = data->chroms + chrom_index;
+
+	data->chrom_index = chrom_index;
+	data->index = 0;
+	if (chrom_index == data->chrom_count)
+		return;
+	data->chrom = internChromosome(data->buffer + chrom->name_offset);
+	data->starts = (int32_t *) (data->buffer + chrom->starts_offset);
+	data->finishes = (int32_t *) (data->buffer + chrom->finishes_offset);
+	data->values = (double *) (data->buffer + chrom->values_offset);
+}
+
+static void CacheReaderPop(WiggleIterator * wi) {
+	CacheReaderData * data = (CacheReaderData *) wi->data;
+
+	if (wi->done)
+		return;
+
+	while (data->chrom_index < data->chrom_count && data->index == data->chroms[data->chrom_index].count) {
+		// Seeks stop at the end of the target chromosome
+		if (data->stop > 0) {
+			wi->done = true;
+			return;
+		}
+		CacheReaderLoadChrom(data, data->chrom_index + 1);
+	}
+
+	if (data->chrom_index == data->chrom_count) {
+		wi->done = true;
+		return;
+	}
+
+	wi->chrom = data->chrom;
+	wi->start = data->starts[data->index];
+	wi->finish = data->finishes[data->index];
+	wi->value = data->values[data->index];
+	data->index++;
+
+	if (data->stop > 0) {
+		if (wi->start >= data->stop)
+			wi->done = true;
+		else if (wi->finish > data->stop)
+			wi->finish = data->stop;
+	}
+}
+
+static void CacheReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
+	CacheReaderData * data = (CacheReaderData *) wi->data;
+	int chrom_index;
+
+	for (chrom_index = 0; chrom_index < data->chrom_count; chrom_index++)
+		if (!strcmp(data->buffer + data->chroms[chrom_index].name_offset, chrom))
+			break;
+
+	wi->done = false;
+	data->stop = finish;
+	if (chrom_index == data->chrom_count) {
+		wi->done = true;
+		return;
+	}
+	CacheReaderLoadChrom(data, chrom_index);
+
+	// Overlapping tracks are only sorted by start, so the finishes
+	// cannot be bisected
+	if (!wi->overlaps) {
+		int64_t low = 0;
+		int64_t high = data->chroms[chrom_index].count;
+		while (low < high) {
+			int64_t middle = (low + high) / 2;
+			if (data->finishes[middle] <= start)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		data->index = low;
+	}
+
+	pop(wi);
+	while (!wi->done && wi->finish <= start)
+		pop(wi);
+
+	if (!wi->done && wi->start < start)
+		wi->start = start;
+}
+
+// Whether count items of the given size, from the given offset, lie between the header and the table
+static bool inCacheBody(CacheHeader * header, int64_t offset, int64_t count, size_t size) {
+	return offset >= (int64_t) sizeof(CacheHeader) && offset % 8 == 0 && offset <= header->table_offset
+		&& count <= (header->table_offset - offset) / (int64_t) size;
+}
+
+static void CacheReaderCheck(CacheReaderData * data, CacheHeader * header) {
+	size_t table_length;
+	int chrom_index;
+
+	if (data->length < sizeof(CacheHeader) || memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC))) {
+		fprintf(stderr, "File %s is not a wiggletools cache\n", data->filename);
+		exit(1);
+	}
+	if (header->byte_order != CACHE_BYTE_ORDER) {
+		fprintf(stderr, "Cache file %s was written on a machine with a different byte order\n", data->filename);
+		exit(1);
+	}
+
+	table_length = header->chrom_count * sizeof(CacheChrom);
+	if (header->chrom_count < 0 || header->table_offset < sizeof(CacheHeader) || header->table_offset % 8 || header->table_offset > data->length || table_length > data->length - header->table_offset) {
+		fprintf(stderr, "Cache file %s is truncated\n", data->filename);
+		exit(1);
+	}
+
+	for (chrom_index = 0; chrom_index < header->chrom_count; chrom_index++) {
+		CacheChrom * chrom = data->chroms + chrom_index;
+		if (chrom->count < 0
+		    || chrom->name_offset < (int64_t) sizeof(CacheHeader) || chrom->name_offset >= header->table_offset
+		    || !memchr(data->buffer + chrom->name_offset, '\0', header->table_offset - chrom->name_offset)
+		    || !inCacheBody(header, chrom->starts_offset, chrom->count, sizeof(int32_t))
+		    || !inCacheBody(header, chrom->finishes_offset, chrom->count, sizeof(int32_t))
+		    || !inCacheBody(header, chrom->values_offset, chrom->count, sizeof(double))) {
+			fprintf(stderr, "Cache file %s is truncated or corrupt\n", data->filename);
+			exit(1);
+		}
+	}
+}
+
+WiggleIterator * CacheReader(char * filename) {
+	CacheReaderData * data = (CacheReaderData *) calloc(1, sizeof(CacheReaderData));
+	CacheHeader * header;
+	struct stat info;
+	int fd;
+
+	data->filename = filename;
+	if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &info)) {
+		fprintf(stderr, "Could not open cache file %s\n", filename);
+		exit(1);
+	}
+	data->length = info.st_size;
+	if (data->length < sizeof(CacheHeader)) {
+		fprintf(stderr, "File %s is not a wiggletools cache\n", filename);
+		exit(1);
+	}
+
+	data->buffer = mmap(NULL, data->length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data->buffer == MAP_FAILED) {
+		fprintf(stderr, "Could not memory map cache file %s\n", filename);
+		exit(1);
+	}
+	// The mapping outlives the descriptor
+	close(fd);
+
+	header = (CacheHeader *) data->buffer;
+	data->chroms = (CacheChrom *) (data->buffer + header->table_offset);
+	data->chrom_count = header->chrom_count;
+	CacheReaderCheck(data, header);
+	CacheReaderLoadChrom(data, 0);
+
+	return newWiggleIterator(data, &CacheReaderPop, &CacheReaderSeek, header->default_value, header->overlaps);
+}
+
+//////////////////////////////////////////////////////
+// Writer
+//////////////////////////////////////////////////////
+
+typedef struct cacheWriterData_st {
+	char * filename;
+	FILE * file;
+	CacheChrom * chroms;
+	int chrom_count;
+	int chrom_capacity;
+	// Columns of the current chromosome
+	char * chrom;
+	int32_t * starts;
+	int32_t * finishes;
+	double * values;
+	int64_t count;
+	int64_t capacity;
+} CacheWriterData;
+
+static const char CACHE_PADDING[8] = {0};
+
+// Writes a section aligned on 8 bytes, returns its offset
+static int64_t writeCacheSection(CacheWriterData * data, const void * section, size_t length) {
+	long offset = ftell(data->file);
+
+	if (offset % 8 && fwrite(CACHE_PADDING, 1, 8 - offset % 8, data->file) != 8 - offset % 8) {
+		fprintf(stderr, "Could not write into cache file %s\n", data->filename);
+		exit(1);
+	}
+	offset = ftell(data->file);
+	if (length && fwrite(section, 1, length, data->file) != length) {
+		fprintf(stderr, "Could not write into cache file %s\n", data->filename);
+		exit(1);
+	}
+	return offset;
+}
+
+static void flushCacheChrom(CacheWriterData * data) {
+	CacheChrom * chrom;
+
+	if (!data->count)
+		return;
+
+	if (data->chrom_count == data->chrom_capacity) {
+		data->chrom_capacity = data->chrom_capacity? 2 * data->chrom_capacity: 64;
+		data->chroms = realloc(data->chroms, data->chrom_capacity * sizeof(CacheChrom));
+	}
+	chrom = data->chroms + data->chrom_count++;
+	chrom->count = data->count;
+	chrom->name_offset = writeCacheSection(data, data->chrom, strlen(data->chrom) + 1);
+	chrom->starts_offset = writeCacheSection(data, data->starts, data->count * sizeof(int32_t));
+	chrom->finishes_offset = writeCacheSection(data, data->finishes, data->count * sizeof(int32_t));
+	chrom->values_offset = writeCacheSection(data, data->values, data->count * sizeof(double));
+	data->count = 0;
+}
+
+static void appendCacheRecord(CacheWriterData * data, WiggleIterator * wi) {
+	if (data->count == data->capacity) {
+		data->capacity = data->capacity? 2 * data->capacity: 1 << 16;
+		data->starts = realloc(data->starts, data->capacity * sizeof(int32_t));
+		data->finishes = realloc(data->finishes, data->capacity * sizeof(int32_t));
+		data->values = realloc(data->values, data->capacity * sizeof(double));
+	}
+	data->starts[data->count] = wi->start;
+	data->finishes[data->count] = wi->finish;
+	data->values[data->count] = wi->value;
+	data->count++;
+}
+
+void writeCacheFile(char * filename, WiggleIterator * wi) {
+	CacheWriterData * data = (CacheWriterData *) calloc(1, sizeof(CacheWriterData));
+	CacheHeader header;
+
+	data->filename = filename;
+	if (access(filename, F_OK) == 0) {
+		fprintf(stderr, "File %s already exists, please delete it if you want to overwrite it.\n", filename);
+		exit(1);
+	}
+	if (!(data->file = fopen(filename, "wb"))) {
+		fprintf(stderr, "Could not open cache file %s\n", filename);
+		exit(1);
+	}
+
+	// Placeholder, until the table offset is known
+	memset(&header, 0, sizeof(CacheHeader));
+	writeCacheSection(data, &header, sizeof(CacheHeader));
+
+	for (; !wi->done; pop(wi)) {
+		if (!data->chrom || strcmp(data->chrom, wi->chrom)) {
+			flushCacheChrom(data);
+			free(data->chrom);
+			data->chrom = strdup(wi->chrom);
+		}
+		appendCacheRecord(data, wi);
+	}
+	flushCacheChrom(data);
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.byte_order = CACHE_BYTE_ORDER;
+	header.chrom_count = data->chrom_count;
+	header.default_value = wi->default_value;
+	header.overlaps = wi->overlaps;
+	header.table_offset = writeCacheSection(data, data->chroms, data->chrom_count * sizeof(CacheChrom));
+
+	if (fseek(data->file, 0, SEEK_SET) || fwrite(&header, sizeof(CacheHeader), 1, data->file) != 1 || fclose(data->file)) {
+		fprintf(stderr, "Could not write into cache file %s\n", filename);
+		exit(1);
+	}
+
+	free(data->chrom);
+	free(data->chroms);
+	free(data->starts);
+	free(data->finishes);
+	free(data->values);
+	free(data);
+}
@@ -0,0 +1,85 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Process wide dictionary of chromosome names.
+// Readers intern the names they output, so that records on the same
+// chromosome share a single label whatever file they were read from,
+// and most chromosome comparisons are settled by address.
+// Interned names live until the end of the process.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "wiggleIterator.h"
+
+// Open addressing table, at most half full
+static char ** names = NULL;
+static unsigned int capacity = 0;
+static unsigned int count = 0;
+static pthread_mutex_t dictionary_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a
+static unsigned int hashName(const char * name, int length) {
+	unsigned int hash = 2166136261U;
+	int index;
+	for (index = 0; index < length; index++) {
+		hash ^= (unsigned char) name[index];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static unsigned int findSlot(char ** table, unsigned int size, const char * name, int length) {
+	unsigned int slot = hashName(name, length) & (size - 1);
+	while (table[slot] && (strncmp(table[slot], name, length) || table[slot][length] != '\0'))
+		slot = (slot + 1) & (size - 1);
+	return slot;
+}
+
+static void growDictionary() {
+	unsigned int new_capacity = capacity? 2 * capacity: 256;
+	char ** new_names = calloc(new_capacity, sizeof(char *));
+	unsigned int slot;
+
+	for (slot = 0; slot < capacity; slot++)
+		if (names[slot])
+			new_names[findSlot(new_names, new_capacity, names[slot], strlen(names[slot]))] = names[slot];
+	free(names);
+	names = new_names;
+	capacity = new_capacity;
+}
+
+char * internChromosomeLength(const char * name, int length) {
+	unsigned int slot;
+	char * interned;
+
+	pthread_mutex_lock(&dictionary_mutex);
+	if (2 * (count + 1) > capacity)
+		growDictionary();
+	slot = findSlot(names, capacity, name, length);
+	if (!names[slot]) {
+		names[slot] = malloc(length + 1);
+		memcpy(names[slot], name, length);
+		names[slot][length] = '\0';
+		count++;
+	}
+	interned = names[slot];
+	pthread_mutex_unlock(&dictionary_mutex);
+	return interned;
+}
+
+char * internChromosome(const char * name) {
+	return internChromosomeLength(name, strlen(name));
+}
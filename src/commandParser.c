@@ -20,6 +20,12 @@
 #include "multiplexer.h"
 
 bool holdFire = false;
+// Opt-in: answer bin and apply over BigWig files from zoom level summaries
+static bool zoomLevels = false;
+
+void useBigWigZoomLevels(bool value) {
+	zoomLevels = value;
+}
 
 void printHelp() {
 
@@ -33,8 +39,32 @@ puts("");
 puts("This library parses wiggle files and executes various operations on them streaming through lazy evaluators.");
 puts("");
 puts("Inputs:");
-puts("\tThe program takes in Wig, BigWig, BedGraph, Bed, BigBed, Bam, VCF, and BCF files, which are distinguished thanks to their suffix (.wig, (.bw|.bigWig|.bigwig), .bg, .bed, .bb, .bam, .cram, .vcf, .bcf respectively).");
+puts("\tThe program takes in Wig, BigWig, BedGraph, Bed, BigBed, Bam, VCF, and BCF files, which are distinguished thanks to their suffix (.wig, (.bw|.bigWig|.bigwig), .bg, .bed, .bb, .bam, .cram, .vcf, .bcf respectively). Files with other suffixes are recognised from their content.");
 puts("\tNote that wiggletools assumes that every bam file has an index .bai file next to it.");
+puts("\tWig, BedGraph and Bed files can be compressed with gzip or bgzip (.wig.gz, .bg.gz, .bed.gz), and bgzipped BedGraph and Bed files indexed with tabix for faster seeks.");
+puts("\tGzipped files and streams which are not bgzipped are inflated on a separate thread.");
+puts("\tUncompressed Wig and BedGraph files can be indexed for faster seeks with: wiggletools index file.wig");
+puts("\tAny track can be cached in a binary file, which is memory mapped when read back, with: wiggletools cache file.wtc (iterator)");
+puts("");
+puts("Threads:");
+puts("\tBigWig, BigBed, Bam and BCF files are decoded by a shared pool of threads, one per core by default.");
+puts("\tThe pool size can be set with --threads or the WIGGLETOOLS_THREADS environment variable.");
+puts("\tThe compressed blocks of Bam, Cram, BCF and bgzipped text files are inflated by a second pool of the same size.");
+puts("\tWith --tiles (int), Bam and Cram files read from start to end are piled up in tiles of that many bases.");
+puts("\tWhen reading a BigWig file or a tiled Bam file from start to end, several windows or tiles are decoded ahead of time, 4 by default, which can be set with --lookahead.");
+puts("");
+puts("Open files:");
+puts("\tBigWig, Bam and Cram files listed as inputs of a reducer or set comparison are opened on demand, and closed again when too many are open at once.");
+puts("\tClosed files are reopened as needed, and resume where they stopped with seeks.");
+puts("\tThe maximum number of open files can be set with --handles or the WIGGLETOOLS_HANDLES environment variable, and defaults to a fraction of the system limit.");
+puts("");
+puts("Remote files:");
+puts("\tWith --cache (directory), or the WIGGLETOOLS_CACHE environment variable, remote BigWig and BigBed files are downloaded once into that directory.");
+puts("\tThe local copies are checked against the ETag or Last-Modified headers of the server when older than WIGGLETOOLS_CACHE_AGE seconds, by default an hour.");
+puts("");
+puts("Approximations:");
+puts("\tWith --zoom, bin (int) (bigwig) and apply/apply_paste of AUC, meanI, maxI or minI over a BigWig file are computed from the file's zoom levels.");
+puts("\tThis is much faster over coarse bins or large regions, but values are approximate where zoom level records straddle bin or region boundaries.");
 puts("");
 puts("Outputs:");
 puts("\tThe program outputs a wiggle file in stdout unless the output is squashed");
@@ -42,21 +72,26 @@ puts("");
 puts("Command line:");
 puts("\twiggletools --help");
 puts("\twiggletools program");
+puts("\twiggletools [--threads (int)] [--lookahead (int)] [--tiles (int)] [--zoom] [--cache (directory)] [--handles (int)] program");
 puts("");
 puts("Program grammar:");
-puts("\tprogram = (iterator) | do (iterator) | (extraction) | (statistic) | run (file)");
+puts("\tprogram = (iterator) | do (iterator) | (extraction) | (statistic) | run (file) | index (wig_filename) | cache (wtc_filename) (iterator)");
 puts("\titerator = (in_filename) | (unary_operator) (iterator) | (binary_operator) (iterator) (iterator) | (reducer) (multiplex) | (setComparison) (multiplex_list) | print (output) (statistic)");
 puts("\tunary_operator = unit | coverage | write (output) | write_bg (ouput) | smooth (int) | abs | exp | ln | log (float) | pow (float) | offset (float) | shiftPos (int) | scale (float) | gt (float) | gte (float) | lt (float) | lte (float) | default (float) | isZero | toInt | floor | extend (int) | bin (int) | compress | (statistic)");
 puts("\toutput = (out_filename) | -");
-puts("\tin_filename = *.wig | *.bw | *.bed | *.bb | *.bg | *.sam | *.bam | *.cram | read_count *.sam | read_count *.bam | read_count *.cram | *.vcf | *.bcf | - | sam -");
+puts("\tin_filename = *.wig | *.bw | *.bed | *.bb | *.bg | *.wig.gz | *.bed.gz | *.bg.gz | *.sam | *.bam | *.cram | read_count *.sam | read_count *.bam | read_count *.cram | readFilter (read_filter) *.bam | readFilter (read_filter) read_count *.bam | fragments (fragment_length) (read_filter) *.bam | score *.bb | column (int) *.bb | *.vcf | *.vcf.gz | *.bcf | *.wtc | - | sam -");
+puts("\tread_filter = [minMAPQ (int)] [require (flags)] [exclude (flags)] [properPair]");
+puts("\tfragment_length = (int) | tlen | estimate");
 puts("\tstatistic = (statistic_function) (iterator) | ndpearson (multiplex) (multiplex)");
 puts("\tstatistic_function = AUC | meanI | varI | minI | maxI | stddevI | CVI | energy (wavelength) | pearson (iterator)");
 puts("\tbinary_operator = diff | ratio | overlaps | trim | noverlaps | nearest | apply (statistic) | fillIn | trimFill");
 puts("\treducer = cat | sum | mult | mean | var | stddev | entropy | CV | median | min | max");
 puts("\tsetComparison = ttest | ftest | wilcoxon");
 puts("\tmultiplex_list = (multiplex) | (multiplex) : (multiplex_list)");
-puts("\tmultiplex = (iterator_list) | map (unary_operator) (multiplex) | strict (multiplex)");
-puts("\titerator_list = (iterator) | (iterator) : (iterator_list)");
+puts("\tmultiplex = (iterator_list) | map (unary_operator) (multiplex) | strict (multiplex) | bams (read_filter) (bam_list)");
+puts("\tbam_list = *.bam | *.bam (bam_list)");
+puts("\titerator_list = (list_item) | (list_item) : (iterator_list)");
+puts("\tlist_item = (iterator) | strands (fragment_length) (read_filter) *.bam");
 puts("\textraction = profile (output) (int) (iterator) (iterator) | profiles (output) (int) (iterator) (iterator) | histogram (output) (width) (iterator_list) | mwrite (output) (multiplex) | mwrite_bg (output) (multiplex)");
 puts("\t\t| apply_paste (out_filename) (statistic) (bed_file) (iterator)");
 
@@ -88,6 +123,8 @@ static char * needNextToken() {
 }
 
 static WiggleIterator * readIteratorToken(char * token);
+static bool isBamFilename(char * token);
+static WiggleIterator ** readStrands();
 
 static WiggleIterator * readIterator() {
 	return readIteratorToken(needNextToken());
@@ -97,15 +134,51 @@ static WiggleIterator ** readFileList(int * count, char * firstToken) {
 	size_t buffer_size = 8;
 	char * token;
 	int i =0;
+	int j;
+	int files = 0;
 	WiggleIterator ** iters = (WiggleIterator **) calloc(buffer_size, sizeof(WiggleIterator*));
+	// BigWig and Bam filenames, opened once the length of the list is known
+	char ** filenames = (char **) calloc(buffer_size, sizeof(char*));
 
 	for (token = firstToken; token != NULL && strcmp(token, ":"); token = nextToken(0,0)) {
-		if (i == buffer_size) {
+		// Leave room for both strands
+		if (i + 1 >= buffer_size) {
 			buffer_size *= 2;
 			iters = (WiggleIterator **) realloc(iters, buffer_size * sizeof(WiggleIterator*));
+			filenames = (char **) realloc(filenames, buffer_size * sizeof(char*));
+		}
+		if (strcmp(token, "strands") == 0) {
+			WiggleIterator ** strands = readStrands();
+			filenames[i] = NULL;
+			iters[i++] = strands[0];
+			filenames[i] = NULL;
+			iters[i++] = strands[1];
+			free(strands);
+		} else if (isBigWiggleFilename(token) || isBamFilename(token)) {
+			filenames[i++] = token;
+			files++;
+		} else {
+			filenames[i] = NULL;
+			iters[i++] = readIteratorToken(token);
 		}
-		iters[i++] = readIteratorToken(token);
 	}
+
+	// Long lists of files may not all fit in the open file limit
+	if (files > getHandleBudget()) {
+		for (j = 0; j < i; j++)
+			if (filenames[j])
+				iters[j] = LazyReader(filenames[j], holdFire);
+		// Each opens its file on its first pop
+		for (j = 0; j < i; j++)
+			if (filenames[j])
+				pop(iters[j]);
+	} else {
+		for (j = 0; j < i; j++)
+			if (filenames[j])
+				iters[j] = readIteratorToken(filenames[j]);
+	}
+
+	free(filenames);
 	*count = i;
 	return iters;
 }
@@ -314,13 +387,20 @@ static Multiplexer * readApply() {
 	}
 
 	WiggleIterator * regions = readIteratorToken(token);
-	WiggleIterator * data = readIterator();
+	token = needNextToken();
+	if (zoomLevels && strict && isBigWiggleFilename(token)) {
+		Multiplexer * res = ZoomApplyMultiplexer(regions, statistics, count, token);
+		if (res)
+			return res;
+	}
+	WiggleIterator * data = readIteratorToken(token);
 
 	return ApplyMultiplexer(regions, statistics, count, data, strict);
 }
 
 
 static Multiplexer * readMultiplexer();
+static Multiplexer * readBamMatrix(bool strict);
 
 static Multiplexer * readMultiplexerToken(char * token) {
 	if (strcmp(token, "mwrite") == 0) {
@@ -331,6 +411,17 @@ static Multiplexer * readMultiplexerToken(char * token) {
 		return TeeMultiplexer(readMultiplexer(), file, true, holdFire);
 	} else if (strcmp(token, "apply") == 0) {
 		return readApply();
+	} else if (strcmp(token, "bams") == 0) {
+		return readBamMatrix(false);
+	} else if (strcmp(token, "strict") == 0) {
+		int count = 0;
+		bool strict = true;
+		WiggleIterator ** iters;
+		token = needNextToken();
+		if (strcmp(token, "bams") == 0)
+			return readBamMatrix(true);
+		iters = readIteratorListToken(&count, &strict, token);
+		return newMultiplexer(iters, count, strict);
 	} else {
 		int count = 0;
 		bool strict = false;
@@ -418,7 +509,10 @@ static WiggleIterator * readExtend() {
 
 static WiggleIterator * readBin() {
 	int extension = atoi(needNextToken());
-	return BinningWiggleIterator(readIterator(), extension);
+	char * token = needNextToken();
+	if (zoomLevels && isBigWiggleFilename(token))
+		return ZoomBinningReader(token, extension);
+	return BinningWiggleIterator(readIteratorToken(token), extension);
 }
 
 static WiggleIterator * readCompression() {
@@ -573,7 +667,7 @@ static WiggleIterator * readUnit() {
 }
 
 static WiggleIterator * readSam() {
-	return SamReader(needNextToken(), false);
+	return SamReader(needNextToken(), holdFire, false);
 }
 
 static WiggleIterator * readCoverage() {
@@ -724,13 +818,133 @@ static WiggleIterator * ReadCount() {
 	else if (!strcmp(filename + length - 5, ".cram"))
 		return BamReader(filename, holdFire, true);
 	else if (!strcmp(filename + length - 4, ".sam"))
-		return SamReader(filename, true);
+		return SamReader(filename, holdFire, true);
 	else {
 		fprintf(stderr, "Could not recognize file format from suffix: %s\n", filename);
 		exit(1);
 	}
 }
 
+// Parses read filter options, returns the first token which is not one
+static char * readReadFilterOptions(ReadFilter * filter) {
+	char * token;
+
+	for (token = needNextToken(); ; token = needNextToken()) {
+		if (strcmp(token, "minMAPQ") == 0)
+			filter->min_mapq = atoi(needNextToken());
+		else if (strcmp(token, "require") == 0)
+			filter->required_flags = strtol(needNextToken(), NULL, 0);
+		else if (strcmp(token, "exclude") == 0)
+			filter->excluded_flags = strtol(needNextToken(), NULL, 0);
+		else if (strcmp(token, "properPair") == 0)
+			filter->proper_pairs = true;
+		else
+			return token;
+	}
+}
+
+static bool isBamFilename(char * token) {
+	size_t length = strlen(token);
+	return (length >= 4 && !strcmp(token + length - 4, ".bam")) || (length >= 5 && !strcmp(token + length - 5, ".cram"));
+}
+
+static WiggleIterator * readReadFilter() {
+	ReadFilter filter = {0, 0, 0, false};
+	bool read_count = false;
+	char * token = readReadFilterOptions(&filter);
+
+	if (strcmp(token, "read_count") == 0) {
+		read_count = true;
+		token = needNextToken();
+	}
+
+	if (isBamFilename(token))
+		return FilteredBamReader(token, holdFire, read_count, &filter);
+
+	fprintf(stderr, "Read filters can only be applied to Bam or Cram files, not %s\n", token);
+	exit(1);
+}
+
+// Parses (fragment_length) [read_filter] (bam_file), returns the filename
+static char * readFragmentOptions(int * length, ReadFilter * filter) {
+	char * token = needNextToken();
+	char * filename;
+
+	if (strcmp(token, "tlen") == 0)
+		*length = FRAGMENT_TLEN;
+	else if (strcmp(token, "estimate") == 0)
+		*length = FRAGMENT_ESTIMATE;
+	else
+		*length = atoi(token);
+
+	filename = readReadFilterOptions(filter);
+	if (!isBamFilename(filename)) {
+		fprintf(stderr, "Fragments can only be read from Bam or Cram files, not %s\n", filename);
+		exit(1);
+	}
+	return filename;
+}
+
+static bool isBigBedFilename(char * token) {
+	size_t length = strlen(token);
+	return (length >= 3 && !strcmp(token + length - 3, ".bb")) || (length >= 7 && !strcmp(token + length - 7, ".bigBed")) || (length >= 7 && !strcmp(token + length - 7, ".bigbed"));
+}
+
+static WiggleIterator * readBigBedColumn(int column) {
+	char * filename = needNextToken();
+	if (!isBigBedFilename(filename)) {
+		fprintf(stderr, "Values can only be read from the columns of BigBed files, not %s\n", filename);
+		exit(1);
+	}
+	return ScoredBigBedReader(filename, column, holdFire);
+}
+
+static WiggleIterator * readScore() {
+	return readBigBedColumn(5);
+}
+
+static WiggleIterator * readColumn() {
+	return readBigBedColumn(atoi(needNextToken()));
+}
+
+static WiggleIterator * readFragments() {
+	ReadFilter filter = {0, 0, 0, false};
+	int length;
+	char * filename = readFragmentOptions(&length, &filter);
+	return FragmentBamReader(filename, length, &filter);
+}
+
+static WiggleIterator ** readStrands() {
+	ReadFilter filter = {0, 0, 0, false};
+	int length;
+	char * filename = readFragmentOptions(&length, &filter);
+	return StrandedFragmentBamReaders(filename, length, &filter);
+}
+
+static Multiplexer * readBamMatrix(bool strict) {
+	ReadFilter filter = {0, 0, 0, false};
+	size_t buffer_size = 8;
+	char ** filenames = calloc(buffer_size, sizeof(char *));
+	int count = 0;
+	char * token;
+
+	for (token = readReadFilterOptions(&filter); token != NULL && strcmp(token, ":"); token = nextToken(0,0)) {
+		if (!isBamFilename(token)) {
+			fprintf(stderr, "Coverage matrices can only be read from Bam or Cram files, not %s\n", token);
+			exit(1);
+		}
+		if (count == buffer_size) {
+			buffer_size *= 2;
+			filenames = realloc(filenames, buffer_size * sizeof(char *));
+		}
+		filenames[count++] = token;
+	}
+
+	Multiplexer * res = BamMatrix(filenames, count, &filter, strict);
+	free(filenames);
+	return res;
+}
+
 static WiggleIterator * readIteratorToken(char * token) {
 	if (strcmp(token, "cat") == 0)
 		return readCat();
@@ -854,11 +1068,24 @@ static WiggleIterator * readIteratorToken(char * token) {
 		return SelectReduction(readApply(), 0);
 	if (strcmp(token, "read_count") == 0)
 		return ReadCount(holdFire);
+	if (strcmp(token, "readFilter") == 0)
+		return readReadFilter();
+	if (strcmp(token, "fragments") == 0)
+		return readFragments();
+	if (strcmp(token, "score") == 0)
+		return readScore();
+	if (strcmp(token, "column") == 0)
+		return readColumn();
 
 	return SmartReader(token, holdFire);
 
 }
 
+static void readCache() {
+	char * filename = needNextToken();
+	writeCacheFile(filename, readLastIterator());
+}
+
 static void readProfile() {
 	FILE * file = readOutputFilename();
 
@@ -933,7 +1160,15 @@ static Multiplexer * readApplyPaste() {
 	       exit(1);
 	}
 
-	return PasteMultiplexer(ApplyMultiplexer(SmartReader(infilename, holdFire), statistics, count, readLastIterator(), strict), infile, outfile, false);
+	WiggleIterator * regions = SmartReader(infilename, holdFire);
+	Multiplexer * apply = NULL;
+	token = needNextToken();
+	if (zoomLevels && strict && isBigWiggleFilename(token) && (apply = ZoomApplyMultiplexer(regions, statistics, count, token)))
+		noTokensLeft();
+	else
+		apply = ApplyMultiplexer(regions, statistics, count, readLastIteratorToken(token), strict);
+
+	return PasteMultiplexer(apply, infile, outfile, false);
 }
 
 void parseFile(char * filename) {
@@ -1000,6 +1235,10 @@ void rollYourOwn(int argc, char ** argv) {
 		toStdout(readSeek(), false, false);
 	else if (strcmp(token, "run") == 0)
 		parseFile(needNextToken());
+	else if (strcmp(token, "index") == 0)
+		indexWiggleFile(needNextToken());
+	else if (strcmp(token, "cache") == 0)
+		readCache();
 	else
 		toStdout(readLastIteratorToken(token), false, false);
 }
@@ -0,0 +1,484 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Fragment coverage of Bam files.
+// Each read is extended into the DNA fragment it was sequenced from,
+// either to a fixed length in the direction of the read, or to the
+// insert size (TLEN) of its proper pair. A single decoder reads the
+// file, and hands out the fragments to one or two (stranded) iterators,
+// which pile them up independently. Fragments which one iterator
+// decoded ahead of the other are queued until the latter catches up.
+// Decoding runs on the caller's thread, BGZF inflation on the shared
+// htslib pool.
+
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/hts.h"
+#include "wiggleIterator.h"
+#include "bamReader.h"
+
+// Number of proper pairs sampled to estimate the fragment length
+static const int ESTIMATE_SAMPLE = 10000;
+// Margin around seek queries within which pairs may start, when using TLEN
+static const int PAIR_MARGIN = 1000;
+
+typedef struct fragment_st {
+	int tid;
+	// 1-based, half open
+	int start;
+	int finish;
+	// Lower bound on the start of this and all following fragments
+	int bound;
+} Fragment;
+
+typedef struct fragmentQueue_st {
+	Fragment * fragments;
+	int head;
+	int count;
+	int capacity;
+} FragmentQueue;
+
+typedef struct strand_st Strand;
+
+typedef struct fragmentDecoder_st {
+	char * filename;
+	samFile * fp;
+	hts_idx_t * idx;
+	bam_hdr_t * header;
+	bam1_t * aln;
+	hts_itr_t * iter;
+	ReadFilter filter;
+	// Fixed fragment length, or FRAGMENT_TLEN
+	int length;
+	bool stranded;
+
+	int * sorted_tids;
+	// Chromosomes to read through for the current query
+	int * tids;
+	int tid_count;
+	int tid_index;
+	// Current query, NULL chrom for the whole file
+	char * chrom;
+	int start;
+	int finish;
+
+	// Decoding status
+	int cursor_tid;
+	int bound;
+	bool exhausted;
+
+	FragmentQueue queues[2];
+	Strand * strands[2];
+	int strand_count;
+	// Incremented with each new query
+	int generation;
+} FragmentDecoder;
+
+struct strand_st {
+	FragmentDecoder * decoder;
+	WiggleIterator * wi;
+	int index;
+	int tid;
+	int generation;
+	Breakpoints * starts;
+	Breakpoints * ends;
+};
+
+//////////////////////////////////////////////////////
+// Fragment queues
+//////////////////////////////////////////////////////
+
+static void enqueueFragment(FragmentQueue * queue, Fragment * fragment) {
+	if (queue->count == queue->capacity) {
+		int old_capacity = queue->capacity;
+		queue->capacity = old_capacity? old_capacity * 2: 1024;
+		queue->fragments = realloc(queue->fragments, queue->capacity * sizeof(Fragment));
+		// Unwrap the ring into the new space
+		if (queue->head + queue->count > old_capacity)
+			memcpy(queue->fragments + old_capacity, queue->fragments, (queue->head + queue->count - old_capacity) * sizeof(Fragment));
+	}
+	queue->fragments[(queue->head + queue->count) % queue->capacity] = *fragment;
+	queue->count++;
+}
+
+static Fragment * peekFragment(FragmentQueue * queue) {
+	return queue->count? queue->fragments + queue->head: NULL;
+}
+
+static void dequeueFragment(FragmentQueue * queue) {
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+}
+
+//////////////////////////////////////////////////////
+// Decoder
+//////////////////////////////////////////////////////
+
+// Returns the strand of the fragment, or -1 if the read does not define one
+static int readFragment(FragmentDecoder * dec, bam1_t * aln, Fragment * fragment) {
+	bool reverse = bam_is_rev(aln);
+
+	fragment->tid = aln->core.tid;
+	fragment->bound = dec->bound;
+	if (dec->length == FRAGMENT_TLEN) {
+		// Each pair is counted once, from its leftmost mate, on the strand of its first mate
+		if (!(aln->core.flag & BAM_FPROPER_PAIR) || aln->core.isize <= 0)
+			return -1;
+		fragment->start = aln->core.pos + 1;
+		fragment->finish = fragment->start + aln->core.isize;
+		if (aln->core.flag & BAM_FREAD2)
+			reverse = !reverse;
+	} else if (reverse) {
+		fragment->finish = bam_endpos(aln) + 1;
+		fragment->start = fragment->finish - dec->length;
+		if (fragment->start < 1)
+			fragment->start = 1;
+	} else {
+		fragment->start = aln->core.pos + 1;
+		fragment->finish = fragment->start + dec->length;
+	}
+
+	return dec->stranded && reverse? 1: 0;
+}
+
+static void openQueryIterator(FragmentDecoder * dec) {
+	int tid = dec->tids[dec->tid_index++];
+	if (dec->chrom) {
+		int margin = dec->length == FRAGMENT_TLEN? PAIR_MARGIN: dec->length;
+		int start = dec->start - 1 - margin;
+		dec->iter = sam_itr_queryi(dec->idx, tid, start < 0? 0: start, dec->finish - 1 + margin);
+	} else
+		dec->iter = sam_itr_queryi(dec->idx, tid, 0, dec->header->target_len[tid]);
+
+	if (!dec->iter) {
+		fprintf(stderr, "Unable to iterate through %s within %s BAM file.", dec->header->target_name[tid], dec->filename);
+		exit(1);
+	}
+	dec->cursor_tid = tid;
+}
+
+// Decodes reads until one fragment is queued, or the current chromosome is finished
+static void decodeNextRead(FragmentDecoder * dec) {
+	Fragment fragment;
+	int strand;
+
+	while (true) {
+		if (!dec->iter) {
+			if (dec->tid_index == dec->tid_count) {
+				dec->exhausted = true;
+				return;
+			}
+			openQueryIterator(dec);
+		}
+
+		if (sam_itr_next(dec->fp, dec->iter, dec->aln) < 0) {
+			hts_itr_destroy(dec->iter);
+			dec->iter = NULL;
+			return;
+		}
+
+		// Fixed length fragments on the reverse strand may start up to length bases before the read
+		dec->bound = dec->aln->core.pos + 1;
+		if (dec->length != FRAGMENT_TLEN)
+			dec->bound -= dec->length;
+
+		if (!(dec->aln->core.flag & BAM_FUNMAP) && acceptRead(&dec->filter, dec->aln) && (strand = readFragment(dec, dec->aln, &fragment)) >= 0) {
+			enqueueFragment(dec->queues + strand, &fragment);
+			return;
+		}
+	}
+}
+
+static void clearBreakpoints(Breakpoints * breakpoints) {
+	while (!breakpoints_empty(breakpoints))
+		breakpoints_remove_min(breakpoints);
+}
+
+static void restartDecoder(FragmentDecoder * dec, const char * chrom, int start, int finish) {
+	int index;
+
+	if (dec->iter) {
+		hts_itr_destroy(dec->iter);
+		dec->iter = NULL;
+	}
+
+	free(dec->chrom);
+	dec->chrom = chrom? strdup(chrom): NULL;
+	dec->start = start;
+	dec->finish = finish;
+	dec->tid_index = 0;
+	if (chrom) {
+		dec->tids[0] = bam_name2id(dec->header, chrom);
+		dec->tid_count = dec->tids[0] < 0? 0: 1;
+	} else {
+		memcpy(dec->tids, dec->sorted_tids, dec->header->n_targets * sizeof(int));
+		dec->tid_count = dec->header->n_targets;
+	}
+	dec->cursor_tid = -1;
+	dec->bound = 0;
+	dec->exhausted = false;
+	dec->generation++;
+
+	for (index = 0; index < dec->strand_count; index++) {
+		Strand * strand = dec->strands[index];
+		dec->queues[index].head = 0;
+		dec->queues[index].count = 0;
+		clearBreakpoints(strand->starts);
+		clearBreakpoints(strand->ends);
+		strand->tid = -1;
+		strand->wi->value = 0;
+		strand->wi->done = false;
+	}
+}
+
+typedef struct {
+	char * name;
+	int tid;
+} name_id_st;
+
+static int comp_name_id_st(const void * A, const void * B) {
+	return strcmp(((name_id_st *) A)->name, ((name_id_st *) B)->name);
+}
+
+static int compareInts(const void * A, const void * B) {
+	return *(int *) A - *(int *) B;
+}
+
+// Median insert size of the first proper pairs in the file
+static int estimateFragmentLength(FragmentDecoder * dec) {
+	int * lengths = calloc(ESTIMATE_SAMPLE, sizeof(int));
+	int count = 0;
+	int median;
+
+	while (count < ESTIMATE_SAMPLE && sam_read1(dec->fp, dec->header, dec->aln) >= 0)
+		if (!(dec->aln->core.flag & BAM_FUNMAP) && acceptRead(&dec->filter, dec->aln) && (dec->aln->core.flag & BAM_FPROPER_PAIR) && dec->aln->core.isize > 0)
+			lengths[count++] = dec->aln->core.isize;
+
+	if (count == 0) {
+		fprintf(stderr, "Could not estimate the fragment length of %s: no proper pairs found\n", dec->filename);
+		exit(1);
+	}
+
+	qsort(lengths, count, sizeof(int), compareInts);
+	median = lengths[count / 2];
+	free(lengths);
+	return median;
+}
+
+static FragmentDecoder * newFragmentDecoder(char * filename, int length, ReadFilter * filter, bool stranded) {
+	FragmentDecoder * dec = (FragmentDecoder *) calloc(1, sizeof(FragmentDecoder));
+	int index;
+
+	dec->filename = filename;
+	if (!(dec->fp = hts_open(filename, "r")) || !(dec->header = sam_hdr_read(dec->fp))) {
+		fprintf(stderr, "Could not open BAM file %s\n", filename);
+		exit(1);
+	}
+	useInflationThreads(dec->fp);
+	if (!(dec->idx = sam_index_load(dec->fp, filename))) {
+		fprintf(stderr, "Unable to open BAM/SAM index. Make sure alignments are indexed\n");
+		exit(1);
+	}
+	dec->aln = bam_init1();
+	if (filter)
+		dec->filter = *filter;
+	dec->stranded = stranded;
+
+	if (length == FRAGMENT_ESTIMATE)
+		dec->length = estimateFragmentLength(dec);
+	else if (length > 0 || length == FRAGMENT_TLEN)
+		dec->length = length;
+	else {
+		fprintf(stderr, "Fragment lengths must be positive: %i\n", length);
+		exit(1);
+	}
+
+	// Chromosomes are read in alphabetical order
+	name_id_st * name_ids = calloc(dec->header->n_targets, sizeof(name_id_st));
+	for (index = 0; index < dec->header->n_targets; index++) {
+		name_ids[index].name = dec->header->target_name[index];
+		name_ids[index].tid = index;
+	}
+	qsort(name_ids, dec->header->n_targets, sizeof(name_id_st), comp_name_id_st);
+	dec->sorted_tids = calloc(dec->header->n_targets, sizeof(int));
+	dec->tids = calloc(dec->header->n_targets > 0? dec->header->n_targets: 1, sizeof(int));
+	for (index = 0; index < dec->header->n_targets; index++)
+		dec->sorted_tids[index] = name_ids[index].tid;
+	free(name_ids);
+
+	return dec;
+}
+
+//////////////////////////////////////////////////////
+// Per strand pileup
+//////////////////////////////////////////////////////
+
+static FragmentQueue * strandQueue(Strand * strand) {
+	return strand->decoder->queues + strand->index;
+}
+
+// Queues the strand's next fragment if there is one
+static Fragment * nextFragment(Strand * strand) {
+	FragmentDecoder * dec = strand->decoder;
+	while (!peekFragment(strandQueue(strand)) && !dec->exhausted)
+		decodeNextRead(dec);
+	return peekFragment(strandQueue(strand));
+}
+
+// Loads every fragment which may start before the next breakpoint
+static void loadFragments(Strand * strand) {
+	FragmentDecoder * dec = strand->decoder;
+
+	while (true) {
+		Fragment * fragment = peekFragment(strandQueue(strand));
+		int bound;
+
+		if (fragment) {
+			if (fragment->tid != strand->tid)
+				return;
+			bound = fragment->bound;
+		} else if (dec->exhausted || (dec->cursor_tid != strand->tid && dec->cursor_tid != -1))
+			return;
+		else
+			bound = dec->bound;
+
+		if (!breakpoints_empty(strand->ends) && !breakpoints_empty(strand->starts) && bound > breakpoints_min(strand->ends) && bound > breakpoints_min(strand->starts))
+			return;
+
+		if (fragment) {
+			breakpoints_insert(strand->starts, fragment->start);
+			breakpoints_insert(strand->ends, fragment->finish);
+			dequeueFragment(strandQueue(strand));
+		} else
+			decodeNextRead(dec);
+	}
+}
+
+static void stepForward(WiggleIterator * wi, Strand * strand) {
+	FragmentDecoder * dec = strand->decoder;
+
+	// Choose start
+	if (wi->value)
+		wi->start = wi->finish;
+	else
+		wi->start = breakpoints_min(strand->starts);
+
+	// If overshot
+	if (dec->chrom && wi->start >= dec->finish) {
+		wi->done = true;
+		return;
+	}
+
+	// Compute value
+	if (!breakpoints_empty(strand->starts) && breakpoints_min(strand->starts) == wi->start)
+		wi->value += breakpoints_remove_min(strand->starts);
+
+	// Compute finish
+	if (breakpoints_empty(strand->starts) || breakpoints_min(strand->ends) < breakpoints_min(strand->starts))
+		wi->finish = breakpoints_min(strand->ends);
+	else
+		wi->finish = breakpoints_min(strand->starts);
+
+	// If overshot
+	if (dec->chrom && wi->finish > dec->finish)
+		wi->finish = dec->finish;
+}
+
+static void FragmentReaderPop(WiggleIterator * wi) {
+	Strand * strand = (Strand *) wi->data;
+
+	// Remaining business on the current chromosome
+	if (strand->tid >= 0) {
+		while (!breakpoints_empty(strand->ends) && breakpoints_min(strand->ends) == wi->finish)
+			wi->value -= breakpoints_remove_min(strand->ends);
+
+		loadFragments(strand);
+
+		if (!breakpoints_empty(strand->ends)) {
+			stepForward(wi, strand);
+			return;
+		}
+	}
+
+	// Move on to the next chromosome
+	Fragment * fragment = nextFragment(strand);
+	if (!fragment) {
+		wi->done = true;
+		return;
+	}
+	wi->value = 0;
+	strand->tid = fragment->tid;
+	wi->chrom = internChromosome(strand->decoder->header->target_name[strand->tid]);
+	loadFragments(strand);
+	stepForward(wi, strand);
+}
+
+static void FragmentReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
+	Strand * strand = (Strand *) wi->data;
+	FragmentDecoder * dec = strand->decoder;
+
+	// The strands of a decoder are typically sought one after the other
+	// to the same region: only the first of them restarts the decoder
+	if (strand->generation == dec->generation || !dec->chrom || strcmp(dec->chrom, chrom) || dec->start != start || dec->finish != finish)
+		restartDecoder(dec, chrom, start, finish);
+	strand->generation = dec->generation;
+
+	FragmentReaderPop(wi);
+
+	while (!wi->done && wi->finish <= start)
+		FragmentReaderPop(wi);
+
+	if (!wi->done && wi->start < start)
+		wi->start = start;
+}
+
+static WiggleIterator * newStrand(FragmentDecoder * dec, int index) {
+	Strand * strand = (Strand *) calloc(1, sizeof(Strand));
+	strand->decoder = dec;
+	strand->index = index;
+	strand->tid = -1;
+	strand->generation = dec->generation;
+	strand->starts = breakpoints_construct();
+	strand->ends = breakpoints_construct();
+	strand->wi = newWiggleIterator(strand, &FragmentReaderPop, &FragmentReaderSeek, 0, false);
+	dec->strands[dec->strand_count++] = strand;
+	return strand->wi;
+}
+
+static WiggleIterator ** newFragmentReaders(char * filename, int length, ReadFilter * filter, bool stranded) {
+	FragmentDecoder * dec = newFragmentDecoder(filename, length, filter, stranded);
+	WiggleIterator ** iters = calloc(2, sizeof(WiggleIterator *));
+	int index;
+
+	restartDecoder(dec, NULL, 0, 0);
+	for (index = 0; index < (stranded? 2: 1); index++)
+		iters[index] = newStrand(dec, index);
+	if (stranded) {
+		iters[0]->strand = 1;
+		iters[1]->strand = -1;
+	}
+	return iters;
+}
+
+WiggleIterator * FragmentBamReader(char * filename, int length, ReadFilter * filter) {
+	WiggleIterator ** iters = newFragmentReaders(filename, length, filter, false);
+	WiggleIterator * res = iters[0];
+	free(iters);
+	return res;
+}
+
+WiggleIterator ** StrandedFragmentBamReaders(char * filename, int length, ReadFilter * filter) {
+	return newFragmentReaders(filename, length, filter, true);
+}
@@ -0,0 +1,246 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// BigWig and Bam readers opened on demand, for lists of very many files.
+// At most a fixed number of readers hold open files at any time. Beyond
+// that, the least recently read one is closed, after noting the end of
+// the last record it output. When read again, it is reopened and resumes
+// from there, with one seek per chromosome listed in the file's header.
+// Readers which are never closed read their file from start to end as usual.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "bufferedReader.h"
+
+typedef struct lazyReaderData_st {
+	char * filename;
+	bool holdFire;
+	WiggleIterator * (*open)(char *, bool);
+	void (*close)(WiggleIterator *);
+	Chrom_length * (*chromosomes)(WiggleIterator *, int *);
+	// Whether the iterator was constructed, the file being opened on the pop after that
+	bool constructed;
+	// Underlying reader, NULL while closed. Its current record is the next one to output
+	WiggleIterator * reader;
+	// Known once the file was first opened
+	Chrom_length * chroms;
+	int chrom_count;
+	int chrom_index;
+	// End of the last record output
+	int position;
+	// Whether the reader is driven by seeks rather than reading the whole file
+	bool seeking;
+	// End of the region sought, 0 if reading to the end of the file
+	int stop;
+	// Open readers, most recently read first
+	struct lazyReaderData_st * previous;
+	struct lazyReaderData_st * next;
+} LazyReaderData;
+
+// Descriptors left for outputs, indexes and other inputs
+#define RESERVED_HANDLES 32
+
+static LazyReaderData * recentHead = NULL;
+static LazyReaderData * recentTail = NULL;
+static int openCount = 0;
+static int handleBudget = 0;
+
+void setHandleBudget(int count) {
+	if (count < 1) {
+		fprintf(stderr, "The number of open files must be a positive integer, not %i\n", count);
+		exit(1);
+	}
+	handleBudget = count;
+}
+
+int getHandleBudget() {
+	if (handleBudget == 0) {
+		char * variable = getenv("WIGGLETOOLS_HANDLES");
+		struct rlimit limit;
+		if (variable && atoi(variable) > 0)
+			handleBudget = atoi(variable);
+		else if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+			handleBudget = limit.rlim_cur - RESERVED_HANDLES;
+		else
+			handleBudget = 1024;
+		if (handleBudget < 1)
+			handleBudget = 1;
+	}
+	return handleBudget;
+}
+
+//////////////////////////////////////////////////////
+// Pool of open readers
+//////////////////////////////////////////////////////
+
+static void unlinkLazyReader(LazyReaderData * data) {
+	if (data->previous)
+		data->previous->next = data->next;
+	else
+		recentHead = data->next;
+	if (data->next)
+		data->next->previous = data->previous;
+	else
+		recentTail = data->previous;
+	data->previous = data->next = NULL;
+}
+
+static void pushLazyReader(LazyReaderData * data) {
+	data->previous = NULL;
+	data->next = recentHead;
+	if (recentHead)
+		recentHead->previous = data;
+	else
+		recentTail = data;
+	recentHead = data;
+}
+
+static void closeLazyReader(LazyReaderData * data) {
+	data->close(data->reader);
+	data->reader = NULL;
+	unlinkLazyReader(data);
+	openCount--;
+	// Reopened readers cannot pick up a whole file read where it stopped
+	data->seeking = true;
+}
+
+static void openLazyReader(LazyReaderData * data) {
+	while (openCount >= getHandleBudget() && recentTail)
+		closeLazyReader(recentTail);
+
+	data->reader = data->open(data->filename, data->seeking);
+	if (!data->chroms)
+		data->chroms = data->chromosomes(data->reader, &data->chrom_count);
+	pushLazyReader(data);
+	openCount++;
+}
+
+static void seekLazyReader(LazyReaderData * data) {
+	Chrom_length * chrom = data->chroms + data->chrom_index;
+	seek(data->reader, chrom->chrom, data->position, data->stop? data->stop: chrom->length + 1);
+}
+
+//////////////////////////////////////////////////////
+// Iterator
+//////////////////////////////////////////////////////
+
+static void LazyReaderPop(WiggleIterator * wi) {
+	LazyReaderData * data = (LazyReaderData *) wi->data;
+	WiggleIterator * reader;
+
+	if (wi->done)
+		return;
+
+	if (!data->constructed) {
+		data->constructed = true;
+		return;
+	}
+
+	if (data->reader) {
+		if (recentHead != data) {
+			unlinkLazyReader(data);
+			pushLazyReader(data);
+		}
+	} else if (data->holdFire && !data->seeking) {
+		// Waiting for a seek
+		wi->done = true;
+		return;
+	} else {
+		openLazyReader(data);
+		if (data->seeking)
+			seekLazyReader(data);
+	}
+	reader = data->reader;
+
+	while (true) {
+		// Resumed queries may start within the last record output
+		while (!reader->done && data->seeking && reader->finish <= data->position)
+			pop(reader);
+		if (!reader->done)
+			break;
+		if (!data->seeking || data->stop || data->chrom_index + 1 >= data->chrom_count) {
+			closeLazyReader(data);
+			wi->done = true;
+			return;
+		}
+		data->chrom_index++;
+		data->position = 1;
+		seekLazyReader(data);
+	}
+
+	// Chromosome names are taken from the header, to survive reopening the file
+	while (strcmp(data->chroms[data->chrom_index].chrom, reader->chrom)) {
+		if (data->seeking || ++data->chrom_index == data->chrom_count) {
+			fprintf(stderr, "Chromosome %s of file %s is missing from its header, or out of order\n", reader->chrom, data->filename);
+			exit(1);
+		}
+		data->position = 1;
+	}
+
+	wi->chrom = data->chroms[data->chrom_index].chrom;
+	wi->start = reader->start < data->position? data->position: reader->start;
+	wi->finish = reader->finish;
+	wi->value = reader->value;
+	data->position = wi->finish;
+	pop(reader);
+}
+
+static void LazyReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
+	LazyReaderData * data = (LazyReaderData *) wi->data;
+
+	data->seeking = true;
+	data->position = start;
+	data->stop = finish;
+	if (!data->reader)
+		openLazyReader(data);
+
+	for (data->chrom_index = 0; data->chrom_index < data->chrom_count; data->chrom_index++)
+		if (!strcmp(data->chroms[data->chrom_index].chrom, chrom))
+			break;
+	if (data->chrom_index == data->chrom_count) {
+		closeLazyReader(data);
+		wi->done = true;
+		return;
+	}
+
+	seekLazyReader(data);
+	LazyReaderPop(wi);
+}
+
+static WiggleIterator * openLazyBam(char * filename, bool holdFire) {
+	return BamReader(filename, holdFire, false);
+}
+
+WiggleIterator * LazyReader(char * filename, bool holdFire) {
+	LazyReaderData * data = (LazyReaderData *) calloc(1, sizeof(LazyReaderData));
+	data->holdFire = holdFire;
+	data->position = 1;
+	if (isBigWiggleFilename(filename)) {
+		// Remote files are only checked against the cache once
+		data->filename = cachedUrl(filename);
+		data->open = &BigWiggleReader;
+		data->close = &closeBigWiggleReader;
+		data->chromosomes = &BigWiggleReaderChromosomes;
+	} else {
+		data->filename = filename;
+		data->open = &openLazyBam;
+		data->close = &closeBamReader;
+		data->chromosomes = &BamReaderChromosomes;
+	}
+	// Not primed: the file is opened on the first pop or seek
+	return newWiggleIterator(data, &LazyReaderPop, &LazyReaderSeek, 0, false);
+}
@@ -0,0 +1,642 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "htslib/hts.h"
+#include "htslib/tbx.h"
+
+#include "lineReader.h"
+#include "threadPool.h"
+
+static const size_t STREAM_BUFFER_SIZE = 1 << 20;
+static const size_t INFLATE_BUFFER_SIZE = 1 << 18;
+
+#define ATOMIC_LOAD(X) __atomic_load_n(&(X), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_SEQ_CST)
+
+// Plain gzip streams are inflated by a dedicated thread, which writes
+// into a pipe that the parser reads from like any other stream
+typedef struct inflater_st {
+	pthread_t threadID;
+	char * filename;
+	int input;
+	int output;
+	// Compressed bytes already read from the input while sniffing it
+	unsigned char * head;
+	size_t head_length;
+	bool stop;
+} Inflater;
+
+struct lineReader_st {
+	char * filename;
+	int fd;
+	// Either the whole mapped file, or a window onto a stream
+	char * buffer;
+	size_t length;
+	size_t capacity;
+	size_t position;
+	bool mapped;
+	bool eof;
+
+	// Bgzipped files are read through htslib, possibly with a tabix index
+	htsFile * hts;
+	tbx_t * index;
+	hts_itr_t * iterator;
+	kstring_t kstring;
+
+	Inflater * inflater;
+};
+
+//////////////////////////////////////////////////////
+// Gzip inflation thread
+//////////////////////////////////////////////////////
+
+static bool writeAll(int fd, unsigned char * buffer, size_t length) {
+	while (length) {
+		ssize_t count = write(fd, buffer, length);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return false;
+		buffer += count;
+		length -= count;
+	}
+	return true;
+}
+
+static void * inflateStream(void * args) {
+	Inflater * inflater = (Inflater *) args;
+	unsigned char * input = malloc(INFLATE_BUFFER_SIZE);
+	unsigned char * output = malloc(INFLATE_BUFFER_SIZE);
+	z_stream stream;
+	int status = Z_OK;
+
+	memset(&stream, 0, sizeof(z_stream));
+	// +32: expect a gzip header
+	if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+		fprintf(stderr, "Could not initialise gzip inflation of %s\n", inflater->filename);
+		exit(1);
+	}
+	stream.next_in = inflater->head;
+	stream.avail_in = inflater->head_length;
+
+	while (!ATOMIC_LOAD(inflater->stop)) {
+		if (!stream.avail_in) {
+			ssize_t count = read(inflater->input, input, INFLATE_BUFFER_SIZE);
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count < 0 || (count == 0 && status != Z_STREAM_END)) {
+				fprintf(stderr, "Error while reading gzip file %s, it may be truncated\n", inflater->filename);
+				exit(1);
+			}
+			if (count == 0)
+				break;
+			stream.next_in = input;
+			stream.avail_in = count;
+		}
+
+		// Concatenated gzip members, e.g. BGZF blocks
+		if (status == Z_STREAM_END)
+			inflateReset(&stream);
+
+		stream.next_out = output;
+		stream.avail_out = INFLATE_BUFFER_SIZE;
+		status = inflate(&stream, Z_NO_FLUSH);
+		if (status != Z_OK && status != Z_STREAM_END) {
+			fprintf(stderr, "Corrupted gzip data in %s\n", inflater->filename);
+			exit(1);
+		}
+
+		if (!writeAll(inflater->output, output, INFLATE_BUFFER_SIZE - stream.avail_out))
+			break;
+	}
+
+	inflateEnd(&stream);
+	free(input);
+	free(output);
+	close(inflater->output);
+	return NULL;
+}
+
+// Inflates the input on a new thread, the reader then reads from a pipe
+static void startInflater(LineReader * reader, int input, unsigned char * head, size_t head_length) {
+	Inflater * inflater = (Inflater *) calloc(1, sizeof(Inflater));
+	int pipe_fds[2];
+
+	if (pipe(pipe_fds)) {
+		fprintf(stderr, "Could not create pipe to inflate %s\n", reader->filename);
+		exit(1);
+	}
+#ifdef F_SETPIPE_SZ
+	// A larger pipe lets inflation run further ahead of parsing
+	fcntl(pipe_fds[1], F_SETPIPE_SZ, STREAM_BUFFER_SIZE);
+#endif
+
+	inflater->filename = reader->filename;
+	inflater->input = input;
+	inflater->output = pipe_fds[1];
+	inflater->head = head;
+	inflater->head_length = head_length;
+
+	reader->inflater = inflater;
+	reader->fd = pipe_fds[0];
+	reader->mapped = false;
+	reader->eof = false;
+	reader->length = 0;
+	reader->position = 0;
+	if (!reader->buffer) {
+		reader->capacity = STREAM_BUFFER_SIZE;
+		reader->buffer = malloc(reader->capacity);
+	}
+
+	int err = pthread_create(&inflater->threadID, NULL, &inflateStream, inflater);
+	if (err) {
+		fprintf(stderr, "Could not create new thread %i\n", err);
+		exit(1);
+	}
+}
+
+static void stopInflater(LineReader * reader) {
+	Inflater * inflater = reader->inflater;
+
+	// Drain the pipe, so that the thread is not stuck writing into it
+	ATOMIC_STORE(inflater->stop, true);
+	while (read(reader->fd, reader->buffer, reader->capacity) > 0);
+	pthread_join(inflater->threadID, NULL);
+
+	close(reader->fd);
+	if (inflater->input != STDIN_FILENO)
+		close(inflater->input);
+	free(inflater->head);
+	free(inflater);
+	reader->inflater = NULL;
+}
+
+//////////////////////////////////////////////////////
+// Line reader
+//////////////////////////////////////////////////////
+
+static bool mapFile(LineReader * reader) {
+	struct stat info;
+
+	if (fstat(reader->fd, &info) || !S_ISREG(info.st_mode))
+		return false;
+
+	reader->mapped = true;
+	reader->eof = true;
+	reader->length = info.st_size;
+	if (reader->length == 0)
+		return true;
+
+	reader->buffer = mmap(NULL, reader->length, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+	if (reader->buffer == MAP_FAILED) {
+		fprintf(stderr, "Could not memory map input file %s\n", reader->filename);
+		exit(1);
+	}
+	madvise(reader->buffer, reader->length, MADV_SEQUENTIAL);
+	return true;
+}
+
+static void openCompressedFile(LineReader * reader) {
+	if (!(reader->hts = hts_open(reader->filename, "r"))) {
+		fprintf(stderr, "Could not open input file %s\n", reader->filename);
+		exit(1);
+	}
+	useInflationThreads(reader->hts);
+}
+
+// Moves the unread tail of a stream to the front of the buffer,
+// then tops it up from the file descriptor
+static bool refillBuffer(LineReader * reader) {
+	size_t remainder = reader->length - reader->position;
+
+	if (reader->eof)
+		return false;
+
+	memmove(reader->buffer, reader->buffer + reader->position, remainder);
+	reader->length = remainder;
+	reader->position = 0;
+
+	if (reader->length == reader->capacity) {
+		reader->capacity *= 2;
+		reader->buffer = realloc(reader->buffer, reader->capacity);
+	}
+
+	ssize_t count = read(reader->fd, reader->buffer + reader->length, reader->capacity - reader->length);
+	if (count < 0) {
+		fprintf(stderr, "Error while reading input file %s\n", reader->filename);
+		exit(1);
+	} else if (count == 0)
+		reader->eof = true;
+
+	reader->length += count;
+	return count > 0;
+}
+
+static bool isGzipHeader(unsigned char * head, size_t length) {
+	return length >= 2 && head[0] == 0x1f && head[1] == 0x8b;
+}
+
+// BGZF blocks are gzip members with a 'BC' extra subfield
+static bool isBgzfHeader(unsigned char * head, size_t length) {
+	return length >= 14 && isGzipHeader(head, length) && (head[3] & 4) && head[12] == 'B' && head[13] == 'C';
+}
+
+static void openStream(LineReader * reader) {
+	reader->capacity = STREAM_BUFFER_SIZE;
+	reader->buffer = malloc(reader->capacity);
+
+	// Streams are sniffed once their first bytes are in, which are
+	// then handed over to the inflater if need be
+	refillBuffer(reader);
+	if (isGzipHeader((unsigned char *) reader->buffer, reader->length)) {
+		unsigned char * head = malloc(reader->length);
+		memcpy(head, reader->buffer, reader->length);
+		startInflater(reader, reader->fd, head, reader->length);
+	}
+}
+
+LineReader * openLineReader(char * filename) {
+	LineReader * reader = (LineReader *) calloc(1, sizeof(LineReader));
+	unsigned char head[18];
+	ssize_t head_length;
+	reader->filename = filename;
+
+	if (strcmp(filename, "-") == 0)
+		reader->fd = STDIN_FILENO;
+	else if ((reader->fd = open(filename, O_RDONLY)) < 0) {
+		fprintf(stderr, "Could not open input file %s\n", filename);
+		exit(1);
+	}
+
+	// Compression is recognised from the first bytes, whatever the suffix
+	if (reader->fd != STDIN_FILENO && (head_length = pread(reader->fd, head, sizeof(head), 0)) > 0 && isGzipHeader(head, head_length)) {
+		if (isBgzfHeader(head, head_length) || getThreadPoolSize() == 1) {
+			close(reader->fd);
+			openCompressedFile(reader);
+			// Looks for a .tbi or .csi file next to the data
+			if (isBgzfHeader(head, head_length))
+				reader->index = tbx_index_load3(filename, NULL, HTS_IDX_SILENT_FAIL);
+		} else
+			startInflater(reader, reader->fd, NULL, 0);
+		return reader;
+	}
+
+	if (!mapFile(reader))
+		openStream(reader);
+
+	return reader;
+}
+
+static bool nextCompressedLine(LineReader * reader, char ** line, char ** end) {
+	int res;
+	if (reader->iterator)
+		res = tbx_itr_next(reader->hts, reader->index, reader->iterator, &reader->kstring);
+	else
+		res = hts_getline(reader->hts, KS_SEP_LINE, &reader->kstring);
+
+	if (res < -1) {
+		fprintf(stderr, "Error while reading input file %s\n", reader->filename);
+		exit(1);
+	} else if (res == -1)
+		return false;
+
+	*line = reader->kstring.s;
+	*end = reader->kstring.s + reader->kstring.l;
+	return true;
+}
+
+bool nextLine(LineReader * reader, char ** line, char ** end) {
+	char * newline;
+
+	if (reader->hts)
+		return nextCompressedLine(reader, line, end);
+
+	while (true) {
+		char * start = reader->buffer + reader->position;
+		size_t remainder = reader->length - reader->position;
+
+		if (remainder && (newline = memchr(start, '\n', remainder))) {
+			*line = start;
+			*end = newline;
+			reader->position += newline - start + 1;
+			return true;
+		}
+
+		if (!refillBuffer(reader)) {
+			// Last line without a trailing newline
+			if (reader->position < reader->length) {
+				*line = reader->buffer + reader->position;
+				*end = reader->buffer + reader->length;
+				reader->position = reader->length;
+				return true;
+			}
+			return false;
+		}
+	}
+}
+
+// Jumps straight to the region with the tabix index, if any.
+// Coordinates are 1-based, half open.
+bool seekLineReader(LineReader * reader, const char * chrom, int start, int finish) {
+	if (!reader->index)
+		return false;
+
+	if (reader->iterator)
+		tbx_itr_destroy(reader->iterator);
+
+	int tid = tbx_name2id(reader->index, chrom);
+	if (tid < 0)
+		reader->iterator = tbx_itr_queryi(reader->index, HTS_IDX_NONE, 0, 0);
+	else
+		reader->iterator = tbx_itr_queryi(reader->index, tid, start - 1, finish - 1);
+
+	if (!reader->iterator) {
+		fprintf(stderr, "Could not query region %s:%i-%i in %s\n", chrom, start, finish, reader->filename);
+		exit(1);
+	}
+	return true;
+}
+
+bool rewindLineReader(LineReader * reader) {
+	if (reader->hts) {
+		if (reader->iterator) {
+			tbx_itr_destroy(reader->iterator);
+			reader->iterator = NULL;
+		}
+		hts_close(reader->hts);
+		openCompressedFile(reader);
+		return true;
+	} else if (reader->inflater) {
+		if (reader->inflater->input == STDIN_FILENO)
+			return false;
+		stopInflater(reader);
+		int input = open(reader->filename, O_RDONLY);
+		if (input < 0) {
+			fprintf(stderr, "Could not open input file %s\n", reader->filename);
+			exit(1);
+		}
+		startInflater(reader, input, NULL, 0);
+		return true;
+	} else if (!reader->mapped)
+		return false;
+	reader->position = 0;
+	return true;
+}
+
+long tellLineReader(LineReader * reader) {
+	if (!reader->mapped)
+		return -1;
+	return reader->position;
+}
+
+bool jumpLineReader(LineReader * reader, long offset) {
+	if (!reader->mapped || offset < 0 || offset > reader->length)
+		return false;
+	reader->position = offset;
+	return true;
+}
+
+void closeLineReader(LineReader * reader) {
+	if (reader->hts) {
+		if (reader->iterator)
+			tbx_itr_destroy(reader->iterator);
+		if (reader->index)
+			tbx_destroy(reader->index);
+		hts_close(reader->hts);
+		free(reader->kstring.s);
+		free(reader);
+		return;
+	}
+
+	if (reader->inflater) {
+		stopInflater(reader);
+		free(reader->buffer);
+		free(reader);
+		return;
+	}
+
+	if (reader->mapped) {
+		if (reader->length)
+			munmap(reader->buffer, reader->length);
+	} else
+		free(reader->buffer);
+	if (reader->fd != STDIN_FILENO)
+		close(reader->fd);
+	free(reader);
+}
+
+// Reads the first bytes of a file, inflated if it is gzipped
+size_t readFileHead(char * filename, char * buffer, size_t length) {
+	gzFile file = gzopen(filename, "rb");
+	int count;
+
+	if (!file) {
+		fprintf(stderr, "Could not open input file %s\n", filename);
+		exit(1);
+	}
+	count = gzread(file, buffer, length);
+	gzclose(file);
+	return count > 0? count: 0;
+}
+
+//////////////////////////////////////////////////////
+// Tokenizers
+//////////////////////////////////////////////////////
+
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+void skipSpaces(char ** ptr, char * end) {
+	char * cursor = *ptr;
+	while (cursor < end && isSpace(*cursor))
+		cursor++;
+	*ptr = cursor;
+}
+
+int countTokens(char * ptr, char * end) {
+	int count = 0;
+	while (true) {
+		skipSpaces(&ptr, end);
+		if (ptr == end)
+			return count;
+		count++;
+		while (ptr < end && !isSpace(*ptr))
+			ptr++;
+	}
+}
+
+char * parseWord(char ** ptr, char * end, int * length) {
+	char * start;
+	skipSpaces(ptr, end);
+	start = *ptr;
+	while (*ptr < end && !isSpace(**ptr))
+		(*ptr)++;
+	*length = *ptr - start;
+	return start;
+}
+
+static inline int digitValue(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return 16;
+}
+
+// Reads an optionally signed integer in the given base, or with C style
+// 0x (hexadecimal) and 0 (octal) prefixes if base is 0, like %i. Returns
+// false if the value does not fit in an int.
+static bool parseIntegerInBase(char ** ptr, char * end, int base, int * result) {
+	char * cursor;
+	bool negative = false;
+	int64_t value = 0;
+	int64_t limit;
+	bool overflow = false;
+
+	skipSpaces(ptr, end);
+	cursor = *ptr;
+	if (cursor < end && (*cursor == '-' || *cursor == '+'))
+		negative = (*cursor++ == '-');
+	limit = negative? -(int64_t) INT_MIN: INT_MAX;
+
+	if (base == 0) {
+		base = 10;
+		if (cursor < end && *cursor == '0') {
+			if (cursor + 2 < end && (cursor[1] == 'x' || cursor[1] == 'X') && digitValue(cursor[2]) < 16) {
+				base = 16;
+				cursor += 2;
+			} else
+				base = 8;
+		}
+	}
+
+	for (; cursor < end && digitValue(*cursor) < base; cursor++) {
+		value = value * base + digitValue(*cursor);
+		if (value > limit) {
+			overflow = true;
+			value = limit;
+		}
+	}
+	*ptr = cursor;
+	*result = negative? -value: value;
+	return !overflow;
+}
+
+int parseInteger(char ** ptr, char * end) {
+	char * start = *ptr;
+	int value;
+
+	if (!parseIntegerInBase(ptr, end, 0, &value)) {
+		skipSpaces(&start, end);
+		fprintf(stderr, "Integer out of range: %.*s\n", (int) (*ptr - start), start);
+		exit(1);
+	}
+	return value;
+}
+
+// Exactly representable powers of ten
+static const double POWERS_OF_TEN[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const uint64_t MAX_EXACT_MANTISSA = ((uint64_t) 1) << 53;
+
+static double parseDoubleSlowly(char ** ptr, char * end) {
+	char buffer[100];
+	int length;
+	char * word = parseWord(ptr, end, &length);
+	if (length >= sizeof(buffer))
+		length = sizeof(buffer) - 1;
+	memcpy(buffer, word, length);
+	buffer[length] = '\0';
+	return strtod(buffer, NULL);
+}
+
+// Decimal numbers whose digits fit in a 53 bit mantissa and with moderate
+// exponents are converted with a single, correctly rounded, multiplication
+// or division (cf. Clinger's fast path). Anything else (nan, inf, long
+// mantissas...) goes through strtod.
+double parseDouble(char ** ptr, char * end) {
+	char * cursor;
+	bool negative = false;
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	bool seen_digit = false;
+
+	skipSpaces(ptr, end);
+	cursor = *ptr;
+
+	if (cursor < end && (*cursor == '-' || *cursor == '+'))
+		negative = (*cursor++ == '-');
+
+	for (; cursor < end && isDigit(*cursor); cursor++) {
+		seen_digit = true;
+		if (mantissa || *cursor != '0')
+			digits++;
+		mantissa = mantissa * 10 + (*cursor - '0');
+	}
+
+	if (cursor < end && *cursor == '.') {
+		for (cursor++; cursor < end && isDigit(*cursor); cursor++) {
+			seen_digit = true;
+			if (mantissa || *cursor != '0')
+				digits++;
+			mantissa = mantissa * 10 + (*cursor - '0');
+			exponent--;
+		}
+	}
+
+	if (seen_digit && cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+		char * exponent_ptr = cursor + 1;
+		if (exponent_ptr < end && (isDigit(*exponent_ptr) || ((*exponent_ptr == '-' || *exponent_ptr == '+') && exponent_ptr + 1 < end && isDigit(exponent_ptr[1])))) {
+			int exponent_value;
+			// Decimal as in strtod, out of range exponents go the slow way
+			if (parseIntegerInBase(&exponent_ptr, end, 10, &exponent_value) && exponent_value > -1000 && exponent_value < 1000)
+				exponent += exponent_value;
+			else
+				exponent = INT_MAX;
+			cursor = exponent_ptr;
+		}
+	}
+
+	if (!seen_digit || digits > 18 || mantissa > MAX_EXACT_MANTISSA || exponent < -22 || exponent > 22 || (cursor < end && !isSpace(*cursor)))
+		return parseDoubleSlowly(ptr, end);
+
+	*ptr = cursor;
+	double value = (double) mantissa;
+	if (exponent < 0)
+		value /= POWERS_OF_TEN[-exponent];
+	else
+		value *= POWERS_OF_TEN[exponent];
+	return negative? -value: value;
+}
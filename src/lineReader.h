@@ -0,0 +1,50 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _LINE_READER_H_
+#define _LINE_READER_H_
+
+#include <stdlib.h>
+#include "wiggletools.h"
+
+// Zero-copy line source over a text file.
+// Regular files are memory mapped, pipes and stdin are read through
+// a large recycled buffer, and bgzipped files are read through htslib,
+// using their tabix index (.tbi or .csi) when seeking if there is one.
+// Other gzipped files and streams are inflated on a separate thread.
+// Compression is recognised from the content, not the filename.
+// Lines are returned in place, as a [start, end) pair of pointers
+// (the newline is excluded), and are NOT null terminated.
+typedef struct lineReader_st LineReader;
+
+LineReader * openLineReader(char * filename);
+bool nextLine(LineReader * reader, char ** line, char ** end);
+bool seekLineReader(LineReader * reader, const char * chrom, int start, int finish);
+bool rewindLineReader(LineReader * reader);
+// Byte offsets of lines within memory mapped files (-1 or false otherwise)
+long tellLineReader(LineReader * reader);
+bool jumpLineReader(LineReader * reader, long offset);
+void closeLineReader(LineReader * reader);
+// Fills the buffer with the first bytes of a file, inflated if need be,
+// returns the number of bytes read
+size_t readFileHead(char * filename, char * buffer, size_t length);
+
+// In place tokenizers, all of which advance *ptr past the parsed token
+void skipSpaces(char ** ptr, char * end);
+int countTokens(char * ptr, char * end);
+int parseInteger(char ** ptr, char * end);
+double parseDouble(char ** ptr, char * end);
+char * parseWord(char ** ptr, char * end, int * length);
+
+#endif
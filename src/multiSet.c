@@ -19,14 +19,14 @@
 #include "multiSet.h"
 
 static void popClosingMultiplexers(Multiset * multi) {
-	while (fh_notempty(multi->finishes) && fh_min(multi->finishes) == multi->finish) {
-		int index = fh_extractmin(multi->finishes);
+	while (tt_notempty(multi->finishes) && tt_min(multi->finishes) == multi->finish) {
+		int index = tt_extractmin(multi->finishes);
 		Multiplexer * multiplexer = multi->multis[index];
 		popMultiplexer(multiplexer);
 		multi->inplay[index] = false;
 		multi->inplay_count--;
-		if (!multiplexer->done && !strcmp(multiplexer->chrom, multi->chrom))
-			fh_insert(multi->starts, multiplexer->start, index);
+		if (!multiplexer->done && sameChromosome(multiplexer->chrom, multi->chrom))
+			tt_insert(multi->starts, multiplexer->start, index);
 	}
 }
 
@@ -36,7 +36,7 @@ static void queueUpMultiplexers(Multiset * multi) {
 	Multiplexer ** muPtr = multi->multis;
 	int i; 
 	for (i = 0; i < multi->count; i++) {
-		if ((!(*muPtr)->done) && (!multi->chrom || strcmp((*muPtr)->chrom, multi->chrom) < 0))
+		if ((!(*muPtr)->done) && (!multi->chrom || compareChromosomes((*muPtr)->chrom, multi->chrom) < 0))
 			multi->chrom = (*muPtr)->chrom;
 		muPtr++;
 	}
@@ -50,28 +50,28 @@ static void queueUpMultiplexers(Multiset * multi) {
 	// Put those multiplexers in heap
 	muPtr = multi->multis;
 	for (i = 0; i < multi->count; i++) {
-		if ((!(*muPtr)->done) && strcmp((*muPtr)->chrom, multi->chrom) == 0)
-			fh_insert(multi->starts, (*muPtr)->start, i);
+		if ((!(*muPtr)->done) && sameChromosome((*muPtr)->chrom, multi->chrom))
+			tt_insert(multi->starts, (*muPtr)->start, i);
 		muPtr++;
 	}
 
 }
 
 static void admitNewMultiplexersIntoPlay(Multiset * multi) {
-	while (fh_notempty(multi->starts) && fh_min(multi->starts) == multi->start) {
-		int index = fh_extractmin(multi->starts);
+	while (tt_notempty(multi->starts) && tt_min(multi->starts) == multi->start) {
+		int index = tt_extractmin(multi->starts);
 		Multiplexer * multiplexer = multi->multis[index];
-		fh_insert(multi->finishes, multiplexer->finish, index);
+		tt_insert(multi->finishes, multiplexer->finish, index);
 		multi->inplay[index] = true;
 		multi->inplay_count++;
 	}
 }
 
 static void defineNewFinish(Multiset * multi) {
-	multi->finish = fh_min(multi->finishes);
+	multi->finish = tt_min(multi->finishes);
 
-	if (fh_notempty(multi->starts)) {
-		int min_start = fh_min(multi->starts);
+	if (tt_notempty(multi->starts)) {
+		int min_start = tt_min(multi->starts);
 		if (multi->finish > min_start)
 			multi->finish = min_start;
 	}
@@ -83,7 +83,7 @@ void popMultiset(Multiset * multi) {
 	// Check that there are multiplexers queued up
 	// If no multiplexers are waiting, either waiting on other chromosomes
 	// or finished.
-	if (fh_empty(multi->starts) && fh_empty(multi->finishes))
+	if (tt_empty(multi->starts) && tt_empty(multi->finishes))
 		queueUpMultiplexers(multi);
 
 	// If queues still empty
@@ -94,7 +94,7 @@ void popMultiset(Multiset * multi) {
 	if (multi->inplay_count)
 		multi->start = multi->finish;
 	else
-		multi->start = fh_min(multi->starts);
+		multi->start = tt_min(multi->starts);
 
 	admitNewMultiplexersIntoPlay(multi);
 	defineNewFinish(multi);
@@ -105,10 +105,8 @@ void seekMultiset(Multiset * multi, const char * chrom, int start, int finish) {
 	multi->done = false;
 	for (i=0; i<multi->count; i++)
 		seekMultiplexer(multi->multis[i], chrom, start, finish);
-	fh_deleteheap(multi->starts);
-	fh_deleteheap(multi->finishes);
-	multi->starts = fh_makeheap();
-	multi->finishes = fh_makeheap();
+	tt_clear(multi->starts);
+	tt_clear(multi->finishes);
 	popMultiset(multi);
 }
 
@@ -118,8 +116,8 @@ Multiset * newMultiset(Multiplexer ** multis, int count) {
 	new->multis = multis;
 	new->inplay = (bool *) calloc(count, sizeof(bool));
 	new->values = (double **) calloc(count, sizeof(double));
-	new->starts = fh_makeheap();
-	new->finishes = fh_makeheap();
+	new->starts = tt_make(count);
+	new->finishes = tt_make(count);
 	int i;
 	for (i = 0; i < count; i++)
 		new->values[i] = multis[i]->values;
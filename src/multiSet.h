@@ -26,7 +26,7 @@ struct multiset_st {
 	bool *inplay;
 	Multiplexer ** multis;
 	bool done;
-	FibHeap * starts, * finishes;
+	TournamentTree * starts, * finishes;
 };
 
 void popMultiset(Multiset* multi);
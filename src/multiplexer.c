@@ -34,16 +34,113 @@ void seekMultiplexer(Multiplexer * multi, const char * chrom, int start, int fin
 	multi->seek(multi, chrom, start, finish);
 }
 
+//////////////////////////////////////////////////////
+// Blocks
+//////////////////////////////////////////////////////
+
+MultiplexerBlock * newMultiplexerBlock(int count) {
+	MultiplexerBlock * block = (MultiplexerBlock *) calloc(1, sizeof(MultiplexerBlock));
+	block->count = count;
+	block->starts = (int *) calloc(MULTIPLEXER_BLOCK_LENGTH, sizeof(int));
+	block->finishes = (int *) calloc(MULTIPLEXER_BLOCK_LENGTH, sizeof(int));
+	block->values = (double *) calloc(count * MULTIPLEXER_BLOCK_LENGTH, sizeof(double));
+	block->inplay = (uint64_t *) calloc(count * MULTIPLEXER_BLOCK_WORDS, sizeof(uint64_t));
+	block->run_starts = (int *) calloc(count, sizeof(int));
+	block->run_values = (double *) calloc(count, sizeof(double));
+	block->run_inplay = (bool *) calloc(count, sizeof(bool));
+	return block;
+}
+
+// Writes the current run of an input into its column, up to the given row
+static void endRun(MultiplexerBlock * block, int index, int length) {
+	double * values = block->values + index * MULTIPLEXER_BLOCK_LENGTH;
+	uint64_t * inplay = block->inplay + index * MULTIPLEXER_BLOCK_WORDS;
+	int row;
+
+	for (row = block->run_starts[index]; row < length; row++)
+		values[row] = block->run_values[index];
+	if (block->run_inplay[index])
+		for (row = block->run_starts[index]; row < length; row++)
+			inplay[row / 64] |= ((uint64_t) 1) << (row % 64);
+	block->run_starts[index] = length;
+}
+
+// Starts a new run if the input changed since its current run started
+static void updateRun(Multiplexer * multi, MultiplexerBlock * block, int index) {
+	bool inplay = multi->inplay[index];
+	double value = inplay? multi->values[index]: multi->default_values[index];
+
+	if (inplay == block->run_inplay[index] && (value == block->run_values[index] || (isnan(value) && isnan(block->run_values[index]))))
+		return;
+	endRun(block, index, block->length);
+	block->run_inplay[index] = inplay;
+	block->run_values[index] = value;
+}
+
+// Reads the multiplexer up to the end of the block or of the chromosome,
+// leaving it on the first output not stored. Empty once the multiplexer is done.
+// Inputs mostly hold their values over many rows, so each column is written
+// a run of equal rows at a time, when the input changes, rather than row by row.
+void fillMultiplexerBlock(Multiplexer * multi, MultiplexerBlock * block) {
+	int i;
+
+	block->length = 0;
+	if (multi->done)
+		return;
+	block->chrom = multi->chrom;
+	memset(block->inplay, 0, multi->count * MULTIPLEXER_BLOCK_WORDS * sizeof(uint64_t));
+	for (i = 0; i < multi->count; i++) {
+		block->run_starts[i] = 0;
+		block->run_inplay[i] = multi->inplay[i];
+		block->run_values[i] = multi->inplay[i]? multi->values[i]: multi->default_values[i];
+	}
+
+	while (!multi->done && block->length < MULTIPLEXER_BLOCK_LENGTH && sameChromosome(multi->chrom, block->chrom)) {
+		int row = block->length++;
+
+		block->starts[row] = multi->start;
+		block->finishes[row] = multi->finish;
+		popMultiplexer(multi);
+
+		// Only the inputs which changed need checking, where they are tracked
+		if (multi->changed && multi->changed_count >= 0) {
+			for (i = 0; i < multi->changed_count; i++)
+				updateRun(multi, block, multi->changed[i]);
+		} else {
+			for (i = 0; i < multi->count; i++)
+				updateRun(multi, block, i);
+		}
+	}
+
+	for (i = 0; i < multi->count; i++)
+		endRun(block, i, block->length);
+}
+
+//////////////////////////////////////////////////////
+// Core multiplexer
+//////////////////////////////////////////////////////
+
+static void recordChange(Multiplexer * multi, int index) {
+	if (multi->changed_count < 0)
+		return;
+	// Strict multiplexers may skip many steps in one pop
+	if (multi->changed_count == 2 * multi->count)
+		multi->changed_count = -1;
+	else
+		multi->changed[multi->changed_count++] = index;
+}
+
 static void popClosingWiggleIterators(Multiplexer * multi) {
-	while (fh_notempty(multi->finishes) && fh_min(multi->finishes) == multi->finish) {
-		int index = fh_extractmin(multi->finishes);
+	while (tt_notempty(multi->finishes) && tt_min(multi->finishes) == multi->finish) {
+		int index = tt_extractmin(multi->finishes);
 		WiggleIterator * wi = multi->iters[index];
 		pop(wi);
 		multi->inplay[index] = false;
 		multi->inplay_count--;
 		multi->values[index] = wi->default_value;
-		if (!wi->done && !strcmp(wi->chrom, multi->chrom))
-			fh_insert(multi->starts, wi->start, index);
+		recordChange(multi, index);
+		if (!wi->done && sameChromosome(wi->chrom, multi->chrom))
+			tt_insert(multi->starts, wi->start, index);
 	}
 }
 
@@ -53,7 +150,7 @@ static void queueUpWiggleIterators(Multiplexer * multi) {
 	WiggleIterator ** muPtr = multi->iters;
 	int i; 
 	for (i = 0; i < multi->count; i++) {
-		if ((!(*muPtr)->done) && (!multi->chrom || strcmp((*muPtr)->chrom, multi->chrom) < 0))
+		if ((!(*muPtr)->done) && (!multi->chrom || compareChromosomes((*muPtr)->chrom, multi->chrom) < 0))
 			multi->chrom = (*muPtr)->chrom;
 		muPtr++;
 	}
@@ -67,28 +164,29 @@ static void queueUpWiggleIterators(Multiplexer * multi) {
 	// Put those wis in heap
 	muPtr = multi->iters;
 	for (i = 0; i < multi->count; i++) {
-		if ((!(*muPtr)->done) && strcmp((*muPtr)->chrom, multi->chrom) == 0)
-			fh_insert(multi->starts, (*muPtr)->start, i);
+		if ((!(*muPtr)->done) && sameChromosome((*muPtr)->chrom, multi->chrom))
+			tt_insert(multi->starts, (*muPtr)->start, i);
 		muPtr++;
 	}
 }
 
 static void admitNewWiggleIteratorsIntoPlay(Multiplexer * multi) {
-	while (fh_notempty(multi->starts) && fh_min(multi->starts) == multi->start) {
-		int index = fh_extractmin(multi->starts);
+	while (tt_notempty(multi->starts) && tt_min(multi->starts) == multi->start) {
+		int index = tt_extractmin(multi->starts);
 		WiggleIterator * wi = multi->iters[index];
-		fh_insert(multi->finishes, wi->finish, index);
+		tt_insert(multi->finishes, wi->finish, index);
 		multi->inplay[index] = true;
 		multi->values[index] = wi->value;
 		multi->inplay_count++;
+		recordChange(multi, index);
 	}
 }
 
 static void defineNewFinish(Multiplexer * multi) {
-	multi->finish = fh_min(multi->finishes);
+	multi->finish = tt_min(multi->finishes);
 
-	if (fh_notempty(multi->starts)) {
-		int min_start = fh_min(multi->starts);
+	if (tt_notempty(multi->starts)) {
+		int min_start = tt_min(multi->starts);
 		if (multi->finish > min_start) {
 			multi->finish = min_start;
 		}
@@ -101,7 +199,7 @@ static bool popCoreMultiplexer2(Multiplexer * multi) {
 	// Check that there are wis queued up
 	// If no wis are waiting, either waiting on other chromosomes
 	// or finished.
-	if (fh_empty(multi->starts) && fh_empty(multi->finishes))
+	if (tt_empty(multi->starts) && tt_empty(multi->finishes))
 		queueUpWiggleIterators(multi);
 
 	// If queues still empty
@@ -112,7 +210,7 @@ static bool popCoreMultiplexer2(Multiplexer * multi) {
 	if (multi->inplay_count)
 		multi->start = multi->finish;
 	else
-		multi->start = fh_min(multi->starts);
+		multi->start = tt_min(multi->starts);
 
 	admitNewWiggleIteratorsIntoPlay(multi);
 	defineNewFinish(multi);
@@ -121,6 +219,8 @@ static bool popCoreMultiplexer2(Multiplexer * multi) {
 }
 
 static void popCoreMultiplexer(Multiplexer * multi) {
+	multi->changed_count = multi->changes_lost? -1: 0;
+	multi->changes_lost = false;
 	while (!multi->done) {
 		if (popCoreMultiplexer2(multi) || !multi->strict)
 			break;
@@ -130,13 +230,15 @@ static void popCoreMultiplexer(Multiplexer * multi) {
 static void seekCoreMultiplexer(Multiplexer * multi, const char * chrom, int start, int finish) {
 	int i;
 	multi->done = false;
-	for (i=0; i<multi->count; i++)
+	for (i=0; i<multi->count; i++) {
 		seek(multi->iters[i], chrom, start, finish);
-	fh_deleteheap(multi->starts);
-	fh_deleteheap(multi->finishes);
-	multi->starts = fh_makeheap();
-	multi->finishes = fh_makeheap();
+		multi->inplay[i] = false;
+		multi->values[i] = multi->default_values[i];
+	}
+	tt_clear(multi->starts);
+	tt_clear(multi->finishes);
 	multi->inplay_count = 0;
+	multi->changes_lost = true;
 	popMultiplexer(multi);
 }
 
@@ -149,8 +251,8 @@ Multiplexer * newCoreMultiplexer(void * data, int count, void (*pop)(Multiplexer
 	new->pop = pop;
 	new->seek = seek;
 	new->data = data;
-	new->starts = fh_makeheap();
-	new->finishes = fh_makeheap();
+	new->starts = tt_make(count);
+	new->finishes = tt_make(count);
 	return new;
 }
 
@@ -158,6 +260,8 @@ Multiplexer * newMultiplexer(WiggleIterator ** iters, int count, bool strict) {
 	Multiplexer * new = newCoreMultiplexer(NULL, count, popCoreMultiplexer, seekCoreMultiplexer);
 	new->strict = strict;
 	new->iters = calloc(count, sizeof(WiggleIterator *));
+	new->changed = calloc(2 * count, sizeof(int));
+	new->changes_lost = true;
 	int i;
 	for (i = 0; i < count; i++) {
 		new->iters[i] = NonOverlappingWiggleIterator(iters[i]);
@@ -15,8 +15,10 @@
 #ifndef WIGGLE_MULTIPLEXER_H_
 #define WIGGLE_MULTIPLEXER_H_
 
+#include <stdint.h>
+
 #include "wiggleIterator.h"
-#include "fib.h"
+#include "tournament.h"
 
 struct multiplexer_st {
 	char * chrom;
@@ -31,10 +33,45 @@ struct multiplexer_st {
 	bool strict;
 	void (*pop)(Multiplexer *);
 	void (*seek)(Multiplexer *, const char *, int, int);
-	FibHeap * starts, *finishes;
+	TournamentTree * starts, *finishes;
+	// Inputs admitted or closed by the last pop, possibly repeated.
+	// NULL if not tracked, changed_count is -1 if all values may have changed
+	int * changed;
+	int changed_count;
+	bool changes_lost;
 	void * data;
 };
 
+// Consecutive outputs of a multiplexer on one chromosome, stored by column
+// so that reducers can process them in tight loops
+#define MULTIPLEXER_BLOCK_LENGTH 256
+
+typedef struct multiplexerBlock_st {
+	char * chrom;
+	int length;
+	int count;
+	int * starts;
+	int * finishes;
+	// Value of input i at row r in values[i * MULTIPLEXER_BLOCK_LENGTH + r],
+	// set to the input's default value where it is not in play
+	double * values;
+	// Bit r % 64 of inplay[i * MULTIPLEXER_BLOCK_WORDS + r / 64]
+	uint64_t * inplay;
+	// Current run of equal rows of each input, written out when it ends
+	int * run_starts;
+	double * run_values;
+	bool * run_inplay;
+} MultiplexerBlock;
+
+#define MULTIPLEXER_BLOCK_WORDS (MULTIPLEXER_BLOCK_LENGTH / 64)
+
+static inline bool inPlayInBlock(MultiplexerBlock * block, int index, int row) {
+	return (block->inplay[index * MULTIPLEXER_BLOCK_WORDS + row / 64] >> (row % 64)) & 1;
+}
+
+MultiplexerBlock * newMultiplexerBlock(int count);
+void fillMultiplexerBlock(Multiplexer * multi, MultiplexerBlock * block);
+
 void popMultiplexer(Multiplexer * multi);
 void seekMultiplexer(Multiplexer * multi, const char * chrom, int start, int finish);
 void runMultiplexer(Multiplexer * multi);
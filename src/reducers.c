@@ -13,9 +13,11 @@
 // limitations under the License.
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "multiplexer.h"
+#include "blockKernels.h"
 
 typedef struct wiggleReducerData_st {
 	Multiplexer * multi;
@@ -28,6 +30,264 @@ void WiggleReducerSeek(WiggleIterator * iter, const char * chrom, int start, int
 	pop(iter);
 }
 
+////////////////////////////////////////////////////////
+// Block reducers
+////////////////////////////////////////////////////////
+
+// Reducers which compute every output of a multiplexer block at once,
+// one input column at a time, with the vector kernels of blockKernels.c.
+// Outputs are then popped one by one from the results.
+
+typedef struct blockReducerData_st {
+	Multiplexer * multi;
+	MultiplexerBlock * block;
+	void (*reduce)(MultiplexerBlock *, double *, double *);
+	double * results;
+	// Workspace for the reduction function
+	double * scratch;
+	int row;
+} BlockReducerData;
+
+static void BlockReductionPop(WiggleIterator * wi) {
+	if (wi->done)
+		return;
+
+	BlockReducerData * data = (BlockReducerData *) wi->data;
+	MultiplexerBlock * block = data->block;
+
+	if (data->row == block->length) {
+		fillMultiplexerBlock(data->multi, block);
+		if (block->length == 0) {
+			wi->done = true;
+			return;
+		}
+		data->reduce(block, data->results, data->scratch);
+		data->row = 0;
+	}
+
+	wi->chrom = block->chrom;
+	wi->start = block->starts[data->row];
+	wi->finish = block->finishes[data->row];
+	wi->value = data->results[data->row];
+	data->row++;
+}
+
+static void BlockReductionSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
+	BlockReducerData * data = (BlockReducerData *) wi->data;
+	seekMultiplexer(data->multi, chrom, start, finish);
+	data->block->length = 0;
+	data->row = 0;
+	pop(wi);
+}
+
+static WiggleIterator * BlockReduction(Multiplexer * multi, void (*reduce)(MultiplexerBlock *, double *, double *), double default_value) {
+	BlockReducerData * data = (BlockReducerData *) calloc(1, sizeof(BlockReducerData));
+	data->multi = multi;
+	data->block = newMultiplexerBlock(multi->count);
+	data->reduce = reduce;
+	data->results = (double *) calloc(MULTIPLEXER_BLOCK_LENGTH, sizeof(double));
+	data->scratch = (double *) calloc(MULTIPLEXER_BLOCK_LENGTH, sizeof(double));
+	return newWiggleIterator(data, &BlockReductionPop, &BlockReductionSeek, default_value, false);
+}
+
+////////////////////////////////////////////////////////
+// Incremental reducers
+////////////////////////////////////////////////////////
+
+// Sums, means and variances over many inputs, maintained from one output
+// of the multiplexer to the next by only updating the inputs it admitted
+// or closed. The running sums are compensated, and recomputed from scratch
+// after a seek and at each new chromosome, so that rounding errors do not
+// build up. Below this number of inputs, recomputing is just as cheap.
+#define INCREMENTAL_MIN_INPUTS 16
+
+// Neumaier's variant of Kahan summation
+typedef struct compensatedSum_st {
+	double sum;
+	double error;
+} CompensatedSum;
+
+static void addCompensated(CompensatedSum * total, double value) {
+	double sum = total->sum + value;
+	if (fabs(total->sum) >= fabs(value))
+		total->error += (total->sum - sum) + value;
+	else
+		total->error += (value - sum) + total->sum;
+	total->sum = sum;
+}
+
+static double compensatedValue(CompensatedSum * total) {
+	return total->sum + total->error;
+}
+
+typedef struct incrementalReducerData_st {
+	Multiplexer * multi;
+	double (*reduce)(struct incrementalReducerData_st *);
+	char * chrom;
+	// Value and status of each input, as currently counted in the sums
+	double * values;
+	bool * inplay;
+	// Inputs whose values are not finite, left out of the sums
+	int nonfinite;
+	// Sum of all values
+	CompensatedSum sum;
+	// Sum of all values rounded to single precision
+	CompensatedSum float_sum;
+	// Sums of the deviations of values in play from shift, and of their squares
+	double shift;
+	CompensatedSum inplay_sum;
+	CompensatedSum inplay_squares;
+	int inplay_count;
+} IncrementalReducerData;
+
+static bool isCountable(double value) {
+	return isfinite(value) && isfinite((float) value);
+}
+
+static void countInput(IncrementalReducerData * data, int index, int sign) {
+	double value = data->values[index];
+
+	if (!isCountable(value)) {
+		data->nonfinite += sign;
+		return;
+	}
+	addCompensated(&data->sum, sign * value);
+	addCompensated(&data->float_sum, sign * (float) value);
+	if (data->inplay[index]) {
+		double deviation = value - data->shift;
+		addCompensated(&data->inplay_sum, sign * deviation);
+		addCompensated(&data->inplay_squares, sign * deviation * deviation);
+		data->inplay_count += sign;
+	}
+}
+
+static void readInput(IncrementalReducerData * data, int index) {
+	Multiplexer * multi = data->multi;
+	data->inplay[index] = multi->inplay[index];
+	data->values[index] = multi->inplay[index]? multi->values[index]: multi->default_values[index];
+}
+
+static void resetIncrementalReducer(IncrementalReducerData * data) {
+	Multiplexer * multi = data->multi;
+	double sum = 0;
+	int i, count = 0;
+
+	for (i = 0; i < multi->count; i++) {
+		readInput(data, i);
+		if (data->inplay[i] && isCountable(data->values[i])) {
+			sum += data->values[i];
+			count++;
+		}
+	}
+	// Deviations from the current mean of the values in play are small
+	data->shift = count? sum / count: 0;
+
+	data->nonfinite = 0;
+	data->inplay_count = 0;
+	memset(&data->sum, 0, sizeof(CompensatedSum));
+	memset(&data->float_sum, 0, sizeof(CompensatedSum));
+	memset(&data->inplay_sum, 0, sizeof(CompensatedSum));
+	memset(&data->inplay_squares, 0, sizeof(CompensatedSum));
+	for (i = 0; i < multi->count; i++)
+		countInput(data, i, 1);
+	data->chrom = multi->chrom;
+}
+
+static void updateIncrementalReducer(IncrementalReducerData * data) {
+	Multiplexer * multi = data->multi;
+	int i;
+
+	if (multi->changed_count < 0 || !sameChromosome(multi->chrom, data->chrom)) {
+		resetIncrementalReducer(data);
+		return;
+	}
+
+	for (i = 0; i < multi->changed_count; i++) {
+		int index = multi->changed[i];
+		countInput(data, index, -1);
+		readInput(data, index);
+		countInput(data, index, 1);
+	}
+}
+
+static void IncrementalReductionPop(WiggleIterator * wi) {
+	if (wi->done)
+		return;
+
+	IncrementalReducerData * data = (IncrementalReducerData *) wi->data;
+	Multiplexer * multi = data->multi;
+
+	if (multi->done) {
+		wi->done = true;
+		return;
+	}
+
+	updateIncrementalReducer(data);
+	wi->chrom = multi->chrom;
+	wi->start = multi->start;
+	wi->finish = multi->finish;
+	wi->value = data->reduce(data);
+	popMultiplexer(multi);
+}
+
+static WiggleIterator * IncrementalReduction(Multiplexer * multi, double (*reduce)(IncrementalReducerData *), double default_value) {
+	IncrementalReducerData * data = (IncrementalReducerData *) calloc(1, sizeof(IncrementalReducerData));
+	data->multi = multi;
+	data->reduce = reduce;
+	data->values = (double *) calloc(multi->count, sizeof(double));
+	data->inplay = (bool *) calloc(multi->count, sizeof(bool));
+	return newWiggleIterator(data, &IncrementalReductionPop, &WiggleReducerSeek, default_value, false);
+}
+
+static bool isIncremental(Multiplexer * multi) {
+	return multi->changed && multi->count >= INCREMENTAL_MIN_INPUTS;
+}
+
+// Plain sum, once infinite or NaN values are involved
+static double sumInputs(IncrementalReducerData * data) {
+	double sum = 0;
+	int i;
+	for (i = 0; i < data->multi->count; i++)
+		sum += data->values[i];
+	return sum;
+}
+
+static double reduceIncrementalSum(IncrementalReducerData * data) {
+	if (data->nonfinite)
+		return sumInputs(data);
+	return compensatedValue(&data->sum);
+}
+
+static double reduceIncrementalMean(IncrementalReducerData * data) {
+	return reduceIncrementalSum(data) / data->multi->count;
+}
+
+// Same conventions as the block variance
+static double reduceIncrementalVariance(IncrementalReducerData * data) {
+	int count = data->multi->count;
+	double mean, deviation, error;
+	int i;
+
+	if (data->nonfinite) {
+		mean = 0;
+		for (i = 0; i < count; i++)
+			mean += (float) data->values[i];
+		if (isnan(mean))
+			return NAN;
+		mean /= count;
+		error = 0;
+		for (i = 0; i < count; i++)
+			if (data->inplay[i])
+				error += (mean - data->values[i]) * (mean - data->values[i]);
+		return error / count;
+	}
+
+	mean = compensatedValue(&data->float_sum) / count;
+	deviation = mean - data->shift;
+	error = compensatedValue(&data->inplay_squares) - 2 * deviation * compensatedValue(&data->inplay_sum) + data->inplay_count * deviation * deviation;
+	return error > 0? error / count: 0;
+}
+
 ////////////////////////////////////////////////////////
 // Select
 ////////////////////////////////////////////////////////
@@ -122,373 +382,210 @@ WiggleIterator * FillInReduction(Multiplexer * multi, bool trim) {
 // Max
 ////////////////////////////////////////////////////////
 
-void MaxReductionPop(WiggleIterator * wi) {
+// NaN if any value is NaN. The first input counts as 0 where not in play
+static void reduceMaxBlock(MultiplexerBlock * block, double * results, double * scratch) {
+	BlockKernels * kernels = getBlockKernels();
 	int i;
 
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	if (multi->inplay[0])
-		wi->value = multi->values[0];
-	else
-		wi->value = 0;
-
-	if (isnan(wi->value)) {
-		popMultiplexer(multi);
-		return;
-	}
-
-	for (i = 1; i < multi->count; i++) {
-		double value;
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			break;
-		}
-
-		if (wi->value < value)
-			wi->value = value;
-	}
-	popMultiplexer(multi);
+	kernels->inPlay(results, block->values, block->inplay, block->length);
+	for (i = 1; i < block->count; i++)
+		kernels->max(results, block->values + i * MULTIPLEXER_BLOCK_LENGTH, block->length);
 }
 
 WiggleIterator * MaxReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
-	double max = data->multi->default_values[0];
+	double max = multi->default_values[0];
 	if (!isnan(max)) {
 		for (i = 1; i < multi->count; i++) {
-			if (isnan(data->multi->default_values[i])) {
+			if (isnan(multi->default_values[i])) {
 				max = NAN;
 				break;
 			}
-			if (data->multi->default_values[i] > max)
-				max = data->multi->default_values[i];
+			if (multi->default_values[i] > max)
+				max = multi->default_values[i];
 		}
 	}
-	return newWiggleIterator(data, &MaxReductionPop, &WiggleReducerSeek, max, false);
+	return BlockReduction(multi, &reduceMaxBlock, max);
 }
 
 ////////////////////////////////////////////////////////
 // Min
 ////////////////////////////////////////////////////////
 
-void MinReductionPop(WiggleIterator * wi) {
+// NaN if any value is NaN. The first input counts as 0 where not in play
+static void reduceMinBlock(MultiplexerBlock * block, double * results, double * scratch) {
+	BlockKernels * kernels = getBlockKernels();
 	int i;
 
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	if (multi->inplay[0])
-		wi->value = multi->values[0];
-	else
-		wi->value = 0;
-
-	if (isnan(wi->value)) {
-		popMultiplexer(multi);
-		return;
-	}
-
-	for (i = 1; i < multi->count; i++) {
-		double value;
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			break;
-		}
-
-		if (wi->value > value)
-			wi->value = value;
-	}
-	popMultiplexer(multi);
+	kernels->inPlay(results, block->values, block->inplay, block->length);
+	for (i = 1; i < block->count; i++)
+		kernels->min(results, block->values + i * MULTIPLEXER_BLOCK_LENGTH, block->length);
 }
 
 WiggleIterator * MinReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
-	double min = data->multi->default_values[0];
+	double min = multi->default_values[0];
 	if (!isnan(min)) {
 		for (i = 1; i < multi->count; i++) {
-			if (isnan(data->multi->default_values[i])) {
+			if (isnan(multi->default_values[i])) {
 				min = NAN;
 				break;
 			}
-			if (data->multi->default_values[i] < min)
-				min = data->multi->default_values[i];
+			if (multi->default_values[i] < min)
+				min = multi->default_values[i];
 		}
 	}
-	return newWiggleIterator(data, &MinReductionPop, &WiggleReducerSeek, min, false);
+	return BlockReduction(multi, &reduceMinBlock, min);
 }
 
 ////////////////////////////////////////////////////////
 // Sum
 ////////////////////////////////////////////////////////
 
-void SumReductionPop(WiggleIterator * wi) {
+static void sumBlock(MultiplexerBlock * block, double * results) {
+	BlockKernels * kernels = getBlockKernels();
 	int i;
 
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	wi->value = 0;
-	for (i = 0; i < multi->count; i++) {
-		double value;
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			break;
-		}
+	memset(results, 0, block->length * sizeof(double));
+	for (i = 0; i < block->count; i++)
+		kernels->add(results, block->values + i * MULTIPLEXER_BLOCK_LENGTH, block->length);
+}
 
-		wi->value += value;
-	}
-	popMultiplexer(multi);
+static void reduceSumBlock(MultiplexerBlock * block, double * results, double * scratch) {
+	sumBlock(block, results);
 }
 
 WiggleIterator * SumReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
 	double sum = 0;
 	for (i = 0; i < multi->count; i++) {
-		if (isnan(data->multi->default_values[i])) {
+		if (isnan(multi->default_values[i])) {
 			sum = NAN;
 			break;
 		}
-		sum += data->multi->default_values[i];
+		sum += multi->default_values[i];
 	}
-	return newWiggleIterator(data, &SumReductionPop, &WiggleReducerSeek, sum, false);
+	if (isIncremental(multi))
+		return IncrementalReduction(multi, &reduceIncrementalSum, sum);
+	return BlockReduction(multi, &reduceSumBlock, sum);
 }
 
 ////////////////////////////////////////////////////////
 // Product
 ////////////////////////////////////////////////////////
 
-void ProductReductionPop(WiggleIterator * wi) {
-	int i;
-
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	wi->value = 1;
-	for (i = 0; i < multi->count; i++) {
-		double value;
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			break;
-		}
+static void reduceProductBlock(MultiplexerBlock * block, double * results, double * scratch) {
+	BlockKernels * kernels = getBlockKernels();
+	int i, row;
 
-		wi->value *= value;
-	}
-	popMultiplexer(multi);
+	for (row = 0; row < block->length; row++)
+		results[row] = 1;
+	for (i = 0; i < block->count; i++)
+		kernels->multiply(results, block->values + i * MULTIPLEXER_BLOCK_LENGTH, block->length);
 }
 
 WiggleIterator * ProductReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
 	double prod = 1;
 	for (i = 0; i < multi->count; i++) {
-		if (isnan(data->multi->default_values[i])) {
+		if (isnan(multi->default_values[i])) {
 			prod = NAN;
 			break;
 		}
-		prod *= data->multi->default_values[i];
+		prod *= multi->default_values[i];
 	}
-	return newWiggleIterator(data, &ProductReductionPop, &WiggleReducerSeek, prod, false);
+	return BlockReduction(multi, &reduceProductBlock, prod);
 }
 
 ////////////////////////////////////////////////////////
 // Mean
 ////////////////////////////////////////////////////////
 
-void MeanReductionPop(WiggleIterator * wi) {
-	int i;
-
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	wi->value = 0;
-	for (i = 0; i < multi->count; i++) {
-		double value;
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			break;
-		}
+static void reduceMeanBlock(MultiplexerBlock * block, double * results, double * scratch) {
+	int row;
 
-		wi->value += value;
-	}
-	if (!isnan(wi->value))
-		wi->value /= multi->count;
-	popMultiplexer(multi);
+	sumBlock(block, results);
+	for (row = 0; row < block->length; row++)
+		results[row] /= block->count;
 }
 
 WiggleIterator * MeanReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
 	double sum = 0;
 	for (i = 0; i < multi->count; i++) {
-		if (isnan(data->multi->default_values[i])) {
+		if (isnan(multi->default_values[i])) {
 			sum = NAN;
 			break;
 		}
-		sum += data->multi->default_values[i];
+		sum += multi->default_values[i];
 	}
 	float default_value;
 	if (isnan(sum))
 		default_value = NAN;
 	else
 		default_value = sum/multi->count;
-	return newWiggleIterator(data, &MeanReductionPop, &WiggleReducerSeek, default_value, false);
+	if (isIncremental(multi))
+		return IncrementalReduction(multi, &reduceIncrementalMean, default_value);
+	return BlockReduction(multi, &reduceMeanBlock, default_value);
 }
 
 ////////////////////////////////////////////////////////
 // Variance
 ////////////////////////////////////////////////////////
 
-void VarianceReductionPop(WiggleIterator * wi) {
-	int i;
-
-	if (wi->done)
-		return;
+// Means of the values, rounded to single precision
+static void floatMeanBlock(MultiplexerBlock * block, double * means) {
+	BlockKernels * kernels = getBlockKernels();
+	int i, row;
 
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
+	memset(means, 0, block->length * sizeof(double));
+	for (i = 0; i < block->count; i++)
+		kernels->addFloat(means, block->values + i * MULTIPLEXER_BLOCK_LENGTH, block->length);
 
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
+	for (row = 0; row < block->length; row++)
+		means[row] /= block->count;
+}
 
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
+// Sums of squared deviations from the means, over all inputs or only those in play
+static void squaredErrorBlock(MultiplexerBlock * block, double * means, double * results, bool inplay_only) {
+	BlockKernels * kernels = getBlockKernels();
+	int i;
 
-	double mean = 0;
-	double count = 0;
-	for (i = 0; i < multi->count; i++) {
-		float value;
+	memset(results, 0, block->length * sizeof(double));
+	for (i = 0; i < block->count; i++) {
+		double * values = block->values + i * MULTIPLEXER_BLOCK_LENGTH;
+		if (inplay_only)
+			kernels->squaredErrorInPlay(results, means, values, block->inplay + i * MULTIPLEXER_BLOCK_WORDS, block->length);
+		else
+			kernels->squaredError(results, means, values, block->length);
+	}
+}
 
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else 	
-			value = multi->default_values[i];
+// Deviations of the inputs not in play are left out
+static void reduceVarianceBlock(MultiplexerBlock * block, double * results, double * means) {
+	int row;
 
-		if (isnan(value)) {
-			mean = NAN;
-			break;
-		}
-		mean += value;
-		count++;
+	if (block->count < 2) {
+		for (row = 0; row < block->length; row++)
+			results[row] = NAN;
+		return;
 	}
 
-	if (count < 2 || isnan(mean)) {
-		wi->value = NAN;
-	} else {
-		mean /= count;
-		
-		wi->value = 0;
-		for (i = 0; i < multi->count; i++) {
-			if (multi->inplay[i]) {
-				double diff = mean - multi->values[i];
-				wi->value += diff * diff;
-			}
-		}
-		wi->value /= count;
-	}
-	popMultiplexer(multi);
+	floatMeanBlock(block, means);
+	squaredErrorBlock(block, means, results, true);
+	for (row = 0; row < block->length; row++)
+		results[row] = isnan(means[row])? NAN: results[row] / block->count;
 }
 
 WiggleIterator * VarianceReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
 	double sum = 0;
 	for (i = 0; i < multi->count; i++) {
-		if (isnan(data->multi->default_values[i])) {
+		if (isnan(multi->default_values[i])) {
 			sum = NAN;
 			break;
 		}
-		sum += data->multi->default_values[i];
+		sum += multi->default_values[i];
 	}
 	double default_value;
 	if (isnan(sum)) 
@@ -497,82 +594,37 @@ WiggleIterator * VarianceReduction(Multiplexer * multi) {
 		double mean = sum / multi->count;
 		double error = 0;
 		for (i = 0; i < multi->count; i++)
-			error += (data->multi->default_values[i] - mean) * (data->multi->default_values[i] - mean);
+			error += (multi->default_values[i] - mean) * (multi->default_values[i] - mean);
 		default_value = error/multi->count;
 	}
 
-	return newWiggleIterator(data, &VarianceReductionPop, &WiggleReducerSeek, default_value, false);
+	if (isIncremental(multi))
+		return IncrementalReduction(multi, &reduceIncrementalVariance, default_value);
+	return BlockReduction(multi, &reduceVarianceBlock, default_value);
 }
 
 ////////////////////////////////////////////////////////
 // StdDev
 ////////////////////////////////////////////////////////
 
-void StdDevReductionPop(WiggleIterator * wi) {
-	int i;
-	double mean, diff;
-
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	mean = 0;
-	for (i = 0; i < multi->count; i++) {
-		float value;
-		if (multi->inplay[i])
-			value = multi->values[i];
-		else
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			mean = NAN;
-			break;
-		}
+static void reduceStdDevBlock(MultiplexerBlock * block, double * results, double * means) {
+	int row;
 
-		mean += value;
-	}
-
-	if (isnan(mean))
-		wi->value = NAN;
-	else {
-		mean /= multi->count;
-		
-		wi->value = 0;
-		for (i = 0; i < multi->count; i++) {
-			if (multi->inplay[i])
-				diff = mean - multi->values[i];
-			else
-				diff = mean - multi->default_values[i];
-			wi->value += diff * diff;
-		}
-		wi->value /= multi->count;
-		wi->value = sqrt(wi->value);
-	}
-	
-	popMultiplexer(multi);
+	floatMeanBlock(block, means);
+	squaredErrorBlock(block, means, results, false);
+	for (row = 0; row < block->length; row++)
+		results[row] = isnan(means[row])? NAN: sqrt(results[row] / block->count);
 }
 
 WiggleIterator * StdDevReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 	int i;
 	double sum = 0;
 	for (i = 0; i < multi->count; i++) {
-		if (isnan(data->multi->default_values[i])) {
+		if (isnan(multi->default_values[i])) {
 			sum = NAN;
 			break;
 		}
-		sum += data->multi->default_values[i];
+		sum += multi->default_values[i];
 	}
 	double default_value;
 
@@ -582,65 +634,39 @@ WiggleIterator * StdDevReduction(Multiplexer * multi) {
 		double mean = sum / multi->count;
 		double error = 0;
 		for (i = 0; i < multi->count; i++)
-			error += (data->multi->default_values[i] - mean) * (data->multi->default_values[i] - mean);
+			error += (multi->default_values[i] - mean) * (multi->default_values[i] - mean);
 		default_value = sqrt(error/multi->count);
 	}
 
-	return newWiggleIterator(data, &StdDevReductionPop, &WiggleReducerSeek, default_value, false);
+	return BlockReduction(multi, &reduceStdDevBlock, default_value);
 }
 
 ////////////////////////////////////////////////////////
 // Shannon entropy
 ////////////////////////////////////////////////////////
 
-void EntropyReductionPop(WiggleIterator * wi) {
-	int i;
-	float count = 0;
-
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
-
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-
-	for (i = 0; i < multi->count; i++) {
-		double value;
-		if (multi->inplay[i]) 
-			value = multi->values[i]; 
-		else 
-			value = multi->default_values[i];
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			popMultiplexer(multi);
-			return;
-		} else if (value > 0)
-			count++;
-	}
-
-	if (count == 0 || count == multi->count)
-		wi->value = 0;
-	else {
-		double p = count / multi->count;
-		wi->value = - p * log(p) - (1-p) * log(1 - p);
+// Binary entropy of the fraction of positive values, NaN if any value is NaN
+static void reduceEntropyBlock(MultiplexerBlock * block, double * results, double * scratch) {
+	BlockKernels * kernels = getBlockKernels();
+	int i, row;
+
+	memset(results, 0, block->length * sizeof(double));
+	for (i = 0; i < block->count; i++)
+		kernels->countPositive(results, block->values + i * MULTIPLEXER_BLOCK_LENGTH, block->length);
+
+	for (row = 0; row < block->length; row++) {
+		if (isnan(results[row]))
+			continue;
+		else if (results[row] == 0 || results[row] == block->count)
+			results[row] = 0;
+		else {
+			double p = results[row] / block->count;
+			results[row] = - p * log(p) - (1-p) * log(1 - p);
+		}
 	}
-	
-	popMultiplexer(multi);
 }
 
 WiggleIterator * EntropyReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
-
 	int i;
 	int count = 0;
 	for (i = 0; i < multi->count; i++) {
@@ -648,85 +674,40 @@ WiggleIterator * EntropyReduction(Multiplexer * multi) {
 			count = -1;
 			break;
 		}
-		if (multi->default_values[i] != 0)
+		if (multi->default_values[i] > 0)
 			count++;
 	}
 	double default_value;
 	if (count == -1)
 		default_value = NAN;
+	else if (count == 0 || count == multi->count)
+		default_value = 0;
 	else {
-		double p = count / multi->count;
-		if (p)
-			default_value = - p * log(p) - (1-p) * log(1 - p);
-		else
-			default_value = 0;
+		double p = (double) count / multi->count;
+		default_value = - p * log(p) - (1-p) * log(1 - p);
 	}
 
-	return newWiggleIterator(data, &StdDevReductionPop, &WiggleReducerSeek, default_value, false);
+	return BlockReduction(multi, &reduceEntropyBlock, default_value);
 }
 
 ////////////////////////////////////////////////////////
 // CV
 ////////////////////////////////////////////////////////
 
-void CVReductionPop(WiggleIterator * wi) {
-	int i;
-	double mean, diff;
-
-	if (wi->done)
-		return;
-
-	WiggleReducerData * data = (WiggleReducerData *) wi->data;
-	Multiplexer * multi = data->multi;
-
-	if (multi->done) {
-		wi->done = true;
-		return;
-	}
+static void reduceCVBlock(MultiplexerBlock * block, double * results, double * means) {
+	int row;
 
-	wi->chrom = multi->chrom;
-	wi->start = multi->start;
-	wi->finish = multi->finish;
-	mean = 0;
-	for (i = 0; i < multi->count; i++) {
-		float value;
-		if (multi->inplay[i])
-			value = multi->values[i];
+	floatMeanBlock(block, means);
+	squaredErrorBlock(block, means, results, false);
+	for (row = 0; row < block->length; row++) {
+		if (isnan(means[row]) || means[row] == 0)
+			results[row] = NAN;
 		else
-			value = multi->default_values[i];
-		mean += value;
-
-		if (isnan(value)) {
-			wi->value = NAN;
-			popMultiplexer(multi);
-			return;
-		}
+			results[row] = sqrt(results[row] / block->count) / means[row];
 	}
-	mean /= multi->count;
-
-	if (mean == 0) {
-		wi->value = NAN;
-		popMultiplexer(multi);
-		return;
-	}
-	
-	wi->value = 0;
-	for (i = 0; i < multi->count; i++) {
-		if (multi->inplay[i])
-			diff = mean - multi->values[i];
-		else
-			diff = mean - multi->default_values[i];
-		wi->value += diff * diff;
-	}
-	wi->value /= multi->count;
-	wi->value = sqrt(wi->value) / mean;
-	
-	popMultiplexer(multi);
 }
 
 WiggleIterator * CVReduction(Multiplexer * multi) {
-	WiggleReducerData * data = (WiggleReducerData *) calloc(1, sizeof(WiggleReducerData));
-	data->multi = multi;
 
 	int i;
 	double mean = 0;
@@ -747,7 +728,7 @@ WiggleIterator * CVReduction(Multiplexer * multi) {
 		default_value = sqrt(error/multi->count)/mean;
 	} else
 		default_value = NAN;
-	return newWiggleIterator(data, &CVReductionPop, &WiggleReducerSeek, default_value, false);
+	return BlockReduction(multi, &reduceCVBlock, default_value);
 }
 
 
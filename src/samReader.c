@@ -16,86 +16,98 @@
 #include <string.h> 
 
 #include "wiggleIterator.h"
-#include "hashfib.h"
+#include "breakpoints.h"
+#include "lineReader.h"
+#include "bufferedReader.h"
 
 typedef struct samReaderData_st {
 	char  *filename;
-	FILE * file;
+	LineReader * reader;
 	char * target_chrom;
 	int stop;
 	bool read_count;
 
-	HashFib * starts, * ends;
+	Breakpoints * starts, * ends;
 	char chrom[1000];
-	char cigar[1000];
+	// CIGAR string of the current read, in place in the line reader's buffer
+	char * cigar;
+	char * cigar_end;
 	int pos;
 	bool done;
 } SamReaderData;
 
-static int isSeparator(char c) {
-	char * separators = "MIDNSHPX=";
-	int i;
-
-	for (i = 0; i < 9; i++)
-		if (c == separators[i])
-			return 1;
-	return 0;
+// Returns the next tab separated field, and moves *ptr past its tab
+static char * nextField(char ** ptr, char * end, int * length) {
+	char * start = *ptr;
+	char * tab = memchr(start, '\t', end - start);
+	if (!tab)
+		tab = end;
+	*length = tab - start;
+	*ptr = tab < end? tab + 1: end;
+	return start;
 }
 
-static char * readNextCigarBlock(char * cigar, char * block) {
-	int i;
-	int lgth = strlen(cigar);
-	for (i = 0; i < lgth && (i == 0 || !isSeparator(cigar[i-1])); i++) 
-		block[i] = cigar[i];
-	block[i] = '\0';
+static void storeReadComponents(Breakpoints * starts, Breakpoints * ends, int start, char * cigar, char * end) {
+	char * ptr = cigar;
 
-	if (i)
-		return cigar + i;
-	else
-		return NULL;
-}
+	while (ptr < end) {
+		int count = 0;
+		for (; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++)
+			count = count * 10 + (*ptr - '0');
+		if (ptr == end)
+			return;
 
-static int storeReadComponent(HashFib * starts, HashFib * ends, int start, char * block) {
-	int last = strlen(block) - 1;
-	char type = block[last];
-	block[last] = '\0';
-	int count = atoi(block);
-	
-	switch (type) {
-		case 'M':
-		case 'X':
-		case '=':
-		case 'D':
-			hashfib_insert(starts, start);
-			hashfib_insert(ends, start + count);
-		case 'N':
-			return start + count;
-		default:
-			return start;
+		switch (*ptr++) {
+			case 'M':
+			case 'X':
+			case '=':
+			case 'D':
+				breakpoints_insert(starts, start);
+				breakpoints_insert(ends, start + count);
+			case 'N':
+				start += count;
+		}
 	}
 }
 
 static void readLine(SamReaderData * data) {
-	char line[5000];
-	char chrom[1000];
-	int pos;
+	char * line, * end, * ptr, * chrom;
+	int length, chrom_length, pos;
 
-	while (fgets(line, 5000, data->file)) {
-		if (line[0] == '#')
+	while (nextLine(data->reader, &line, &end)) {
+		if (line == end || line[0] == '#' || line[0] == '@')
 			continue;
-		if (line[0] == EOF) {
-			data->done = true;
-			return;
-		}
 
-		sscanf(line, "%*s\t%*i\t%s\t%i\t%*i\t%s", chrom, &pos, data->cigar);
-
-		if (strcmp(chrom, data->chrom) < 0 || (strcmp(chrom, data->chrom) == 0 && pos < data->pos)) {
-			fprintf(stderr, "Sam file %s is not sorted!\nPosition %s:%i should be before %s:%i\n", data->filename, chrom, pos, data->chrom, data->pos);
+		// QNAME, FLAG, RNAME, POS, MAPQ, CIGAR
+		ptr = line;
+		nextField(&ptr, end, &length);
+		nextField(&ptr, end, &length);
+		chrom = nextField(&ptr, end, &chrom_length);
+		pos = parseInteger(&ptr, end);
+		nextField(&ptr, end, &length);
+		nextField(&ptr, end, &length);
+		data->cigar = nextField(&ptr, end, &length);
+		data->cigar_end = data->cigar + length;
+
+		// Most reads are on the same chromosome as the previous one
+		if (strncmp(chrom, data->chrom, chrom_length) || data->chrom[chrom_length] != '\0') {
+			if (chrom_length >= sizeof(data->chrom)) {
+				fprintf(stderr, "Chromosome name too long in Sam file %s\n", data->filename);
+				exit(1);
+			}
+			char previous[sizeof(data->chrom)];
+			strcpy(previous, data->chrom);
+			memcpy(data->chrom, chrom, chrom_length);
+			data->chrom[chrom_length] = '\0';
+			if (strcmp(data->chrom, previous) < 0) {
+				fprintf(stderr, "Sam file %s is not sorted!\nPosition %s:%i should be before %s:%i\n", data->filename, data->chrom, pos, previous, data->pos);
+				exit(1);
+			}
+		} else if (pos < data->pos) {
+			fprintf(stderr, "Sam file %s is not sorted!\nPosition %s:%i should be before %s:%i\n", data->filename, data->chrom, pos, data->chrom, data->pos);
 			exit(1);
 		}
 
-		strcpy(data->chrom, chrom);
 		data->pos = pos;
 		return;
 	}
@@ -103,19 +115,11 @@ static void readLine(SamReaderData * data) {
 	data->done = true;
 }
 
-static void storeReadComponents(HashFib * starts, HashFib * ends, int start, char * cigar) {
-	char block[100];
-	char * ptr;
-
-	for (ptr = readNextCigarBlock(cigar, block); ptr; ptr = readNextCigarBlock(ptr, block)) 
-		start = storeReadComponent(starts, ends, start, block);
-}
-
 static void loadNextReadsOnChrom(WiggleIterator * wi) {
 	SamReaderData * data = (SamReaderData *) wi->data;
 
-	while (!data->done && !strcmp(wi->chrom, data->chrom) && (hashfib_empty(data->ends) || hashfib_empty(data->starts) || data->pos <= hashfib_min(data->ends) || data->pos <= hashfib_min(data->starts))) {
-		storeReadComponents(data->starts, data->ends, data->pos, data->cigar);
+	while (!data->done && !strcmp(wi->chrom, data->chrom) && (breakpoints_empty(data->ends) || breakpoints_empty(data->starts) || data->pos <= breakpoints_min(data->ends) || data->pos <= breakpoints_min(data->starts))) {
+		storeReadComponents(data->starts, data->ends, data->pos, data->cigar, data->cigar_end);
 		readLine(data);
 	}
 }
@@ -126,7 +130,7 @@ static void stepForward(WiggleIterator * wi) {
 	if (wi->value)
 		wi->start = wi->finish;
 	else
-		wi->start = hashfib_min(data->starts);
+		wi->start = breakpoints_min(data->starts);
 
 	if (wi->start == -1)
 		abort();
@@ -142,14 +146,14 @@ static void stepForward(WiggleIterator * wi) {
 	}
 
 	// Compute value
-	if (!hashfib_empty(data->starts) && hashfib_min(data->starts) == wi->start)
-		wi->value += hashfib_remove_min(data->starts);
+	if (!breakpoints_empty(data->starts) && breakpoints_min(data->starts) == wi->start)
+		wi->value += breakpoints_remove_min(data->starts);
 
 	// Compute finish
-	if (hashfib_empty(data->starts) || hashfib_min(data->ends) < hashfib_min(data->starts)) 
-		wi->finish = hashfib_min(data->ends);
+	if (breakpoints_empty(data->starts) || breakpoints_min(data->ends) < breakpoints_min(data->starts)) 
+		wi->finish = breakpoints_min(data->ends);
 	else
-		wi->finish = hashfib_min(data->starts);
+		wi->finish = breakpoints_min(data->starts);
 
 	// If overshot
 	if (data->target_chrom && wi->finish > data->stop)
@@ -165,17 +169,15 @@ void SamReaderPop(WiggleIterator * wi) {
 
 	if (data->read_count) {
 		if (data->done) {
-			fclose(data->file);
-			data->file = NULL;
+			closeLineReader(data->reader);
+			data->reader = NULL;
 			wi->done = true;
 			return;
 		}
 
 		// Initialise iterator values
-		if (!wi->chrom || strcmp(wi->chrom, data->chrom)) {
-			wi->chrom = (char *) calloc(strlen(data->chrom) + 1, sizeof(char));
-			strcpy(wi->chrom, data->chrom);
-		}
+		if (!wi->chrom || strcmp(wi->chrom, data->chrom))
+			wi->chrom = internChromosome(data->chrom);
 		wi->start = data->pos;
 		wi->finish = data->pos + 1;
 		wi->value = 0;
@@ -188,8 +190,8 @@ void SamReaderPop(WiggleIterator * wi) {
 	} else {
 		// Plan A is if already on a chromosome and there is remaining business there:
 		if (wi->chrom) {
-			while (!hashfib_empty(data->ends) && hashfib_min(data->ends) == wi->finish) {
-				wi->value -= hashfib_remove_min(data->ends);
+			while (!breakpoints_empty(data->ends) && breakpoints_min(data->ends) == wi->finish) {
+				wi->value -= breakpoints_remove_min(data->ends);
 				if (wi->value < 0) {
 					fprintf(stderr, "Negative coverage at %s:%i???\n", wi->chrom, wi->finish);
 					exit(1);
@@ -198,7 +200,7 @@ void SamReaderPop(WiggleIterator * wi) {
 
 			loadNextReadsOnChrom(wi);
 
-			if (!hashfib_empty(data->ends)) {
+			if (!breakpoints_empty(data->ends)) {
 				stepForward(wi);
 				return;
 			}
@@ -207,19 +209,18 @@ void SamReaderPop(WiggleIterator * wi) {
 		// Plan B if nothing to do on chromosome, move to next one:
 		// This re-initialisation is needed because the default init value is 1 for the WiggleIterator
 		wi->value = 0;
-		wi->chrom = (char *) calloc(strlen(data->chrom) + 1, sizeof(char));
-		strcpy(wi->chrom, data->chrom);
+		wi->chrom = internChromosome(data->chrom);
 
 		loadNextReadsOnChrom(wi);
 
-		if (!hashfib_empty(data->ends)) {
+		if (!breakpoints_empty(data->ends)) {
 			stepForward(wi);
 			return;
 		}
 
 		// Plan C: just quit it
-		fclose(data->file);
-		data->file = NULL;
+		closeLineReader(data->reader);
+		data->reader = NULL;
 		wi->done = true;
 	} 
 }
@@ -227,7 +228,7 @@ void SamReaderPop(WiggleIterator * wi) {
 void SamReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
 	SamReaderData * data = (SamReaderData*) wi->data;
 
-	if (data->file == stdin) {
+	if (strcmp(data->filename, "-") == 0) {
 		fprintf(stderr, "Cannot do a seek on stdin stream!\n");
 		exit(1);
 	}
@@ -237,12 +238,12 @@ void SamReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finis
 	data->target_chrom = chrom;
 
 	// Possibly start reading file from the top
-	if (!data->file || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
-		if (data->file)
-			fclose(data->file);
-		if (!(data->file = fopen(data->filename, "r"))) {
-			fprintf(stderr, "Could not open input file %s\n", data->filename);
-			exit(1);
+	if (!data->reader || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
+		if (!data->reader)
+			data->reader = openLineReader(data->filename);
+		else if (!rewindLineReader(data->reader)) {
+			closeLineReader(data->reader);
+			data->reader = openLineReader(data->filename);
 		}
 		wi->done = false;
 		// This is needed to avoid triggering the out of order check in the readLine below
@@ -251,10 +252,10 @@ void SamReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finis
 
 		// Reset coverage data structures
 		if (!data->read_count) {
-			hashfib_destroy(data->starts);
-			hashfib_destroy(data->ends);
-			data->starts = hashfib_construct();
-			data->ends = hashfib_construct();
+			breakpoints_destroy(data->starts);
+			breakpoints_destroy(data->ends);
+			data->starts = breakpoints_construct();
+			data->ends = breakpoints_construct();
 		}
 		data->done = false;
 		readLine(data);
@@ -272,23 +273,75 @@ void SamReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finis
 		wi->start = start;
 }
 
-WiggleIterator * SamReader(char * filename, bool read_count) {
+static WiggleIterator * SynchronousSamReader(char * filename, bool read_count) {
 	SamReaderData * data = (SamReaderData *) calloc(1, sizeof(SamReaderData));
 	data->filename = filename;
 	data->stop = -1;
 	data->read_count = read_count;
 	if (!read_count) {
-		data->starts = hashfib_construct();
-		data->ends = hashfib_construct();
+		data->starts = breakpoints_construct();
+		data->ends = breakpoints_construct();
 	}
-	if (strcmp(filename, "-")) {
-		if (!(data->file = fopen(filename, "r"))) {
-			fprintf(stderr, "Could not open input file %s\n", filename);
-			exit(1);
-		}
-	} else
-		data->file = stdin;
+	data->reader = openLineReader(filename);
 	readLine(data);
 
 	return newWiggleIterator(data, &SamReaderPop, &SamReaderSeek, 0, false);
 }
+
+//////////////////////////////////////////////////////
+// Background parsing
+//////////////////////////////////////////////////////
+
+// The synchronous reader above runs as a task of the thread pool,
+// which pipelines parsing (e.g. of stdin) with downstream computations
+typedef struct samStreamData_st {
+	WiggleIterator * reader;
+	BufferedReaderData * bufferedReaderData;
+} SamStreamData;
+
+static void * streamSamFile(void * args) {
+	SamStreamData * data = (SamStreamData *) args;
+	WiggleIterator * reader = data->reader;
+
+	for (; !reader->done; pop(reader))
+		if (pushValuesToBuffer(data->bufferedReaderData, reader->chrom, reader->start, reader->finish, reader->value))
+			break;
+
+	endBufferedSignal(data->bufferedReaderData);
+	return NULL;
+}
+
+static void SamStreamPop(WiggleIterator * wi) {
+	SamStreamData * data = (SamStreamData *) wi->data;
+	BufferedReaderPop(wi, data->bufferedReaderData);
+}
+
+static void SamStreamSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
+	SamStreamData * data = (SamStreamData *) wi->data;
+
+	// Kill ongoing job before touching the reader
+	if (data->bufferedReaderData) {
+		killBufferedReader(data->bufferedReaderData);
+		free(data->bufferedReaderData);
+		data->bufferedReaderData = NULL;
+	}
+
+	seek(data->reader, chrom, start, finish);
+	launchBufferedReader(&streamSamFile, data, &(data->bufferedReaderData));
+	wi->done = false;
+	SamStreamPop(wi);
+}
+
+WiggleIterator * SamReader(char * filename, bool holdFire, bool read_count) {
+	WiggleIterator * reader = SynchronousSamReader(filename, read_count);
+
+	// A single thread gains nothing from pipelining
+	if (getThreadPoolSize() == 1)
+		return reader;
+
+	SamStreamData * data = (SamStreamData *) calloc(1, sizeof(SamStreamData));
+	data->reader = reader;
+	if (!holdFire)
+		launchBufferedReader(&streamSamFile, data, &(data->bufferedReaderData));
+	return newWiggleIterator(data, &SamStreamPop, &SamStreamSeek, 0, false);
+}
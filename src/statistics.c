@@ -366,7 +366,7 @@ static void EnergyPop(WiggleIterator * wi) {
 		return;
 	}
 
-	if (wi->chrom != data->source->chrom)
+	if (!wi->chrom || !sameChromosome(wi->chrom, data->source->chrom))
 		data->chrom_offset += wi->finish;
 
 	wi->chrom = data->source->chrom;
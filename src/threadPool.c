@@ -0,0 +1,341 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "htslib/thread_pool.h"
+#include "threadPool.h"
+
+static const size_t STACK_SIZE = 1 << 21;
+
+enum taskState {RUNNABLE, RUNNING, SUSPENDING, YIELDING, SLEEPING, FINISHING, FINISHED};
+
+typedef struct worker_st {
+	pthread_t threadID;
+	ucontext_t context;
+} Worker;
+
+struct task_st {
+	void * (* function)(void *);
+	void * arg;
+	ucontext_t context;
+	char * stack;
+	enum taskState state;
+	int wakeups;
+	Worker * worker;
+	struct task_st * parent;
+	struct task_st * previous, * next;
+};
+
+// All the fields below are protected by pool_mutex
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished_cond = PTHREAD_COND_INITIALIZER;
+static Task * queueHead = NULL;
+static Task * queueTail = NULL;
+static int poolSize = 0;
+static int workerCount = 0;
+static int taskCount = 0;
+static char * spareStacks = NULL;
+
+//////////////////////////////////////////////////////
+// Pool size
+//////////////////////////////////////////////////////
+
+void setThreadPoolSize(int size) {
+	if (size < 1) {
+		fprintf(stderr, "The number of threads must be a positive integer, not %i\n", size);
+		exit(1);
+	}
+	pthread_mutex_lock(&pool_mutex);
+	poolSize = size;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+int getThreadPoolSize() {
+	if (poolSize == 0) {
+		char * variable = getenv("WIGGLETOOLS_THREADS");
+		if (variable && atoi(variable) > 0)
+			poolSize = atoi(variable);
+		else if ((poolSize = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			poolSize = 1;
+	}
+	return poolSize;
+}
+
+//////////////////////////////////////////////////////
+// Run queue
+//////////////////////////////////////////////////////
+
+static void enqueueTask(Task * task, bool urgent) {
+	task->state = RUNNABLE;
+	task->previous = task->next = NULL;
+	if (!queueHead)
+		queueHead = queueTail = task;
+	else if (urgent) {
+		task->next = queueHead;
+		queueHead->previous = task;
+		queueHead = task;
+	} else {
+		task->previous = queueTail;
+		queueTail->next = task;
+		queueTail = task;
+	}
+	pthread_cond_signal(&work_cond);
+}
+
+static void unlinkTask(Task * task) {
+	if (task->previous)
+		task->previous->next = task->next;
+	else
+		queueHead = task->next;
+	if (task->next)
+		task->next->previous = task->previous;
+	else
+		queueTail = task->previous;
+	task->previous = task->next = NULL;
+}
+
+static Task * dequeueTask() {
+	Task * task = queueHead;
+	if (task)
+		unlinkTask(task);
+	return task;
+}
+
+//////////////////////////////////////////////////////
+// Stacks
+//////////////////////////////////////////////////////
+
+static char * allocateStack() {
+	char * stack = spareStacks;
+
+	if (stack) {
+		spareStacks = *((char **) (stack + getpagesize()));
+		return stack;
+	}
+
+	stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (stack == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate task stack\n");
+		exit(1);
+	}
+	// Guard page, stacks grow downwards
+	mprotect(stack, getpagesize(), PROT_NONE);
+	return stack;
+}
+
+static void recycleStack(char * stack) {
+	*((char **) (stack + getpagesize())) = spareStacks;
+	spareStacks = stack;
+}
+
+//////////////////////////////////////////////////////
+// Workers
+//////////////////////////////////////////////////////
+
+static void wakeTaskLocked(Task * task, bool urgent);
+
+static void runTask(unsigned int high, unsigned int low) {
+	Task * task = (Task *) (uintptr_t) (((uint64_t) high << 32) | low);
+	task->function(task->arg);
+	pthread_mutex_lock(&pool_mutex);
+	task->state = FINISHING;
+	pthread_mutex_unlock(&pool_mutex);
+	setcontext(&task->worker->context);
+}
+
+static void * runWorker(void * ptr) {
+	Worker * worker = (Worker *) ptr;
+	Task * task;
+
+	pthread_mutex_lock(&pool_mutex);
+	while (true) {
+		while (!(task = dequeueTask()))
+			pthread_cond_wait(&work_cond, &pool_mutex);
+		task->state = RUNNING;
+		task->worker = worker;
+		pthread_mutex_unlock(&pool_mutex);
+
+		swapcontext(&worker->context, &task->context);
+
+		// The task's context is only safe to resume once it has been saved
+		pthread_mutex_lock(&pool_mutex);
+		switch (task->state) {
+		case SUSPENDING:
+			if (task->wakeups) {
+				task->wakeups = 0;
+				enqueueTask(task, false);
+			} else
+				task->state = SLEEPING;
+			break;
+		case YIELDING:
+			enqueueTask(task, false);
+			break;
+		case FINISHING:
+			recycleStack(task->stack);
+			task->stack = NULL;
+			task->state = FINISHED;
+			taskCount--;
+			pthread_cond_broadcast(&finished_cond);
+			if (task->parent)
+				wakeTaskLocked(task->parent, true);
+			break;
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void createWorker() {
+	Worker * worker = (Worker *) calloc(1, sizeof(Worker));
+	pthread_attr_t attributes;
+
+	pthread_attr_init(&attributes);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	int err = pthread_create(&worker->threadID, &attributes, &runWorker, worker);
+	if (err) {
+		fprintf(stderr, "Could not create new thread %i\n", err);
+		abort();
+	}
+	pthread_attr_destroy(&attributes);
+	workerCount++;
+}
+
+//////////////////////////////////////////////////////
+// Tasks
+//////////////////////////////////////////////////////
+
+void launchSubtask(void * (* function)(void *), void * arg, Task ** handle, Task * parent) {
+	Task * task = (Task *) calloc(1, sizeof(Task));
+	task->function = function;
+	task->arg = arg;
+	task->parent = parent;
+	*handle = task;
+
+	pthread_mutex_lock(&pool_mutex);
+	task->stack = allocateStack();
+	getcontext(&task->context);
+	task->context.uc_stack.ss_sp = task->stack + getpagesize();
+	task->context.uc_stack.ss_size = STACK_SIZE - getpagesize();
+	task->context.uc_link = NULL;
+	makecontext(&task->context, (void (*)()) runTask, 2, (unsigned int) ((uint64_t) (uintptr_t) task >> 32), (unsigned int) (uintptr_t) task);
+
+	// Workers are only started when there are tasks to keep them busy
+	taskCount++;
+	if (workerCount < getThreadPoolSize() && workerCount < taskCount)
+		createWorker();
+	enqueueTask(task, false);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void launchTask(void * (* function)(void *), void * arg, Task ** handle) {
+	launchSubtask(function, arg, handle, NULL);
+}
+
+// Hands the worker back until wakeTask is called, unless that already happened
+void suspendTask(Task * task) {
+	pthread_mutex_lock(&pool_mutex);
+	if (task->wakeups) {
+		task->wakeups = 0;
+		pthread_mutex_unlock(&pool_mutex);
+		return;
+	}
+	task->state = SUSPENDING;
+	pthread_mutex_unlock(&pool_mutex);
+	swapcontext(&task->context, &task->worker->context);
+}
+
+// Lets other tasks run, if any are waiting for a worker
+void yieldTask(Task * task) {
+	pthread_mutex_lock(&pool_mutex);
+	if (!queueHead) {
+		pthread_mutex_unlock(&pool_mutex);
+		return;
+	}
+	task->state = YIELDING;
+	pthread_mutex_unlock(&pool_mutex);
+	swapcontext(&task->context, &task->worker->context);
+}
+
+// Urgent tasks jump the queue
+static void wakeTaskLocked(Task * task, bool urgent) {
+	switch (task->state) {
+	case SLEEPING:
+		enqueueTask(task, urgent);
+		break;
+	case RUNNABLE:
+		if (urgent && task != queueHead) {
+			unlinkTask(task);
+			enqueueTask(task, true);
+		}
+		break;
+	case FINISHING:
+	case FINISHED:
+		break;
+	default:
+		task->wakeups++;
+	}
+}
+
+void wakeTask(Task * task, bool urgent) {
+	pthread_mutex_lock(&pool_mutex);
+	wakeTaskLocked(task, urgent);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+static bool isFinished(Task * task) {
+	pthread_mutex_lock(&pool_mutex);
+	bool finished = task->state == FINISHED;
+	pthread_mutex_unlock(&pool_mutex);
+	return finished;
+}
+
+void joinSubtask(Task * task, Task * parent) {
+	while (!isFinished(task))
+		suspendTask(parent);
+	free(task);
+}
+
+void joinTask(Task * task) {
+	pthread_mutex_lock(&pool_mutex);
+	while (task->state != FINISHED)
+		pthread_cond_wait(&finished_cond, &pool_mutex);
+	pthread_mutex_unlock(&pool_mutex);
+	free(task);
+}
+
+//////////////////////////////////////////////////////
+// BGZF inflation
+//////////////////////////////////////////////////////
+
+// BGZF blocks of all the open files are inflated by a shared htslib thread pool
+static htsThreadPool inflationPool = {NULL, 0};
+static pthread_mutex_t inflation_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void useInflationThreads(htsFile * fp) {
+	pthread_mutex_lock(&inflation_mutex);
+	if (!inflationPool.pool && getThreadPoolSize() > 1)
+		inflationPool.pool = hts_tpool_init(getThreadPoolSize());
+	pthread_mutex_unlock(&inflation_mutex);
+	if (inflationPool.pool)
+		hts_set_thread_pool(fp, &inflationPool);
+}
@@ -0,0 +1,43 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include "htslib/hts.h"
+#include "wiggletools.h"
+
+// Global pool of worker threads, shared by all the file readers.
+// Each task runs on its own stack, and gives its worker back
+// whenever it has to wait (typically because its output buffer is
+// full), so that a bounded number of threads can serve any number
+// of open files.
+typedef struct task_st Task;
+
+void launchTask(void * (* function)(void *), void * arg, Task ** task);
+// To be called from within a task
+void suspendTask(Task * task);
+void yieldTask(Task * task);
+// Subtasks wake up their parent when they finish, so that it can join them without blocking its worker
+void launchSubtask(void * (* function)(void *), void * arg, Task ** task, Task * parent);
+void joinSubtask(Task * task, Task * parent);
+// To be called from outside a task
+void wakeTask(Task * task, bool urgent);
+void joinTask(Task * task);
+// Defaults to the WIGGLETOOLS_THREADS environment variable, else the number of cores
+int getThreadPoolSize();
+// Hands the shared pool of BGZF inflation threads to an open htslib file
+void useInflationThreads(htsFile * fp);
+
+#endif
@@ -0,0 +1,112 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tournament tree over a fixed set of inputs.
+// Leaves are the inputs, each internal node holds the input with the
+// lowest key below it, so that the root holds the minimum. Inputs which
+// are not queued have an infinite key. Queuing or dequeuing an input
+// replays the matches on the path from its leaf to the root, and stops
+// early as soon as a match result is unaffected.
+// Unlike a loser tree, which only replays the path of the current winner,
+// this allows inputs to be queued in any order.
+//
+// The tree is stored heap-like: internal nodes are numbered 1 to count - 1,
+// the children of node i are 2i and 2i + 1, and node count + i is the
+// leaf of input i, for any count.
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "tournament.h"
+
+#define NOT_QUEUED LONG_MAX
+
+struct tournamentTree_st {
+	int count;
+	long * keys;
+	// Winning input of each internal node, index 0 unused
+	int * winners;
+};
+
+static inline int winner(TournamentTree * tree, int node) {
+	return node >= tree->count? node - tree->count: tree->winners[node];
+}
+
+static inline int play(TournamentTree * tree, int node) {
+	int left = winner(tree, 2 * node);
+	int right = winner(tree, 2 * node + 1);
+	return tree->keys[right] < tree->keys[left]? right: left;
+}
+
+static void replay(TournamentTree * tree, int index) {
+	int node;
+	for (node = (tree->count + index) / 2; node > 0; node /= 2) {
+		int previous = tree->winners[node];
+		tree->winners[node] = play(tree, node);
+		// Matches higher up cannot change either
+		if (tree->winners[node] == previous && previous != index)
+			return;
+	}
+}
+
+static inline int root(TournamentTree * tree) {
+	return tree->count > 1? tree->winners[1]: 0;
+}
+
+void tt_clear(TournamentTree * tree) {
+	int index;
+	for (index = 0; index < tree->count; index++)
+		tree->keys[index] = NOT_QUEUED;
+	for (index = tree->count - 1; index > 0; index--)
+		tree->winners[index] = play(tree, index);
+}
+
+TournamentTree * tt_make(int count) {
+	TournamentTree * tree = (TournamentTree *) calloc(1, sizeof(TournamentTree));
+	tree->count = count > 0? count: 1;
+	tree->keys = (long *) calloc(tree->count, sizeof(long));
+	tree->winners = (int *) calloc(tree->count, sizeof(int));
+	tt_clear(tree);
+	return tree;
+}
+
+void tt_insert(TournamentTree * tree, int key, int index) {
+	tree->keys[index] = key;
+	replay(tree, index);
+}
+
+bool tt_empty(TournamentTree * tree) {
+	return tree->keys[root(tree)] == NOT_QUEUED;
+}
+
+bool tt_notempty(TournamentTree * tree) {
+	return tree->keys[root(tree)] != NOT_QUEUED;
+}
+
+int tt_min(TournamentTree * tree) {
+	return tree->keys[root(tree)];
+}
+
+int tt_extractmin(TournamentTree * tree) {
+	int index = root(tree);
+	tree->keys[index] = NOT_QUEUED;
+	replay(tree, index);
+	return index;
+}
+
+void tt_destroy(TournamentTree * tree) {
+	free(tree->keys);
+	free(tree->winners);
+	free(tree);
+}
@@ -0,0 +1,34 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _TOURNAMENT_H_
+#define _TOURNAMENT_H_
+
+#include "wiggletools.h"
+
+// Priority queue over a fixed set of inputs, numbered 0 to count - 1,
+// each of which is queued at most once. Same interface as the Fibonacci
+// heap, without any allocation after creation.
+typedef struct tournamentTree_st TournamentTree;
+
+TournamentTree * tt_make(int count);
+void tt_insert(TournamentTree *, int key, int index);
+bool tt_empty(TournamentTree *);
+bool tt_notempty(TournamentTree *);
+int tt_min(TournamentTree *);
+int tt_extractmin(TournamentTree *);
+void tt_clear(TournamentTree *);
+void tt_destroy(TournamentTree *);
+
+#endif
@@ -14,11 +14,13 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 // Local header
 #include "wiggleIterator.h"
 #include "fib.h"
+#include "lineReader.h"
 
 //////////////////////////////////////////////////////
 // Null operator
@@ -73,7 +75,7 @@ void UnionWiggleIteratorPop(WiggleIterator * wi) {
 			wi->start = iter->start;
 			wi->finish = iter->finish;
 			wi->value = iter->value;
-		} else if (wi->chrom == iter->chrom && wi->finish > iter->start) {
+		} else if (sameChromosome(wi->chrom, iter->chrom) && wi->finish > iter->start) {
 			if (iter->finish > wi->finish)
 				wi->finish = iter->finish;
 		} else
@@ -120,7 +122,7 @@ void TestNonOverlappingWiggleIteratorPop(WiggleIterator * wi) {
 
 		pop(iter);
 
-		if (wi->chrom == iter->chrom && wi->finish >= iter->start)
+		if (!iter->done && sameChromosome(wi->chrom, iter->chrom) && wi->finish >= iter->start)
 			exit(1);
 	}
 }
@@ -245,7 +247,7 @@ void CompressionWiggleIteratorPop(WiggleIterator * wi) {
 		wi->value = iter->value;
 		pop(iter);
 
-		while (!iter->done && strcmp(iter->chrom, wi->chrom) == 0 && iter->start == wi->finish && ((isnan(iter->value) && isnan(wi->value)) || (fabs(iter->value - wi->value) < 0.000001))) {
+		while (!iter->done && sameChromosome(iter->chrom, wi->chrom) && iter->start == wi->finish && ((isnan(iter->value) && isnan(wi->value)) || (fabs(iter->value - wi->value) < 0.000001))) {
 			wi->finish = iter->finish;
 			pop(iter);
 		}
@@ -324,13 +326,13 @@ void CoverageWiggleIteratorPop(WiggleIterator * wi) {
 			wi->start = iter->start;
 		}
 
-		while (!iter->done && !strcmp(iter->chrom, wi->chrom) && iter->start == wi->start) {
+		while (!iter->done && sameChromosome(iter->chrom, wi->chrom) && iter->start == wi->start) {
 			fh_insert(data->heap, iter->finish, 0);
 			pop(iter);
 			wi->value++;
 		}
 
-		if (!fh_notempty(data->heap) || (!strcmp(iter->chrom, wi->chrom) && iter->start < fh_min(data->heap)))
+		if (!fh_notempty(data->heap) || (sameChromosome(iter->chrom, wi->chrom) && iter->start < fh_min(data->heap)))
 			wi->finish = iter->start;
 		else
 			wi->finish = fh_min(data->heap);
@@ -440,7 +442,7 @@ void OverlapWiggleIteratorPop(WiggleIterator * wi) {
 	WiggleIterator * mask = data->mask;
 
 	while (!source->done && !mask->done) {
-		int chrom_cmp = strcmp(mask->chrom, source->chrom);
+		int chrom_cmp = compareChromosomes(mask->chrom, source->chrom);
 		if (chrom_cmp < 0)
 			pop(mask);
 		else if (chrom_cmp > 0)
@@ -488,7 +490,7 @@ void TrimWiggleIteratorPop(WiggleIterator * wi) {
 	WiggleIterator * mask = data->mask;
 
 	while (!source->done && !mask->done) {
-		int chrom_cmp = strcmp(mask->chrom, source->chrom);
+		int chrom_cmp = compareChromosomes(mask->chrom, source->chrom);
 		if (chrom_cmp < 0)
 			pop(mask);
 		else if (chrom_cmp > 0)
@@ -532,7 +534,7 @@ void NoverlapWiggleIteratorPop(WiggleIterator * wi) {
 	WiggleIterator * mask = data->mask;
 
 	while (!source->done && !mask->done) {
-		int chrom_cmp = strcmp(mask->chrom, source->chrom);
+		int chrom_cmp = compareChromosomes(mask->chrom, source->chrom);
 		if (chrom_cmp < 0)
 			pop(mask);
 		else if (chrom_cmp > 0)
@@ -586,7 +588,7 @@ void NearestWiggleIteratorPop(WiggleIterator * wi) {
 	}
 
 	while (!mask->done) {
-		int chrom_cmp = strcmp(mask->chrom, source->chrom);
+		int chrom_cmp = compareChromosomes(mask->chrom, source->chrom);
 		if (chrom_cmp < 0)
 			pop(mask);
 		else if (chrom_cmp > 0)
@@ -605,12 +607,12 @@ void NearestWiggleIteratorPop(WiggleIterator * wi) {
 	wi->finish = source->finish;
 
 	bool set = false;
-	if (data->prev_chrom && strcmp(data->prev_chrom, source->chrom) == 0) {
+	if (data->prev_chrom && sameChromosome(data->prev_chrom, source->chrom)) {
 		wi->value = wi->start - data->prev_finish + 1;
 		set = true;
 	}
 
-	if (!mask->done && strcmp(mask->chrom, source->chrom) == 0 && (!set || wi->value > mask->start - wi->finish + 1)) {
+	if (!mask->done && sameChromosome(mask->chrom, source->chrom) && (!set || wi->value > mask->start - wi->finish + 1)) {
 		wi->value = mask->start - wi->finish + 1;
 		set = true;
 	}
@@ -987,7 +989,7 @@ static void BinningWiggleIteratorPop(WiggleIterator * wi) {
 
 	// Set new boundaries
 	// Remember to check chromosome before simply incrementing coordinates
-	if (wi->chrom == iter->chrom && iter->start < wi->finish + width)
+	if (wi->chrom && sameChromosome(wi->chrom, iter->chrom) && iter->start < wi->finish + width)
 		wi->start = wi->finish;
 	else
 		// This odd looking formula is an integer division that rounds up
@@ -998,7 +1000,7 @@ static void BinningWiggleIteratorPop(WiggleIterator * wi) {
 	// Compute sum
 	wi->value = 0;
 	int total_covered_length = 0;
-	while (!iter->done && iter->chrom == wi->chrom && iter->start < wi->finish) {
+	while (!iter->done && sameChromosome(iter->chrom, wi->chrom) && iter->start < wi->finish) {
 		int start, finish;
 		if (iter->start < wi->start)
 			start = wi->start;
@@ -1080,11 +1082,11 @@ static void smoothWiggleIteratorReadOne(char * chrom, int position, SmoothWiggle
 	WiggleIterator * iter = data->iter;
 
 	// Let iter run if necessary
-	while (!iter->done && iter->chrom == chrom && iter->finish <= position)
+	while (!iter->done && sameChromosome(iter->chrom, chrom) && iter->finish <= position)
 		pop(iter);
 
 	// Record iter's value as appropriate
-	if (!iter->done && iter->chrom == chrom) {
+	if (!iter->done && sameChromosome(iter->chrom, chrom)) {
 		if (iter->start <= position) {
 			data->buffer[data->latest] = iter->value;
 			data->sum += iter->value;
@@ -1165,13 +1167,106 @@ WiggleIterator * SmoothWiggleIterator(WiggleIterator * i, int width) {
 // Convenience file reader
 //////////////////////////////////////////////////////
 
+// Number of leading bytes inspected to recognise a file format
+#define SNIFF_LENGTH 65536
+
+static const uint32_t BIGWIG_MAGIC = 0x888FFC26;
+static const uint32_t BIGBED_MAGIC = 0x8789F2EB;
+
+static bool hasMagic(char * head, size_t length, uint32_t magic) {
+	uint32_t word;
+	if (length < sizeof(uint32_t))
+		return false;
+	memcpy(&word, head, sizeof(uint32_t));
+	// Either byte order
+	return word == magic || __builtin_bswap32(word) == magic;
+}
+
+static bool hasPrefix(char * head, size_t length, const char * prefix) {
+	size_t prefix_length = strlen(prefix);
+	return length >= prefix_length && !memcmp(head, prefix, prefix_length);
+}
+
+static bool isNumber(char * word, int length) {
+	char buffer[100];
+	char * end;
+	if (length == 0 || length >= sizeof(buffer))
+		return false;
+	memcpy(buffer, word, length);
+	buffer[length] = '\0';
+	strtod(buffer, &end);
+	return end == buffer + length;
+}
+
+// Recognises text formats from their first data line
+static WiggleIterator * SniffTextFile(char * filename, char * head, size_t length) {
+	char * line = head, * end, * ptr, * word;
+	char * limit = head + length;
+	int tokens, word_length;
+
+	for (; line < limit && (end = memchr(line, '\n', limit - line)); line = end + 1) {
+		if (line == end || line[0] == '#' || hasPrefix(line, end - line, "track") || hasPrefix(line, end - line, "browser"))
+			continue;
+		if (hasPrefix(line, end - line, "fixedStep") || hasPrefix(line, end - line, "variableStep"))
+			return WiggleReader(filename);
+
+		tokens = countTokens(line, end);
+		if (tokens == 0)
+			continue;
+		if (tokens == 4) {
+			// BedGraph, unless the fourth column is a name
+			ptr = line;
+			parseWord(&ptr, end, &word_length);
+			parseWord(&ptr, end, &word_length);
+			parseWord(&ptr, end, &word_length);
+			word = parseWord(&ptr, end, &word_length);
+			if (isNumber(word, word_length))
+				return WiggleReader(filename);
+		}
+		if (tokens >= 3)
+			return BedReader(filename);
+		break;
+	}
+
+	fprintf(stderr, "Could not recognize file format from the suffix or the content of %s\n", filename);
+	exit(1);
+}
+
+// Recognises a file from its first bytes, inflated if it is gzipped
+static WiggleIterator * SniffingReader(char * filename, bool holdFire) {
+	char * head = malloc(SNIFF_LENGTH);
+	size_t length = readFileHead(filename, head, SNIFF_LENGTH);
+	WiggleIterator * reader;
+
+	if (hasMagic(head, length, BIGWIG_MAGIC))
+		reader = BigWiggleReader(filename, holdFire);
+	else if (hasMagic(head, length, BIGBED_MAGIC))
+		reader = BigBedReader(filename, holdFire);
+	else if (hasPrefix(head, length, "wtcache"))
+		reader = CacheReader(filename);
+	else if (hasPrefix(head, length, "BAM\1") || hasPrefix(head, length, "CRAM"))
+		reader = BamReader(filename, holdFire, false);
+	else if (hasPrefix(head, length, "BCF\2"))
+		reader = BcfReader(filename, holdFire);
+	else if (hasPrefix(head, length, "##fileformat=VCF"))
+		reader = VcfReader(filename);
+	else if (hasPrefix(head, length, "@HD") || hasPrefix(head, length, "@SQ"))
+		reader = SamReader(filename, holdFire, false);
+	else
+		reader = SniffTextFile(filename, head, length);
+
+	free(head);
+	return reader;
+}
+
+bool isBigWiggleFilename(char * filename) {
+	size_t length = strlen(filename);
+	return (length >= 3 && !strcmp(filename + length - 3, ".bw")) || (length >= 7 && (!strcmp(filename + length - 7, ".bigWig") || !strcmp(filename + length - 7, ".bigwig")));
+}
+
 WiggleIterator * SmartReader(char * filename, bool holdFire) {
 	size_t length = strlen(filename);
-	if (!strcmp(filename + length - 3, ".bw"))
-		return BigWiggleReader(filename, holdFire);
-	else if (!strcmp(filename + length - 7, ".bigWig"))
-		return BigWiggleReader(filename, holdFire);
-	else if (!strcmp(filename + length - 7, ".bigwig"))
+	if (isBigWiggleFilename(filename))
 		return BigWiggleReader(filename, holdFire);
 	else if (!strcmp(filename + length - 3, ".bg"))
 		return WiggleReader(filename);
@@ -1179,6 +1274,14 @@ WiggleIterator * SmartReader(char * filename, bool holdFire) {
 		return WiggleReader(filename);
 	else if (!strcmp(filename + length - 4, ".bed"))
 		return BedReader(filename);
+	else if (!strcmp(filename + length - 4, ".wtc"))
+		return CacheReader(filename);
+	else if (!strcmp(filename + length - 6, ".bg.gz"))
+		return WiggleReader(filename);
+	else if (!strcmp(filename + length - 7, ".wig.gz"))
+		return WiggleReader(filename);
+	else if (!strcmp(filename + length - 7, ".bed.gz"))
+		return BedReader(filename);
 	else if (!strcmp(filename + length - 3, ".bb"))
 		return BigBedReader(filename, holdFire);
 	else if (!strcmp(filename + length - 7, ".bigBed"))
@@ -1190,17 +1293,17 @@ WiggleIterator * SmartReader(char * filename, bool holdFire) {
 	else if (!strcmp(filename + length - 5, ".cram"))
 		return BamReader(filename, holdFire, false);
 	else if (!strcmp(filename + length - 4, ".sam"))
-		return SamReader(filename, false);
+		return SamReader(filename, holdFire, false);
 	else if (!strcmp(filename + length - 4, ".vcf"))
 		return VcfReader(filename);
+	else if (!strcmp(filename + length - 7, ".vcf.gz"))
+		return VcfReader(filename);
 	else if (!strcmp(filename + length - 4, ".bcf"))
 		return BcfReader(filename, holdFire);
 	else if (!strcmp(filename, "-"))
 		return WiggleReader(filename);
-	else {
-		fprintf(stderr, "Could not recognize file format from suffix: %s\n", filename);
-		exit(1);
-	}
+	else
+		return SniffingReader(filename, holdFire);
 }
 
 //////////////////////////////////////////////////////
@@ -1226,10 +1329,10 @@ void CatWiggleIteratorPop(WiggleIterator * wi) {
 	} else if (data->index < data->count - 1) {
 		while (++data->index < data->count) {
 			iter = data->iter = SmartReader(data->filenames[data->index], false);
-			while (!iter->done && (strcmp(wi->chrom, iter->chrom) >= 0 || (strcmp(wi->chrom, iter->chrom) == 0 && wi->finish >= iter->finish)))
+			while (!iter->done && (compareChromosomes(wi->chrom, iter->chrom) >= 0 || (sameChromosome(wi->chrom, iter->chrom) && wi->finish >= iter->finish)))
 				pop(iter);
 			if (!iter->done) {
-				if (strcmp(wi->chrom, iter->chrom) < 0 || iter->start > wi->finish)
+				if (compareChromosomes(wi->chrom, iter->chrom) < 0 || iter->start > wi->finish)
 					wi->start = iter->start;
 				else
 					wi->start = wi->finish;
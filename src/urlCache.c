@@ -0,0 +1,310 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Local copies of remote BigWig and BigBed files.
+// libBigWig fetches remote files through its own curl handles, with no
+// hook on the byte ranges it requests, so whole files are cached instead.
+// Each copy is named after a hash of its URL, and is checked against the
+// server's ETag, or else Last-Modified, header with a HEAD request before
+// being used, unless it was checked recently. Files are downloaded under
+// a temporary name then renamed, so that concurrent runs never see a
+// partial copy. Within a run, each URL is only looked up once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+
+#include "wiggletools.h"
+
+#define VALIDATOR_LENGTH 1000
+// Seconds during which a checked copy is used without asking the server again
+#define DEFAULT_CACHE_AGE 3600
+
+typedef struct urlValidators_st {
+	char etag[VALIDATOR_LENGTH];
+	char last_modified[VALIDATOR_LENGTH];
+} UrlValidators;
+
+// Local paths already resolved in this run
+typedef struct resolvedUrl_st {
+	char * url;
+	char * path;
+	struct resolvedUrl_st * next;
+} ResolvedUrl;
+
+static char * cacheDirectory = NULL;
+static bool cacheDirectorySet = false;
+static int cacheAge = -1;
+static ResolvedUrl * resolvedUrls = NULL;
+
+void setUrlCacheDirectory(char * directory) {
+	cacheDirectory = directory;
+	cacheDirectorySet = true;
+}
+
+static char * getUrlCacheDirectory() {
+	if (!cacheDirectorySet) {
+		char * variable = getenv("WIGGLETOOLS_CACHE");
+		if (variable && variable[0])
+			cacheDirectory = variable;
+		cacheDirectorySet = true;
+	}
+	return cacheDirectory;
+}
+
+static int getUrlCacheAge() {
+	if (cacheAge < 0) {
+		char * variable = getenv("WIGGLETOOLS_CACHE_AGE");
+		if (variable && variable[0])
+			cacheAge = atoi(variable);
+		if (cacheAge < 0)
+			cacheAge = DEFAULT_CACHE_AGE;
+	}
+	return cacheAge;
+}
+
+static bool isUrl(char * filename) {
+	return !strncmp(filename, "http://", 7) || !strncmp(filename, "https://", 8) || !strncmp(filename, "ftp://", 6);
+}
+
+// FNV-1a
+static uint64_t hashUrl(char * url) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *url; url++) {
+		hash ^= (unsigned char) *url;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//////////////////////////////////////////////////////
+// HTTP
+//////////////////////////////////////////////////////
+
+static void storeHeader(char * line, size_t length, const char * name, char * value) {
+	size_t name_length = strlen(name);
+
+	if (length <= name_length || strncasecmp(line, name, name_length))
+		return;
+	line += name_length;
+	length -= name_length;
+	while (length && (*line == ' ' || *line == '\t')) {
+		line++;
+		length--;
+	}
+	while (length && (line[length - 1] == '\r' || line[length - 1] == '\n' || line[length - 1] == ' '))
+		length--;
+	if (length >= VALIDATOR_LENGTH)
+		length = VALIDATOR_LENGTH - 1;
+	memcpy(value, line, length);
+	value[length] = '\0';
+}
+
+static size_t readHeader(char * buffer, size_t size, size_t count, void * ptr) {
+	UrlValidators * validators = (UrlValidators *) ptr;
+	size_t length = size * count;
+
+	// Only keep the headers of the last response after redirections
+	if (length > 5 && !strncmp(buffer, "HTTP/", 5))
+		memset(validators, 0, sizeof(UrlValidators));
+	storeHeader(buffer, length, "ETag:", validators->etag);
+	storeHeader(buffer, length, "Last-Modified:", validators->last_modified);
+	return length;
+}
+
+static size_t writeBody(char * buffer, size_t size, size_t count, void * ptr) {
+	return fwrite(buffer, size, count, (FILE *) ptr) * size;
+}
+
+// Fetches the headers, or the whole file if output is not NULL
+static bool requestUrl(char * url, UrlValidators * validators, FILE * output) {
+	CURL * curl = curl_easy_init();
+	CURLcode res;
+
+	if (!curl)
+		return false;
+	memset(validators, 0, sizeof(UrlValidators));
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, readHeader);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, validators);
+	if (output) {
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeBody);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, output);
+	} else
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+
+	res = curl_easy_perform(curl);
+	if (res != CURLE_OK)
+		fprintf(stderr, "Could not fetch %s: %s\n", url, curl_easy_strerror(res));
+	curl_easy_cleanup(curl);
+	return res == CURLE_OK;
+}
+
+static bool hasValidators(UrlValidators * validators) {
+	return validators->etag[0] || validators->last_modified[0];
+}
+
+// ETags are preferred, as they change with the content
+static bool sameValidators(UrlValidators * A, UrlValidators * B) {
+	if (A->etag[0] || B->etag[0])
+		return !strcmp(A->etag, B->etag);
+	return !strcmp(A->last_modified, B->last_modified);
+}
+
+//////////////////////////////////////////////////////
+// Cache entries
+//////////////////////////////////////////////////////
+
+// The metadata file holds the URL, the ETag then the Last-Modified date, one per line
+static bool readMetadata(char * filename, char * url, UrlValidators * validators) {
+	FILE * file = fopen(filename, "r");
+	size_t length = strlen(url);
+	char * line;
+	bool valid;
+
+	if (!file)
+		return false;
+	line = calloc(length + 2, sizeof(char));
+	memset(validators, 0, sizeof(UrlValidators));
+	valid = fgets(line, length + 2, file) && !strncmp(line, url, length) && line[length] == '\n'
+		&& fgets(validators->etag, VALIDATOR_LENGTH, file)
+		&& fgets(validators->last_modified, VALIDATOR_LENGTH, file);
+	fclose(file);
+	free(line);
+
+	validators->etag[strcspn(validators->etag, "\n")] = '\0';
+	validators->last_modified[strcspn(validators->last_modified, "\n")] = '\0';
+	return valid;
+}
+
+static bool writeMetadata(char * filename, char * url, UrlValidators * validators) {
+	FILE * file = fopen(filename, "w");
+	if (!file)
+		return false;
+	fprintf(file, "%s\n%s\n%s\n", url, validators->etag, validators->last_modified);
+	return fclose(file) == 0;
+}
+
+// Downloads the file under a temporary name, then moves it into place
+static bool downloadUrl(char * url, char * data_path, char * metadata_path) {
+	UrlValidators validators;
+	size_t length = strlen(data_path) + 32;
+	char * temporary_data = calloc(length, sizeof(char));
+	char * temporary_metadata = calloc(length, sizeof(char));
+	FILE * output;
+	bool success = false;
+
+	snprintf(temporary_data, length, "%s.%i.tmp", data_path, (int) getpid());
+	snprintf(temporary_metadata, length, "%s.%i.tmp", metadata_path, (int) getpid());
+
+	if ((output = fopen(temporary_data, "wb"))) {
+		success = requestUrl(url, &validators, output);
+		success = (fclose(output) == 0) && success;
+	}
+	success = success && hasValidators(&validators)
+		&& writeMetadata(temporary_metadata, url, &validators)
+		&& rename(temporary_data, data_path) == 0
+		&& rename(temporary_metadata, metadata_path) == 0;
+
+	if (!success) {
+		unlink(temporary_data);
+		unlink(temporary_metadata);
+	}
+	free(temporary_data);
+	free(temporary_metadata);
+	return success;
+}
+
+// Whether the copy was checked against the server within the cache age
+static bool isFresh(char * metadata_path) {
+	struct stat info;
+	return stat(metadata_path, &info) == 0 && difftime(time(NULL), info.st_mtime) < getUrlCacheAge();
+}
+
+// Local path of a URL, or the URL itself if it cannot be cached
+static char * resolveUrl(char * url, char * directory) {
+	UrlValidators remote, local;
+	char * data_path, * metadata_path;
+	size_t length;
+	bool cached;
+
+	if (mkdir(directory, 0777) && errno != EEXIST) {
+		fprintf(stderr, "Could not create cache directory %s\n", directory);
+		exit(1);
+	}
+
+	length = strlen(directory) + 32;
+	data_path = calloc(length, sizeof(char));
+	metadata_path = calloc(length, sizeof(char));
+	snprintf(data_path, length, "%s/%016llx", directory, (unsigned long long) hashUrl(url));
+	snprintf(metadata_path, length, "%s.meta", data_path);
+
+	cached = readMetadata(metadata_path, url, &local) && access(data_path, R_OK) == 0;
+
+	if (cached && isFresh(metadata_path)) {
+		free(metadata_path);
+		return data_path;
+	} else if (!requestUrl(url, &remote, NULL)) {
+		// Offline, stale data is better than none
+		if (cached) {
+			fprintf(stderr, "Using the cached copy of %s, which could not be checked\n", url);
+			free(metadata_path);
+			return data_path;
+		}
+	} else if (!hasValidators(&remote)) {
+		// Nothing to check a copy against
+	} else if (cached && sameValidators(&local, &remote)) {
+		// Restarts the cache age
+		utime(metadata_path, NULL);
+		free(metadata_path);
+		return data_path;
+	} else if (downloadUrl(url, data_path, metadata_path)) {
+		free(metadata_path);
+		return data_path;
+	}
+
+	free(data_path);
+	free(metadata_path);
+	return url;
+}
+
+// The paths returned are shared by all the readers of a URL, and never freed
+char * cachedUrl(char * url) {
+	char * directory = getUrlCacheDirectory();
+	ResolvedUrl * resolved;
+
+	if (!directory || !isUrl(url))
+		return url;
+
+	for (resolved = resolvedUrls; resolved; resolved = resolved->next)
+		if (!strcmp(resolved->url, url))
+			return resolved->path;
+
+	resolved = (ResolvedUrl *) calloc(1, sizeof(ResolvedUrl));
+	resolved->url = strdup(url);
+	resolved->path = resolveUrl(url, directory);
+	resolved->next = resolvedUrls;
+	resolvedUrls = resolved;
+	return resolved->path;
+}
@@ -16,65 +16,82 @@
 #include <string.h> 
 
 #include "wiggleIterator.h"
+#include "lineReader.h"
 
-typedef struct bedReaderData_st {
+typedef struct vcfReaderData_st {
 	char  *filename;
-	FILE * file;
-	char * chrom;
+	LineReader * reader;
+	const char * chrom;
 	int stop;
+	// Label of the previous record, to spare lookups in the shared dictionary
+	char * last_chrom;
 } VcfReaderData;
 
+static char * internChrom(VcfReaderData * data, char * name, int length) {
+	// Most records are on the same chromosome as the previous one
+	if (data->last_chrom && strncmp(data->last_chrom, name, length) == 0 && data->last_chrom[length] == '\0')
+		return data->last_chrom;
+	return data->last_chrom = internChromosomeLength(name, length);
+}
+
 void VcfReaderPop(WiggleIterator * wi) {
 	VcfReaderData * data = (VcfReaderData *) wi->data;
-	char line[5000];
-	char chrom[1000];
+	char * line, * end, * ptr, * chrom;
+	int length;
 
 	if (wi->done)
 		return;
 
-	while (fgets(line, 5000, data->file)) {
-		if (line[0] != '#') {
-			sscanf(line, "%s\t%i", chrom, &wi->start);
-
-			wi->finish = wi->start + 1;
-
-			// The reason for creating a new string instead of simply 
-			// overwriting is that other functions may still be pointin
-			// at the old label
-			if (wi->chrom[0] == '\0' || strcmp(wi->chrom, chrom)) {
-				wi->chrom = (char *) calloc(strlen(chrom), sizeof(char));
-				strcpy(wi->chrom, chrom);
+	while (nextLine(data->reader, &line, &end)) {
+		if (line == end || line[0] == '#')
+			continue;
+
+		ptr = line;
+		chrom = parseWord(&ptr, end, &length);
+		wi->chrom = internChrom(data, chrom, length);
+		wi->start = parseInteger(&ptr, end);
+		wi->finish = wi->start + 1;
+
+		if (data->stop > 0) {
+			if ((wi->start >= data->stop && strcmp(wi->chrom, data->chrom) == 0) || strcmp(wi->chrom, data->chrom) > 0) {
+				wi->done = true;
+				return;
+			} else if (wi->finish > data->stop) {
+				wi->finish = data->stop;
 			}
-
-			if (data->stop > 0) {
-				if ((wi->start >= data->stop && strcmp(wi->chrom, data->chrom) == 0) || strcmp(wi->chrom, data->chrom) > 0) {
-					wi->done = true;
-					return;
-				} else if (wi->finish > data->stop) {
-					wi->finish = data->stop;
-				}
-			}
-			return;
 		}
-	} 
+		return;
+	}
 
-	fclose(data->file);
-	data->file = NULL;
+	closeLineReader(data->reader);
+	data->reader = NULL;
 	wi->done = true;
 }
 
 void VcfReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
 	VcfReaderData * data = (VcfReaderData*) wi->data;
+	bool reopened = false;
 
 	data->stop = finish;
 	data->chrom = chrom;
 
-	if (wi->done || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
-		if (data->file)
-			fclose(data->file);
-		if (!(data->file = fopen(data->filename, "r"))) {
-			fprintf(stderr, "Could not open input file %s\n", data->filename);
-			exit(1);
+	if (!data->reader) {
+		data->reader = openLineReader(data->filename);
+		reopened = true;
+	}
+
+	// Bgzipped and tabix indexed files jump directly to the region
+	if (seekLineReader(data->reader, chrom, start, finish)) {
+		wi->done = false;
+		pop(wi);
+	} else if (reopened || wi->done || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
+		if (!reopened && !rewindLineReader(data->reader)) {
+			if (strcmp(data->filename, "-") == 0) {
+				fprintf(stderr, "Cannot do a seek on stdin stream!\n");
+				exit(1);
+			}
+			closeLineReader(data->reader);
+			data->reader = openLineReader(data->filename);
 		}
 		wi->done = false;
 		pop(wi);
@@ -91,9 +108,6 @@ WiggleIterator * VcfReader(char * filename) {
 	VcfReaderData * data = (VcfReaderData *) calloc(1, sizeof(VcfReaderData));
 	data->filename = filename;
 	data->stop = -1;
-	if (!(data->file = fopen(filename, "r"))) {
-		fprintf(stderr, "Could not open bed file %s\n", filename);
-		exit(1);
-	}
-	return newWiggleIteratorChromName(data, &VcfReaderPop, &VcfReaderSeek, 0, true);
+	data->reader = openLineReader(filename);
+	return newWiggleIterator(data, &VcfReaderPop, &VcfReaderSeek, 0, true);
 }
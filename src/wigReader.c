@@ -15,8 +15,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "wiggleIterator.h"
+#include "lineReader.h"
 
 //////////////////////////////////////////////////////
 // File Reader
@@ -24,23 +26,48 @@
 
 enum readingMode {FIXED_STEP, VARIABLE_STEP, BED_GRAPH};
 
+// A sidecar index entry stores the parser state just before
+// a given record, so that reading can resume from its offset
+typedef struct wiggleIndexEntry_st {
+	char * chrom;
+	int start;
+	long offset;
+	enum readingMode readingMode;
+	int previous;
+	int step;
+	int span;
+} WiggleIndexEntry;
+
 typedef struct wiggleReaderData_st {
 	char * filename;
-	FILE * file;
+	LineReader * reader;
 	enum readingMode readingMode;
 	int step;
 	int span;
 	char words[5];
 	char * chrom;
 	int stop;
+	int headers;
+	// Reading
+	WiggleIndexEntry * index;
+	int indexLength;
+	// Writing
+	FILE * indexFile;
+	int indexedHeaders;
+	char * indexedChrom;
+	int unindexedRecords;
 } WiggleReaderData;
 
+static const char * INDEX_SUFFIX = ".wti";
+// Number of records between two sampled positions
+static const int INDEX_SAMPLING = 4096;
+
 
 static void WiggleReaderReadHeader(WiggleIterator * wi, WiggleReaderData * data, char * line) {
 	bool chrom_b = true;
 	bool start_b = true;
 	bool step_b = true;
-	const char * seps = " \t=";
+	const char * seps = " \t\r=";
 	char * token = strtok(line, seps);
 
 	// Default
@@ -56,10 +83,8 @@ static void WiggleReaderReadHeader(WiggleIterator * wi, WiggleReaderData * data,
 				fprintf(stderr, "Empty wi->chromosome name!\n");
 				exit(1);
 			}
-			if (strcmp(wi->chrom, token)) {
-				wi->chrom = malloc(strlen(token) + 1);
-				strcpy(wi->chrom, token);
-			}
+			if (strcmp(wi->chrom, token))
+				wi->chrom = internChromosome(token);
 		}
 		if (!strcmp(token, "start")) {
 			start_b = false;
@@ -105,90 +130,117 @@ static void WiggleReaderReadHeader(WiggleIterator * wi, WiggleReaderData * data,
 		wi->start -= data->step;
 }
 
-static void WiggleReaderReadFixedStepLine(WiggleIterator * wi, char * line, int step, int span) {
-	sscanf(line, "%lf", &(wi->value));
+static void WiggleReaderReadHeaderLine(WiggleIterator * wi, WiggleReaderData * data, char * line, char * end) {
+	// Headers are rare, so they are copied out and tokenized the old fashioned way
+	char buffer[5000];
+	size_t length = end - line;
+	if (length >= sizeof(buffer))
+		length = sizeof(buffer) - 1;
+	memcpy(buffer, line, length);
+	buffer[length] = '\0';
+	WiggleReaderReadHeader(wi, data, buffer);
+	data->headers++;
+}
+
+static void WiggleReaderReadFixedStepLine(WiggleIterator * wi, char * line, char * end, int step, int span) {
+	wi->value = parseDouble(&line, end);
 	wi->start += step;
 	wi->finish = wi->start + span;
 }
 
-static void WiggleReaderReadVariableStepLine(WiggleIterator * wi, char * line, int span) {
-	sscanf(line, "%i\t%lf", &(wi->start), &(wi->value));
+static void WiggleReaderReadVariableStepLine(WiggleIterator * wi, char * line, char * end, int span) {
+	wi->start = parseInteger(&line, end);
+	wi->value = parseDouble(&line, end);
 	wi->finish = wi->start + span;
 }
 
-static void WiggleReaderReadBedGraphLine(WiggleIterator * wi, char * line) {
-	char * buffer = calloc(500, sizeof(char));
-	sscanf(line, "%s\t%i\t%i\t%lf", buffer, &(wi->start), &(wi->finish), &(wi->value));
+static void WiggleReaderReadBedGraphLine(WiggleIterator * wi, char * line, char * end) {
+	int length;
+	char * chrom = parseWord(&line, end, &length);
+
+	// The label is only looked up when the chromosome changes
+	if (strncmp(chrom, wi->chrom, length) || wi->chrom[length] != '\0')
+		wi->chrom = internChromosomeLength(chrom, length);
+
+	wi->start = parseInteger(&line, end);
+	wi->finish = parseInteger(&line, end);
+	wi->value = parseDouble(&line, end);
 	// BedGraphs are 0 based, half open
 	wi->start++;
 	wi->finish++;
-	if (strcmp(buffer, wi->chrom))
-		wi->chrom = buffer;
-	else
-		free(buffer);
 }
 
-static int countWords(char * line) {
-	int count = 0;
-	char * ptr;
-
-	if (line[0] != ' ' && line[0] != '\t')
-		count++;
-
-	for (ptr = line; *ptr; ptr++)
-		if (*ptr == ' ' || *ptr == '\t')
-			count++;
+static void WiggleReaderIndexRecord(WiggleIterator * wi, WiggleReaderData * data, WiggleIndexEntry * state) {
+	// Every chromosome and header block gets an entry, then every INDEX_SAMPLING records
+	if (wi->chrom == data->indexedChrom && data->headers == data->indexedHeaders && ++data->unindexedRecords < INDEX_SAMPLING)
+		return;
 
-	return count;
+	fprintf(data->indexFile, "%s\t%i\t%li\t%i\t%i\t%i\t%i\n", wi->chrom, wi->start, state->offset, state->readingMode, state->previous, state->step, state->span);
+	data->indexedChrom = wi->chrom;
+	data->indexedHeaders = data->headers;
+	data->unindexedRecords = 0;
 }
 
 static void WiggleReaderPop(WiggleIterator * wi) {
 	WiggleReaderData * data = (WiggleReaderData*) wi->data;
-	char line[5000];
+	char * line, * end;
+	WiggleIndexEntry state;
 
 	if (wi->done)
 		return;
 
-	while (fgets(line, 5000, data->file)) {
-		if (line[0] == '#' || line[0] == EOF)
+	// Parser state before this record, for the sidecar index
+	state.offset = tellLineReader(data->reader);
+	state.readingMode = data->readingMode;
+	state.previous = wi->start;
+	state.step = data->step;
+	state.span = data->span;
+
+	while (nextLine(data->reader, &line, &end)) {
+		if (line == end || line[0] == '#')
 			continue;
-		else if ( !strncmp("variableStep", line, 12)) {
+		else if (end - line >= 12 && !strncmp("variableStep", line, 12)) {
 			data->readingMode = VARIABLE_STEP;
-			WiggleReaderReadHeader(wi, data, line);
+			WiggleReaderReadHeaderLine(wi, data, line, end);
 			continue;
-		} else if (!strncmp("fixedStep", line, 9)) {
+		} else if (end - line >= 9 && !strncmp("fixedStep", line, 9)) {
 			data->readingMode = FIXED_STEP;
-			WiggleReaderReadHeader(wi, data, line);
+			WiggleReaderReadHeaderLine(wi, data, line, end);
 			continue;
-		} else if (!strncmp("track", line, 5)) {
+		} else if (end - line >= 5 && !strncmp("track", line, 5)) {
 			continue;
 		}
 		
-		switch (countWords(line)) {
+		switch (countTokens(line, end)) {
+		case 0:
+			continue;
 		case 4:
 			data->readingMode = BED_GRAPH;
-			WiggleReaderReadBedGraphLine(wi, line);
+			WiggleReaderReadBedGraphLine(wi, line, end);
 			break;
 		case 2:
 			if (data->readingMode != VARIABLE_STEP) {
-				fprintf(stderr, "Badly formatted fixed step line:\n%s", line);
+				fprintf(stderr, "Badly formatted fixed step line:\n%.*s\n", (int) (end - line), line);
 				exit(1);
 			}
-			WiggleReaderReadVariableStepLine(wi, line,data->span);
+			WiggleReaderReadVariableStepLine(wi, line, end, data->span);
 			break;
 		case 1:
 			if (data->readingMode != FIXED_STEP) {
-				fprintf(stderr, "Badly formatted variable step line:\n%s", line);
+				fprintf(stderr, "Badly formatted variable step line:\n%.*s\n", (int) (end - line), line);
 				exit(1);
 			}
-			WiggleReaderReadFixedStepLine(wi, line, data->step, data->span);
+			WiggleReaderReadFixedStepLine(wi, line, end, data->step, data->span);
 			break;
 		default:
-			fprintf(stderr, "Badly formatted wiggle or bed graph line :\n%s", line);
+			fprintf(stderr, "Badly formatted wiggle or bed graph line :\n%.*s\n", (int) (end - line), line);
 			exit(1);
 
 		}
 
+		if (data->indexFile)
+			WiggleReaderIndexRecord(wi, data, &state);
+
 		if (data->stop > 0) {
 			int comparison = strcmp(wi->chrom, data->chrom);
 			if (comparison == 0) {
@@ -204,22 +256,64 @@ static void WiggleReaderPop(WiggleIterator * wi) {
 
 		return;
 	}
-	fclose(data->file);
-	data->file = NULL;
+	closeLineReader(data->reader);
+	data->reader = NULL;
 	wi->done = true;
 }
 
+// Restores the parser state of the last index entry before the requested position
+static void WiggleReaderJump(WiggleIterator * wi, WiggleReaderData * data, const char * chrom, int start) {
+	int low = 0;
+	int high = data->indexLength;
+
+	while (low < high) {
+		int middle = (low + high) / 2;
+		WiggleIndexEntry * entry = data->index + middle;
+		int comparison = strcmp(entry->chrom, chrom);
+		if (comparison < 0 || (comparison == 0 && entry->start <= start))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if (low == 0) {
+		rewindLineReader(data->reader);
+		return;
+	}
+
+	WiggleIndexEntry * entry = data->index + low - 1;
+	jumpLineReader(data->reader, entry->offset);
+	wi->chrom = entry->chrom;
+	wi->start = entry->previous;
+	data->readingMode = entry->readingMode;
+	data->step = entry->step;
+	data->span = entry->span;
+}
+
 void WiggleReaderSeek(WiggleIterator * wi, const char * chrom, int start, int finish) {
 	WiggleReaderData * data = (WiggleReaderData*) wi->data;
 
 	data->stop = finish;
 	data->chrom = chrom;
 
-	if (!data->file || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
-		if (data->file)
-			fclose(data->file);
-		if (!(data->file = fopen(data->filename, "r"))) {
-			fprintf(stderr, "Cannot open input file %s\n", data->filename);
+	bool reopened = false;
+
+	if (!data->reader) {
+		data->reader = openLineReader(data->filename);
+		reopened = true;
+	}
+
+	// Indexed bedGraph files jump directly to the region
+	if (seekLineReader(data->reader, chrom, start, finish)) {
+		wi->done = false;
+		pop(wi);
+	} else if (data->index) {
+		WiggleReaderJump(wi, data, chrom, start);
+		wi->done = false;
+		pop(wi);
+	} else if (reopened || strcmp(chrom, wi->chrom) < 0 || (strcmp(chrom, wi->chrom) == 0 && start < wi->start)) {
+		if (!reopened && !rewindLineReader(data->reader)) {
+			fprintf(stderr, "Cannot do a seek on stdin stream!\n");
 			exit(1);
 		}
 		wi->done = false;
@@ -233,17 +327,90 @@ void WiggleReaderSeek(WiggleIterator * wi, const char * chrom, int start, int fi
 		wi->start = start;
 }
 
+static char * indexFilename(char * filename) {
+	char * indexname = calloc(strlen(filename) + strlen(INDEX_SUFFIX) + 1, sizeof(char));
+	strcpy(indexname, filename);
+	strcat(indexname, INDEX_SUFFIX);
+	return indexname;
+}
+
+static void WiggleReaderLoadIndex(WiggleReaderData * data) {
+	char * indexname = indexFilename(data->filename);
+	FILE * file = fopen(indexname, "r");
+	char chrom[1000];
+	long size, mtime;
+	int mode;
+	struct stat info;
+	int capacity = 1024;
+
+	if (!file) {
+		free(indexname);
+		return;
+	}
+
+	// The index records the size and modification time of the file it was built from
+	if (fscanf(file, "#wiggletools index\t%li\t%li\n", &size, &mtime) != 2 || stat(data->filename, &info) || info.st_size != size || info.st_mtime != mtime) {
+		fprintf(stderr, "Ignoring out of date or corrupted index file %s\n", indexname);
+		fclose(file);
+		free(indexname);
+		return;
+	}
+
+	data->index = calloc(capacity, sizeof(WiggleIndexEntry));
+	while (true) {
+		WiggleIndexEntry * entry = data->index + data->indexLength;
+		if (fscanf(file, "%999s\t%i\t%li\t%i\t%i\t%i\t%i\n", chrom, &entry->start, &entry->offset, &mode, &entry->previous, &entry->step, &entry->span) != 7)
+			break;
+		entry->readingMode = mode;
+		// Consecutive entries share their chromosome label
+		if (data->indexLength && !strcmp(entry[-1].chrom, chrom))
+			entry->chrom = entry[-1].chrom;
+		else
+			entry->chrom = internChromosome(chrom);
+		if (++data->indexLength == capacity) {
+			capacity *= 2;
+			data->index = realloc(data->index, capacity * sizeof(WiggleIndexEntry));
+		}
+	}
+
+	fclose(file);
+	free(indexname);
+}
+
 WiggleIterator * WiggleReader(char * f) {
 	WiggleReaderData * data = (WiggleReaderData *) calloc(1, sizeof(WiggleReaderData));
 	data->filename = f;
-	if (strcmp(f, "-")) {
-		if (!(data->file = fopen(f, "r"))) {
-			fprintf(stderr, "Could not open input file %s\n", f);
-			exit(1);
-		}
-	} else
-		data->file = stdin;
+	data->reader = openLineReader(f);
 	data->readingMode = BED_GRAPH;
 	data->stop = -1;
+	if (tellLineReader(data->reader) >= 0)
+		WiggleReaderLoadIndex(data);
 	return CompressionWiggleIterator(newWiggleIteratorChromName(data, &WiggleReaderPop, &WiggleReaderSeek, 0, false));
+}
+
+void indexWiggleFile(char * filename) {
+	WiggleReaderData * data = (WiggleReaderData *) calloc(1, sizeof(WiggleReaderData));
+	char * indexname = indexFilename(filename);
+	struct stat info;
+
+	data->filename = filename;
+	data->reader = openLineReader(filename);
+	data->readingMode = BED_GRAPH;
+	data->stop = -1;
+
+	if (tellLineReader(data->reader) < 0 || stat(filename, &info)) {
+		fprintf(stderr, "Can only index regular, uncompressed wiggle files: %s\n", filename);
+		exit(1);
+	}
+
+	if (!(data->indexFile = fopen(indexname, "w"))) {
+		fprintf(stderr, "Could not open index file %s\n", indexname);
+		exit(1);
+	}
+	fprintf(data->indexFile, "#wiggletools index\t%li\t%li\n", (long) info.st_size, (long) info.st_mtime);
+
+	runWiggleIterator(newWiggleIteratorChromName(data, &WiggleReaderPop, &WiggleReaderSeek, 0, false));
+
+	fclose(data->indexFile);
+	free(indexname);
 }	
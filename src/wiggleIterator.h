@@ -16,6 +16,7 @@
 #define _WIGGLETOOLS_PRIV_
 
 #include <stdio.h>
+#include <string.h>
 #include "wiggletools.h"
 
 struct wiggleIterator_st {
@@ -39,4 +40,18 @@ WiggleIterator * newWiggleIteratorChromName(void * data, void (*popFunction)(Wig
 void pop(WiggleIterator *);
 WiggleIterator * CompressionWiggleIterator(WiggleIterator *);
 
+// Unique label of each chromosome name, shared by all readers
+char * internChromosome(const char * name);
+char * internChromosomeLength(const char * name, int length);
+
+// Interned labels of the same chromosome are equal, so names are only
+// compared character by character across chromosomes
+static inline bool sameChromosome(const char * A, const char * B) {
+	return A == B || strcmp(A, B) == 0;
+}
+
+static inline int compareChromosomes(const char * A, const char * B) {
+	return A == B? 0: strcmp(A, B);
+}
+
 #endif
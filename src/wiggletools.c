@@ -27,6 +27,35 @@ int main(int argc, char ** argv) {
 
 	libBigWigInit(128000);
 
+	while (strcmp(argv[1], "--threads") == 0 || strcmp(argv[1], "--lookahead") == 0 || strcmp(argv[1], "--tiles") == 0 || strcmp(argv[1], "--zoom") == 0 || strcmp(argv[1], "--cache") == 0 || strcmp(argv[1], "--handles") == 0) {
+		if (strcmp(argv[1], "--zoom") == 0) {
+			if (argc < 3) {
+				printHelp();
+				return 1;
+			}
+			useBigWigZoomLevels(true);
+			argc--;
+			argv++;
+			continue;
+		}
+		if (argc < 4) {
+			printHelp();
+			return 1;
+		}
+		if (strcmp(argv[1], "--threads") == 0)
+			setThreadPoolSize(atoi(argv[2]));
+		else if (strcmp(argv[1], "--tiles") == 0)
+			setBamTileWidth(atoi(argv[2]));
+		else if (strcmp(argv[1], "--cache") == 0)
+			setUrlCacheDirectory(argv[2]);
+		else if (strcmp(argv[1], "--handles") == 0)
+			setHandleBudget(atoi(argv[2]));
+		else
+			setLookahead(atoi(argv[2]));
+		argc -= 2;
+		argv += 2;
+	}
+
 	rollYourOwn(argc-1, argv+1);
 
 	return 0;
@@ -28,18 +28,45 @@ typedef struct multiplexer_st Multiplexer;
 typedef struct multiset_st Multiset;
 typedef struct histogram_st Histogram;
 
+// Read level filters applied by the Bam reader before piling up
+typedef struct readFilter_st {
+	int min_mapq;
+	int required_flags;
+	int excluded_flags;
+	bool proper_pairs;
+} ReadFilter;
+
 // Creators
 WiggleIterator * SmartReader (char *, bool);
 WiggleIterator * CatWiggleIterator (char **, int);
 // Secondary creators (to force file format recognition if necessary)
 WiggleIterator * WiggleReader (char *);
 WiggleIterator * BigWiggleReader (char *, bool);
+bool isBigWiggleFilename(char *);
+// Approximate answers from BigWig zoom levels
+WiggleIterator * ZoomBinningReader(char *, int);
 WiggleIterator * BedReader (char *);
 WiggleIterator * BigBedReader (char *, bool);
+WiggleIterator * ScoredBigBedReader (char *, int, bool);
 WiggleIterator * BamReader (char *, bool, bool);
-WiggleIterator * SamReader (char *, bool);
+WiggleIterator * FilteredBamReader (char *, bool, bool, ReadFilter *);
+// Reads extended to fragments of fixed length, or to the insert size of proper pairs
+#define FRAGMENT_TLEN -1
+// Fixed length estimated from the insert sizes of the first proper pairs
+#define FRAGMENT_ESTIMATE -2
+WiggleIterator * FragmentBamReader (char *, int, ReadFilter *);
+// Plus then minus strand fragment coverage, from a single pass over the file
+WiggleIterator ** StrandedFragmentBamReaders (char *, int, ReadFilter *);
+WiggleIterator * SamReader (char *, bool, bool);
 WiggleIterator * VcfReader (char *);
 WiggleIterator * BcfReader (char *, bool);
+// Writes a sidecar offset index next to a plain text wiggle file
+void indexWiggleFile (char *);
+// Binary columnar cache of any track, memory mapped when read back
+WiggleIterator * CacheReader (char *);
+// BigWig or Bam reader opened on demand, and closed when too many files are open
+WiggleIterator * LazyReader (char *, bool);
+void writeCacheFile (char *, WiggleIterator *);
 
 // Generic class functions
 void seek(WiggleIterator *, const char *, int, int);
@@ -78,6 +105,8 @@ WiggleIterator * ExtendWiggleIterator(WiggleIterator * i, int);
 
 // Sets of iterators
 Multiplexer * newMultiplexer(WiggleIterator **, int, bool);
+// Coverage of many Bam files swept together, with optional read filter
+Multiplexer * BamMatrix(char **, int, ReadFilter *, bool);
 
 // Reduction operators on sets
 
@@ -134,6 +163,7 @@ void print_histogram(Histogram *, FILE *);
 
 // Regional statistics
 Multiplexer * ApplyMultiplexer(WiggleIterator *, WiggleIterator * (**statistics)(WiggleIterator *), int count, WiggleIterator *, bool strict);
+Multiplexer * ZoomApplyMultiplexer(WiggleIterator *, WiggleIterator * (**statistics)(WiggleIterator *), int count, char *);
 Multiplexer * ProfileMultiplexer(WiggleIterator *, int, WiggleIterator *);
 Multiplexer * PasteMultiplexer(Multiplexer *,  FILE *, FILE *, bool);
 
@@ -142,6 +172,16 @@ void destroyWiggleIterator (WiggleIterator *);
 
 // Big file params
 void libBigWigInit(int);
+void setThreadPoolSize(int);
+void setLookahead(int);
+void setBamTileWidth(int);
+void useBigWigZoomLevels(bool);
+// Local copies of remote BigWig and BigBed files
+void setUrlCacheDirectory(char *);
+char * cachedUrl(char *);
+// Maximum number of files opened at once by lazy readers
+void setHandleBudget(int);
+int getHandleBudget();
 
 // Command line parser
 void rollYourOwn(int argc, char ** argv);
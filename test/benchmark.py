@@ -0,0 +1,61 @@
+import sys
+import os
+import time
+import random
+import shutil
+import subprocess
+
+# Throughput benchmarks on synthetic data.
+# Usage: python benchmark.py [lines]
+# The executable can be overridden with the WIGGLETOOLS environment variable.
+
+WIGGLETOOLS = os.environ.get('WIGGLETOOLS', '../bin/wiggletools')
+LINES = int(sys.argv[1]) if len(sys.argv) > 1 else 2000000
+CHROMOSOMES = ['chr1', 'chr10', 'chr2', 'chrX']
+
+def writeBedGraph(filename, lines):
+	random.seed(1)
+	out = open(filename, 'w')
+	per_chrom = lines // len(CHROMOSOMES)
+	for chrom in CHROMOSOMES:
+		pos = 0
+		for i in range(per_chrom):
+			pos += random.randint(0, 5)
+			length = random.randint(1, 50)
+			out.write('%s\t%i\t%i\t%.4f\n' % (chrom, pos, pos + length, random.random() * 100))
+			pos += length
+	out.close()
+	return per_chrom * len(CHROMOSOMES)
+
+def writeFixedStep(filename, lines):
+	random.seed(2)
+	out = open(filename, 'w')
+	per_chrom = lines // len(CHROMOSOMES)
+	for chrom in CHROMOSOMES:
+		out.write('fixedStep chrom=%s start=1 step=10 span=5\n' % chrom)
+		for i in range(per_chrom):
+			out.write('%.3f\n' % (random.random() * 100))
+	out.close()
+	return per_chrom * len(CHROMOSOMES)
+
+def timeCommand(cmd):
+	start = time.time()
+	assert subprocess.call(cmd, shell = True) == 0
+	return time.time() - start
+
+def report(name, lines, cmd):
+	seconds = timeCommand(cmd)
+	print('%-30s %10i lines %8.2f s %12.0f lines/s' % (name, lines, seconds, lines / seconds))
+
+if os.path.exists('tmp_benchmark'):
+	shutil.rmtree('tmp_benchmark')
+os.mkdir('tmp_benchmark')
+
+bg_lines = writeBedGraph('tmp_benchmark/benchmark.bg', LINES)
+wig_lines = writeFixedStep('tmp_benchmark/benchmark.wig', LINES)
+
+report('bedGraph parse', bg_lines, '%s do tmp_benchmark/benchmark.bg' % WIGGLETOOLS)
+report('fixedStep parse', wig_lines, '%s do tmp_benchmark/benchmark.wig' % WIGGLETOOLS)
+report('bedGraph seek', bg_lines, '%s do seek chrX 1 1000000 tmp_benchmark/benchmark.bg' % WIGGLETOOLS)
+
+shutil.rmtree('tmp_benchmark')
@@ -0,0 +1,150 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark of the column kernels behind the block reducers.
+// Each kernel supported by the CPU is run over a synthetic block, with
+// a few NaNs and random in play bitmaps, and its results are checked
+// against the scalar kernel's.
+// Usage: kernelBenchmark [passes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "blockKernels.h"
+
+#define ROWS 256
+#define COLUMNS 64
+#define WORDS (ROWS / 64)
+#define OPERATIONS 9
+
+static const char * operations[OPERATIONS] = {"add", "addFloat", "multiply", "max", "min", "inPlay", "squaredError", "squaredErrorInPlay", "countPositive"};
+
+static double values[COLUMNS * ROWS];
+static uint64_t inplay[COLUMNS * WORDS];
+static double means[ROWS];
+
+static void makeBlock() {
+	int index, row;
+	srand(1);
+	for (index = 0; index < COLUMNS * ROWS; index++)
+		values[index] = rand() % 1000 == 0? NAN: (rand() - RAND_MAX / 2) / 1e6;
+	for (index = 0; index < COLUMNS * WORDS; index++)
+		inplay[index] = ((uint64_t) rand() << 32) ^ rand();
+	for (row = 0; row < ROWS; row++)
+		means[row] = rand() / 1e9;
+}
+
+// Runs one operation over all the columns of the block
+static void run(BlockKernels * kernels, int operation, double * results, int length) {
+	int column;
+
+	for (column = 0; column < COLUMNS; column++) {
+		double * column_values = values + column * ROWS;
+		uint64_t * column_inplay = inplay + column * WORDS;
+		switch (operation) {
+		case 0:
+			kernels->add(results, column_values, length);
+			break;
+		case 1:
+			kernels->addFloat(results, column_values, length);
+			break;
+		case 2:
+			kernels->multiply(results, column_values, length);
+			break;
+		case 3:
+			kernels->max(results, column_values, length);
+			break;
+		case 4:
+			kernels->min(results, column_values, length);
+			break;
+		case 5:
+			kernels->inPlay(results, column_values, column_inplay, length);
+			break;
+		case 6:
+			kernels->squaredError(results, means, column_values, length);
+			break;
+		case 7:
+			kernels->squaredErrorInPlay(results, means, column_values, column_inplay, length);
+			break;
+		case 8:
+			kernels->countPositive(results, column_values, length);
+			break;
+		}
+	}
+}
+
+static void reset(double * results) {
+	int row;
+	for (row = 0; row < ROWS; row++)
+		results[row] = 1;
+}
+
+static bool sameResults(double * A, double * B) {
+	int row;
+	for (row = 0; row < ROWS; row++)
+		if (!(isnan(A[row]) && isnan(B[row])) && memcmp(A + row, B + row, sizeof(double)))
+			return false;
+	return true;
+}
+
+static double now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec + time.tv_usec / 1e6;
+}
+
+int main(int argc, char ** argv) {
+	int passes = argc > 1? atoi(argv[1]): 20000;
+	const char * names[] = {"scalar", "avx2", "avx512"};
+	BlockKernels * scalar = findBlockKernels("scalar");
+	double expected[ROWS], results[ROWS];
+	int name, operation, pass, length;
+	bool success = true;
+
+	makeBlock();
+	for (name = 0; name < 3; name++) {
+		BlockKernels * kernels = findBlockKernels(names[name]);
+		if (!kernels) {
+			printf("%-8s not supported\n", names[name]);
+			continue;
+		}
+		for (operation = 0; operation < OPERATIONS; operation++) {
+			double start, seconds;
+
+			// Including rows left over by the vector loops
+			for (length = ROWS - 7; length <= ROWS; length++) {
+				reset(expected);
+				run(scalar, operation, expected, length);
+				reset(results);
+				run(kernels, operation, results, length);
+				if (!sameResults(expected, results)) {
+					printf("%-8s %-20s differs from scalar over %i rows\n", names[name], operations[operation], length);
+					success = false;
+				}
+			}
+
+			start = now();
+			for (pass = 0; pass < passes; pass++) {
+				reset(results);
+				run(kernels, operation, results, ROWS);
+			}
+			seconds = now() - start;
+			printf("%-8s %-20s %14.0f values/s\n", names[name], operations[operation], (double) passes * COLUMNS * ROWS / seconds);
+		}
+	}
+	return success? 0: 1;
+}
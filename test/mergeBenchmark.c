@@ -0,0 +1,116 @@
+// Copyright [1999-2017] EMBL-European Bioinformatics Institute
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark of the priority queues behind the multiplexer.
+// Synthetic inputs, each a sorted run of non-overlapping intervals, are
+// merged with the same event loop as the multiplexer, first with
+// Fibonacci heaps then with tournament trees.
+// Usage: mergeBenchmark [intervals]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "fib.h"
+#include "tournament.h"
+
+typedef struct input_st {
+	unsigned int seed;
+	int remaining;
+	int start;
+	int finish;
+} Input;
+
+static void nextInterval(Input * input) {
+	input->seed = input->seed * 1103515245 + 12345;
+	input->start = input->finish + (input->seed >> 16) % 10;
+	input->seed = input->seed * 1103515245 + 12345;
+	input->finish = input->start + 1 + (input->seed >> 16) % 50;
+	input->remaining--;
+}
+
+static Input * makeInputs(int count, int intervals) {
+	Input * inputs = calloc(count, sizeof(Input));
+	int index;
+	for (index = 0; index < count; index++) {
+		inputs[index].seed = index + 1;
+		inputs[index].remaining = intervals / count;
+		nextInterval(inputs + index);
+	}
+	return inputs;
+}
+
+static double now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec + time.tv_usec / 1e6;
+}
+
+// Event loop of the multiplexer, over a single chromosome
+#define MERGE(QUEUE, MAKE, PREFIX) \
+static long merge_##PREFIX(Input * inputs, int count) { \
+	QUEUE * starts = MAKE; \
+	QUEUE * finishes = MAKE; \
+	long events = 0; \
+	int inplay = 0, start = 0, finish = 0, index; \
+	for (index = 0; index < count; index++) \
+		PREFIX##_insert(starts, inputs[index].start, index); \
+	while (true) { \
+		while (PREFIX##_notempty(finishes) && PREFIX##_min(finishes) == finish) { \
+			index = PREFIX##_extractmin(finishes); \
+			inplay--; \
+			events++; \
+			if (inputs[index].remaining > 0) { \
+				nextInterval(inputs + index); \
+				PREFIX##_insert(starts, inputs[index].start, index); \
+			} \
+		} \
+		if (PREFIX##_empty(starts) && PREFIX##_empty(finishes)) \
+			break; \
+		start = inplay? finish: PREFIX##_min(starts); \
+		while (PREFIX##_notempty(starts) && PREFIX##_min(starts) == start) { \
+			index = PREFIX##_extractmin(starts); \
+			PREFIX##_insert(finishes, inputs[index].finish, index); \
+			inplay++; \
+		} \
+		finish = PREFIX##_min(finishes); \
+		if (PREFIX##_notempty(starts) && PREFIX##_min(starts) < finish) \
+			finish = PREFIX##_min(starts); \
+	} \
+	return events; \
+}
+
+MERGE(FibHeap, fh_makeheap(), fh)
+MERGE(TournamentTree, tt_make(count), tt)
+
+static void report(const char * name, int count, int intervals, long (*merge)(Input *, int)) {
+	Input * inputs = makeInputs(count, intervals);
+	double start = now();
+	long events = merge(inputs, count);
+	double seconds = now() - start;
+	printf("%-16s %6i inputs %10li events %8.2f s %14.0f events/s\n", name, count, events, seconds, events / seconds);
+	free(inputs);
+}
+
+int main(int argc, char ** argv) {
+	int intervals = argc > 1? atoi(argv[1]): 4000000;
+	int counts[] = {2, 64, 4096};
+	int index;
+
+	for (index = 0; index < 3; index++) {
+		report("Fibonacci heap", counts[index], intervals, &merge_fh);
+		report("Tournament tree", counts[index], intervals, &merge_tt);
+	}
+	return 0;
+}
@@ -1,7 +1,10 @@
 import sys
 import os
 import shutil
+import socket
+import struct
 import subprocess
+import time
 
 def test(cmd):
 	print('Testing: %s' % cmd)
@@ -27,6 +30,16 @@ assert test('../bin/wiggletools diff fixedStep.bw variableStep.wig fixedStep.wig
 # Positive control
 assert test('../bin/wiggletools do isZero diff fixedStep.bw fixedStep.wig') == 0
 
+# Testing a single decoding thread shared by several readers
+assert test('../bin/wiggletools --threads 1 do isZero diff sum fixedStep.bw variableStep.bw : sum fixedStep.wig variableStep.wig') == 0
+
+# Testing files which are closed then reopened, as only one may be open at a time
+assert test('../bin/wiggletools --handles 1 do isZero diff sum fixedStep.bw variableStep.bw fixedStep.bw : sum fixedStep.wig variableStep.wig fixedStep.wig') == 0
+assert test('../bin/wiggletools --handles 1 do isZero diff sum bam.bam cram.cram : scale 2 pileup.bg') == 0
+
+# Testing zoom level summaries, which fall back onto base level data for narrow bins
+assert test('../bin/wiggletools --zoom do isZero diff bin 2 fixedStep.bw bin 2 fixedStep.wig') == 0
+
 # Testing ratios and offset
 assert test('../bin/wiggletools do isZero offset -1 ratio variableStep.bw variableStep.wig') == 0
 
@@ -36,23 +49,64 @@ assert test('../bin/wiggletools do isZero diff bam.bam pileup.bg') == 0
 # Testing BAM & CRAM
 assert test('../bin/wiggletools do isZero diff bam.bam cram.cram') == 0
 
+# Testing read filters, which do nothing when empty
+assert test('../bin/wiggletools do isZero diff readFilter exclude 0 bam.bam pileup.bg') == 0
+assert test('../bin/wiggletools do isZero readFilter minMAPQ 256 bam.bam') == 0
+
+# Testing read filters which drop the reverse strand reads, but not the others
+assert test("awk '/^@/ || $2 == 0' sam.sam > tmp/forward.sam && awk '/^@/ || $2 == 16' sam.sam > tmp/reverse.sam") == 0
+assert test('../bin/wiggletools do isZero readFilter exclude 16 bam.bam') == 1
+assert test('../bin/wiggletools do isZero diff readFilter exclude 16 bam.bam bam.bam') == 1
+assert test('../bin/wiggletools do isZero diff readFilter exclude 16 bam.bam tmp/forward.sam') == 0
+assert test('../bin/wiggletools do isZero diff readFilter require 16 bam.bam tmp/reverse.sam') == 0
+assert test('../bin/wiggletools do isZero diff readFilter exclude 16 read_count bam.bam read_count tmp/forward.sam') == 0
+assert test('../bin/wiggletools do isZero diff sum bams exclude 16 bam.bam cram.cram : scale 2 tmp/forward.sam') == 0
+os.remove('tmp/forward.sam')
+os.remove('tmp/reverse.sam')
+
+# Testing fragment coverage, split by strand or not
+assert test('../bin/wiggletools do isZero diff fragments 100 bam.bam sum strands 100 bam.bam') == 0
+
+# Testing coverage matrices of several BAM files
+assert test('../bin/wiggletools do isZero diff sum bams bam.bam cram.cram : scale 2 pileup.bg') == 0
+assert test('../bin/wiggletools do isZero diff sum strict bams bam.bam cram.cram : scale 2 pileup.bg') == 0
+
+# Testing tiled BAM pileups
+assert test('../bin/wiggletools --tiles 100 do isZero diff bam.bam pileup.bg') == 0
+assert test('../bin/wiggletools --tiles 100 do isZero diff read_count bam.bam read_count sam.sam') == 0
+assert test('../bin/wiggletools --tiles 100 --lookahead 4 do isZero diff cram.cram pileup.bg') == 0
+assert test('../bin/wiggletools --tiles 100 --lookahead 4 do isZero diff read_count cram.cram read_count sam.sam') == 0
+
 # Testing BAM & SAM
 assert test('../bin/wiggletools do isZero diff bam.bam sam.sam') == 0
 
 # Testing fast BAM and SAM
 assert test('../bin/wiggletools do isZero diff read_count bam.bam read_count sam.sam') == 0
 
+# Testing streamed wiggle
+assert test('cat fixedStep.wig | ../bin/wiggletools do isZero diff fixedStep.wig -') == 0
+
 # Testing BAM & SAM
 assert test('cat sam.sam | ../bin/wiggletools do isZero diff bam.bam sam -') == 0
+assert test('cat sam.sam | ../bin/wiggletools --threads 1 do isZero diff bam.bam sam -') == 0
+
+# Testing seeks into reducers
+assert test('../bin/wiggletools do isZero diff seek chr1 5 300 sum fixedStep.wig variableStep.wig : sum seek chr1 5 300 fixedStep.wig seek chr1 5 300 variableStep.wig') == 0
 
 # Testing Bed and BigBed
 assert test('../bin/wiggletools do isZero diff overlapping.bed overlapping.bb') == 0
+assert test('../bin/wiggletools do isZero diff scale 1000 coverage overlapping.bed score overlapping.bb') == 0
+assert test('../bin/wiggletools do isZero diff scored.bed scored.bb') == 0
+assert test('../bin/wiggletools write_bg tmp/scored_score.bg score scored.bb') == 0
+assert test('../bin/wiggletools write_bg tmp/scored_column.bg column 6 scored.bb') == 0
+assert test('../bin/wiggletools do isZero seek chr1 2 6 diff score scored.bb column 5 scored.bb') == 0
 
 # Testing Wig and BigWig
 assert test('../bin/wiggletools do isZero diff variableStep.bw variableStep.wig') == 0
 
 # Testing VCF and BCF
 assert test('../bin/wiggletools do isZero diff vcf.vcf bcf.bcf') == 0
+assert test('../bin/wiggletools do isZero diff vcf.vcf vcf.vcf.gz') == 0
 
 # Testing BAM & BedGraph
 assert test('../bin/wiggletools do isZero seek GL000200.1 1 1000 diff bam.bam pileup.bg') == 0
@@ -65,16 +119,102 @@ assert test('../bin/wiggletools do isZero seek GL000200.1 1 1000 diff sam.sam pi
 
 # Testing Bed and BigBed
 assert test('../bin/wiggletools do isZero seek chr1 2 6 diff overlapping.bed overlapping.bb') == 0
+assert test('../bin/wiggletools do isZero seek chr1 2 6 diff scale 1000 coverage overlapping.bed score overlapping.bb') == 0
+
+# Testing bgzipped and tabix indexed files
+assert test('../bin/wiggletools do isZero diff fixedStep.wig fixedStep.wig.gz') == 0
+assert test('../bin/wiggletools do isZero diff pileup.bg pileup.bg.gz') == 0
+assert test('../bin/wiggletools do isZero diff overlapping.bed overlapping.bed.gz') == 0
+assert test('../bin/wiggletools do isZero seek GL000200.1 1 1000 diff pileup.bg pileup.bg.gz') == 0
+assert test('../bin/wiggletools do isZero seek chr1 2 6 diff overlapping.bed overlapping.bed.gz') == 0
+
+# Testing gzipped files and formats recognised from their content
+assert test('gzip -c pileup.bg > tmp/pileup.gz && ../bin/wiggletools do isZero diff pileup.bg tmp/pileup.gz') == 0
+assert test('../bin/wiggletools do isZero seek GL000200.1 1 1000 diff pileup.bg tmp/pileup.gz') == 0
+assert test('cp overlapping.bed tmp/overlapping.txt && ../bin/wiggletools do isZero diff overlapping.bed tmp/overlapping.txt') == 0
+assert test('gzip -c variableStep.wig | ../bin/wiggletools do isZero diff variableStep.wig -') == 0
+os.remove('tmp/pileup.gz')
+os.remove('tmp/overlapping.txt')
+
+# Testing sidecar wiggle index
+assert test('cp variableStep.wig tmp/indexed.wig && ../bin/wiggletools index tmp/indexed.wig') == 0
+assert test('../bin/wiggletools do isZero seek chr1 2 6 diff variableStep.wig tmp/indexed.wig') == 0
+os.remove('tmp/indexed.wig')
+os.remove('tmp/indexed.wig.wti')
+
+# Testing seeks from sampled index entries, past the first records of a chromosome
+large = open('tmp/large.wig', 'w')
+large.write('variableStep chrom=chr1 span=1\n')
+for position in range(1, 20001):
+	large.write('%i\t%i\n' % (2 * position, position % 7))
+large.close()
+shutil.copy('tmp/large.wig', 'tmp/unindexed.wig')
+assert test('../bin/wiggletools index tmp/large.wig') == 0
+assert test('../bin/wiggletools do isZero seek chr1 30000 30100 tmp/large.wig') == 1
+assert test('../bin/wiggletools do isZero seek chr1 30000 30100 diff tmp/large.wig tmp/unindexed.wig') == 0
+# Same size, different modification time
+os.utime('tmp/large.wig', (1, 1))
+assert test('../bin/wiggletools seek chr1 30000 30100 tmp/large.wig 2>&1 > /dev/null | grep -q "out of date"') == 0
+os.remove('tmp/large.wig')
+os.remove('tmp/large.wig.wti')
+os.remove('tmp/unindexed.wig')
+
+# Testing binary cache files
+assert test('../bin/wiggletools cache tmp/pileup.wtc pileup.bg') == 0
+assert test('../bin/wiggletools do isZero diff pileup.bg tmp/pileup.wtc') == 0
+assert test('../bin/wiggletools do isZero seek GL000200.1 1 1000 diff pileup.bg tmp/pileup.wtc') == 0
+assert test('../bin/wiggletools cache tmp/overlapping.wtc overlapping.bed') == 0
+assert test('../bin/wiggletools do isZero seek chr1 2 6 diff overlapping.bed tmp/overlapping.wtc') == 0
+assert test('../bin/wiggletools cache tmp/overlapping.wtc overlapping.bed') == 1
+assert test('head -c 100 tmp/overlapping.wtc > tmp/truncated.wtc && ../bin/wiggletools tmp/truncated.wtc') == 1
+# Starts of the first chromosome pointing at the chromosome table
+cache = open('tmp/overlapping.wtc', 'rb').read()
+table_offset = struct.unpack_from('q', cache, 16)[0]
+open('tmp/corrupt.wtc', 'wb').write(cache[:table_offset + 16] + struct.pack('q', table_offset) + cache[table_offset + 24:])
+assert test('../bin/wiggletools tmp/corrupt.wtc') == 1
+os.remove('tmp/pileup.wtc')
+os.remove('tmp/overlapping.wtc')
+os.remove('tmp/truncated.wtc')
+os.remove('tmp/corrupt.wtc')
 
 # Testing Wig and BigWig
 assert test('../bin/wiggletools do isZero seek chr1 2 6 diff variableStep.bw variableStep.wig') == 0
 
+# Testing the local cache of remote files, including when the server is gone
+probe = socket.socket()
+probe.bind(('localhost', 0))
+port = probe.getsockname()[1]
+probe.close()
+url = 'http://localhost:%i/fixedStep.bw' % port
+server = subprocess.Popen([sys.executable, '-m', 'SimpleHTTPServer' if sys.version_info[0] == 2 else 'http.server', str(port)], stdout = open(os.devnull, 'w'), stderr = subprocess.STDOUT)
+for attempt in range(100):
+	try:
+		socket.create_connection(('localhost', port)).close()
+		break
+	except socket.error:
+		time.sleep(0.1)
+assert test('../bin/wiggletools --cache tmp/url_cache do isZero diff fixedStep.bw %s' % url) == 0
+assert test('WIGGLETOOLS_CACHE_AGE=0 ../bin/wiggletools --cache tmp/url_cache do isZero diff fixedStep.bw %s' % url) == 0
+server.terminate()
+server.wait()
+assert test('WIGGLETOOLS_CACHE_AGE=0 ../bin/wiggletools --cache tmp/url_cache do isZero diff fixedStep.bw %s' % url) == 0
+assert test('../bin/wiggletools --cache tmp/url_cache do isZero diff fixedStep.bw %s' % url) == 0
+shutil.rmtree('tmp/url_cache')
+
 # Testing VCF and BCF
 assert test('../bin/wiggletools do isZero seek chr1 2 6 diff vcf.vcf bcf.bcf') == 0
+assert test('../bin/wiggletools do isZero seek chr1 2 6 diff vcf.vcf vcf.vcf.gz') == 0
 
 # Testing sum, scale and multiplexers
 assert test('../bin/wiggletools do isZero diff sum fixedStep.bw fixedStep.bw : scale 2 fixedStep.bw') == 0
 
+# Testing incremental reductions over many inputs
+assert test('../bin/wiggletools do isZero diff sum fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig : scale 8 sum fixedStep.wig variableStep.wig') == 0
+assert test('../bin/wiggletools do isZero diff var fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig fixedStep.wig variableStep.wig : var fixedStep.wig variableStep.wig') == 0
+
+# Testing vector kernels against scalar ones
+assert testOutput('WIGGLETOOLS_KERNELS=scalar ../bin/wiggletools stddev fixedStep.wig variableStep.wig overlapping.bed') == testOutput('../bin/wiggletools stddev fixedStep.wig variableStep.wig overlapping.bed')
+
 # Testing open-ended lists
 assert test('../bin/wiggletools do isZero diff sum fixedStep.bw fixedStep.bw : sum fixedStep.bw fixedStep.bw ') == 0
 
@@ -118,6 +258,9 @@ assert test('../bin/wiggletools write_bg tmp/nearest_overlapping.bg nearest vari
 # Test nearest #1
 assert test('../bin/wiggletools write_bg tmp/nearest_fixedStep.bg nearest variableStep.wig fixedStep.bw') == 0
 
+# Test entropy
+assert test('../bin/wiggletools write_bg tmp/entropy.bg entropy fixedStep.wig variableStep.wig') == 0
+
 # Test min
 assert float(testOutput('../bin/wiggletools print - minI fixedStep.wig')) == 0
 